@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -8,14 +9,21 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/cappolicy.h>
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdint.h>
 
 #include "capsicum.h"
 #include "syscalls.h"
 #include "capsicum-test.h"
+#include "capsicum-fd.h"
 
 /* Utilities for printing rights information */
 /* Written in C style to allow for: */
@@ -668,6 +676,317 @@ FORK_TEST_ON(Capability, Operations, TmpFile("cap_fd_operations")) {
   close(fd);
 }
 
+// The bulk and zero-copy I/O syscalls that capability mode allows are still
+// subject to the rights on the descriptors they use.
+FORK_TEST_ON(Capability, BulkIOOperations, TmpFile("cap_bulk_io")) {
+  int fd = open(TmpFile("cap_bulk_io"), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  EXPECT_OK(fd);
+  if (fd < 0) return;
+  EXPECT_OK(write(fd, "0123456789", 10));
+
+  cap_rights_t r_ro;
+  cap_rights_init(&r_ro, CAP_READ, CAP_FSTAT);
+  cap_rights_t r_wo;
+  cap_rights_init(&r_wo, CAP_WRITE, CAP_FSTAT);
+  cap_rights_t r_pread;
+  cap_rights_init(&r_pread, CAP_PREAD, CAP_FSTAT);
+  cap_rights_t r_pwrite;
+  cap_rights_init(&r_pwrite, CAP_PWRITE, CAP_FTRUNCATE, CAP_FSTAT);
+
+  int cap_ro = dup(fd);
+  EXPECT_OK(cap_ro);
+  EXPECT_OK(cap_rights_limit(cap_ro, &r_ro));
+  int cap_wo = dup(fd);
+  EXPECT_OK(cap_wo);
+  EXPECT_OK(cap_rights_limit(cap_wo, &r_wo));
+  int cap_pread = dup(fd);
+  EXPECT_OK(cap_pread);
+  EXPECT_OK(cap_rights_limit(cap_pread, &r_pread));
+  int cap_pwrite = dup(fd);
+  EXPECT_OK(cap_pwrite);
+  EXPECT_OK(cap_rights_limit(cap_pwrite, &r_pwrite));
+
+  int pipe_in[2];
+  EXPECT_OK(pipe2(pipe_in, O_NONBLOCK));
+  int pipe_out[2];
+  EXPECT_OK(pipe2(pipe_out, O_NONBLOCK));
+  EXPECT_OK(write(pipe_in[1], "1234", 4));
+  int cap_in_wo = dup(pipe_in[0]);
+  EXPECT_OK(cap_in_wo);
+  EXPECT_OK(cap_rights_limit(cap_in_wo, &r_wo));
+  int cap_out_ro = dup(pipe_out[1]);
+  EXPECT_OK(cap_out_ro);
+  EXPECT_OK(cap_rights_limit(cap_out_ro, &r_ro));
+
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  EXPECT_OK(timer_fd);
+  int cap_timer_ro = dup(timer_fd);
+  EXPECT_OK(cap_timer_ro);
+  EXPECT_OK(cap_rights_limit(cap_timer_ro, &r_ro));
+
+  EXPECT_OK(cap_enter());  // Enter capability mode.
+
+  char buffer[4];
+  struct iovec io;
+  io.iov_base = buffer;
+  io.iov_len = sizeof(buffer);
+#ifdef HAVE_PREADV2
+  // The file position needs CAP_READ/CAP_WRITE; an offset needs CAP_SEEK too.
+  EXPECT_NOTCAPABLE(preadv2_(cap_wo, &io, 1, -1, 0));
+  EXPECT_OK(preadv2_(cap_ro, &io, 1, -1, 0));
+  EXPECT_NOTCAPABLE(preadv2_(cap_ro, &io, 1, 0, 0));
+  EXPECT_OK(preadv2_(cap_pread, &io, 1, 0, 0));
+  EXPECT_NOTCAPABLE(pwritev2_(cap_ro, &io, 1, -1, 0));
+  EXPECT_OK(pwritev2_(cap_wo, &io, 1, -1, 0));
+  EXPECT_NOTCAPABLE(pwritev2_(cap_wo, &io, 1, 0, 0));
+  EXPECT_OK(pwritev2_(cap_pwrite, &io, 1, 0, 0));
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+  loff_t off_in = 0;
+  loff_t off_out = 20;
+  EXPECT_NOTCAPABLE(copy_file_range_(cap_wo, &off_in, fd, &off_out, 1, 0));
+  EXPECT_NOTCAPABLE(copy_file_range_(fd, &off_in, cap_ro, &off_out, 1, 0));
+  EXPECT_FAIL_NOT_NOTCAPABLE(copy_file_range_(cap_pread, &off_in, cap_pwrite, &off_out, 1, 0));
+#endif
+#ifdef HAVE_FALLOCATE
+  EXPECT_NOTCAPABLE(fallocate(cap_ro, 0, 0, 20));
+  EXPECT_NOTCAPABLE(fallocate(cap_pread, 0, 0, 20));
+  EXPECT_FAIL_NOT_NOTCAPABLE(fallocate(cap_pwrite, 0, 0, 20));
+#endif
+#ifdef HAVE_SPLICE
+  EXPECT_NOTCAPABLE(splice(cap_in_wo, NULL, pipe_out[1], NULL, 4, SPLICE_F_NONBLOCK));
+  EXPECT_NOTCAPABLE(splice(pipe_in[0], NULL, cap_out_ro, NULL, 4, SPLICE_F_NONBLOCK));
+#endif
+#ifdef HAVE_TEE
+  EXPECT_NOTCAPABLE(tee(cap_in_wo, pipe_out[1], 4, SPLICE_F_NONBLOCK));
+  EXPECT_NOTCAPABLE(tee(pipe_in[0], cap_out_ro, 4, SPLICE_F_NONBLOCK));
+  EXPECT_OK(tee(pipe_in[0], pipe_out[1], 4, SPLICE_F_NONBLOCK));
+#endif
+  struct itimerspec ispec;
+  memset(&ispec, 0, sizeof(ispec));
+  ispec.it_value.tv_sec = 100;
+  EXPECT_NOTCAPABLE(timerfd_settime(cap_timer_ro, 0, &ispec, NULL));
+  EXPECT_OK(timerfd_settime(timer_fd, 0, &ispec, NULL));
+
+  close(cap_timer_ro);
+  close(timer_fd);
+  close(cap_out_ro);
+  close(cap_in_wo);
+  close(pipe_out[0]);
+  close(pipe_out[1]);
+  close(pipe_in[0]);
+  close(pipe_in[1]);
+  close(cap_pwrite);
+  close(cap_pread);
+  close(cap_wo);
+  close(cap_ro);
+  close(fd);
+}
+
+#ifdef CAP_RIGHTS_VERSION
+// The same operations through cap_fd<>, whose type decides which of them are
+// available.  TYPED_OP(name, expr) defines Has_name<T>, true if expr compiles
+// for a const T& fd, and Typed_name(fd, has) which runs expr if so, or the
+// equivalent raw call on cfd = fd.get() if not.
+static char typed_buf[1];
+static struct stat typed_sb;
+static struct statfs typed_sf;
+static long MmapResult(void *p) {
+  if (p == MAP_FAILED) return -1;
+  munmap(p, getpagesize());
+  return 0;
+}
+
+#define TYPED_OP(NAME, EXPR, RAW)                                             \
+  template <typename T>                                                       \
+  auto TypedDo_##NAME(const T& fd) -> decltype((long)(EXPR)) {                \
+    return (long)(EXPR);                                                      \
+  }                                                                           \
+  template <typename T, typename = void>                                      \
+  struct Has_##NAME : std::false_type {};                                     \
+  template <typename T>                                                       \
+  struct Has_##NAME<T, decltype((void)TypedDo_##NAME(std::declval<const T&>()))> \
+      : std::true_type {};                                                    \
+  template <typename T>                                                       \
+  long Typed_##NAME(const T& fd, std::true_type) { return TypedDo_##NAME(fd); } \
+  template <typename T>                                                       \
+  long Typed_##NAME(const T& fd, std::false_type) {                           \
+    int cfd = fd.get();                                                       \
+    return (long)(RAW);                                                       \
+  }
+
+TYPED_OP(read, fd.read(typed_buf, 1), read(cfd, typed_buf, 1))
+TYPED_OP(pread, fd.pread(typed_buf, 1, 0), pread(cfd, typed_buf, 1, 0))
+TYPED_OP(write, fd.write(typed_buf, 1), write(cfd, typed_buf, 1))
+TYPED_OP(pwrite, fd.pwrite(typed_buf, 1, 0), pwrite(cfd, typed_buf, 1, 0))
+TYPED_OP(lseek, fd.lseek(0, SEEK_SET), lseek(cfd, 0, SEEK_SET))
+TYPED_OP(mmap, MmapResult(fd.template mmap<PROT_NONE>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_NONE, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_r, MmapResult(fd.template mmap<PROT_READ>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_w, MmapResult(fd.template mmap<PROT_WRITE>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_WRITE, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_x, MmapResult(fd.template mmap<PROT_EXEC>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_EXEC, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_rw, MmapResult(fd.template mmap<PROT_READ|PROT_WRITE>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_rx, MmapResult(fd.template mmap<PROT_READ|PROT_EXEC>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_READ|PROT_EXEC, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_wx, MmapResult(fd.template mmap<PROT_WRITE|PROT_EXEC>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_WRITE|PROT_EXEC, MAP_SHARED, cfd, 0)))
+TYPED_OP(mmap_rwx, MmapResult(fd.template mmap<PROT_READ|PROT_WRITE|PROT_EXEC>(NULL, getpagesize(), MAP_SHARED, 0)),
+         MmapResult(mmap(NULL, getpagesize(), PROT_READ|PROT_WRITE|PROT_EXEC, MAP_SHARED, cfd, 0)))
+TYPED_OP(fsync, fd.fsync(), fsync(cfd))
+TYPED_OP(getfl, fd.getfl(), fcntl(cfd, F_GETFL))
+TYPED_OP(setfl, fd.setfl(O_RDWR), fcntl(cfd, F_SETFL, O_RDWR))
+TYPED_OP(fchown, fd.fchown(-1, -1), fchown(cfd, -1, -1))
+TYPED_OP(fchmod, fd.fchmod(0644), fchmod(cfd, 0644))
+TYPED_OP(flock, fd.flock(LOCK_SH) | fd.flock(LOCK_UN), flock(cfd, LOCK_SH))
+TYPED_OP(ftruncate, fd.ftruncate(0), ftruncate(cfd, 0))
+TYPED_OP(fstat, fd.fstat(&typed_sb), fstat(cfd, &typed_sb))
+TYPED_OP(fstatfs, fd.fstatfs(&typed_sf), fstatfs(cfd, &typed_sf))
+TYPED_OP(futimes, fd.futimes(NULL), futimes(cfd, NULL))
+#ifdef HAVE_FPATHCONF
+TYPED_OP(fpathconf, fd.fpathconf(_PC_NAME_MAX), fpathconf(cfd, _PC_NAME_MAX))
+#endif
+
+// Whatever the type offers works; anything it doesn't would have failed.
+#define CHECK_TYPED_OP(fd, NAME) do {                                   \
+  typedef Has_##NAME<typename std::decay<decltype(fd)>::type> has;      \
+  long rc = Typed_##NAME((fd), has());                                  \
+  if (has::value) {                                                     \
+    EXPECT_OK(rc) << " typed " #NAME;                                   \
+  } else {                                                              \
+    EXPECT_EQ(-1, rc) << " raw " #NAME;                                 \
+    EXPECT_EQ(ENOTCAPABLE, errno) << " raw " #NAME;                     \
+  }                                                                     \
+} while (0)
+
+template <uint64_t... Rights>
+static void TryTypedFileOps(int fd) {
+  typedef cap_fd<Rights...> fd_type;
+  fd_type cap = fd_type::limit(dup(fd));
+  EXPECT_TRUE(cap.valid()) << " errno " << errno;
+  if (!cap.valid()) return;
+  cap_rights_t erights;
+  EXPECT_OK(cap_rights_get(cap.get(), &erights));
+  EXPECT_RIGHTS_EQ(&fd_type::rights, &erights);
+
+  // Check creation of a capability from a capability.
+  fd_type cap_cap = cap.template dup_narrow<Rights...>();
+  EXPECT_TRUE(cap_cap.valid());
+  EXPECT_NE(cap.get(), cap_cap.get());
+  EXPECT_OK(cap_rights_get(cap_cap.get(), &erights));
+  EXPECT_RIGHTS_EQ(&fd_type::rights, &erights);
+  cap_cap.reset();
+
+  CHECK_TYPED_OP(cap, read);
+  CHECK_TYPED_OP(cap, pread);
+  CHECK_TYPED_OP(cap, write);
+  CHECK_TYPED_OP(cap, pwrite);
+  CHECK_TYPED_OP(cap, lseek);
+  CHECK_TYPED_OP(cap, mmap);
+  CHECK_TYPED_OP(cap, mmap_r);
+  CHECK_TYPED_OP(cap, mmap_w);
+  CHECK_TYPED_OP(cap, mmap_x);
+  CHECK_TYPED_OP(cap, mmap_rw);
+  CHECK_TYPED_OP(cap, mmap_rx);
+  CHECK_TYPED_OP(cap, mmap_wx);
+  CHECK_TYPED_OP(cap, mmap_rwx);
+  CHECK_TYPED_OP(cap, fsync);
+  CHECK_TYPED_OP(cap, getfl);
+  CHECK_TYPED_OP(cap, setfl);
+  CHECK_TYPED_OP(cap, fchown);
+  CHECK_TYPED_OP(cap, fchmod);
+  CHECK_TYPED_OP(cap, flock);
+  CHECK_TYPED_OP(cap, ftruncate);
+  CHECK_TYPED_OP(cap, fstat);
+  CHECK_TYPED_OP(cap, fstatfs);
+  CHECK_TYPED_OP(cap, futimes);
+#ifdef HAVE_FPATHCONF
+  CHECK_TYPED_OP(cap, fpathconf);
+#endif
+}
+
+// Operations a type lacks aren't there to call at all.
+static_assert(Has_pread<cap_fd<CAP_PREAD>>::value, "pread missing");
+static_assert(!Has_pread<cap_fd<CAP_READ, CAP_WRITE>>::value, "pread without CAP_PREAD");
+static_assert(!Has_write<cap_fd<CAP_READ, CAP_SEEK>>::value, "write without CAP_WRITE");
+static_assert(Has_mmap_r<cap_fd<CAP_MMAP_RW>>::value, "CAP_MMAP_RW includes CAP_MMAP_R");
+static_assert(!Has_mmap_w<cap_fd<CAP_MMAP_R>>::value, "PROT_WRITE without CAP_MMAP_W");
+static_assert(!Has_fstat<cap_fd<>>::value, "fstat with no rights");
+
+FORK_TEST_ON(Capability, TypedOperations, TmpFile("cap_typed_fd_operations")) {
+  int fd = open(TmpFile("cap_typed_fd_operations"), O_RDWR | O_CREAT, 0644);
+  EXPECT_OK(fd);
+  if (fd < 0) return;
+
+  EXPECT_OK(cap_enter());  // Enter capability mode.
+
+  TryTypedFileOps<CAP_READ>(fd);
+  TryTypedFileOps<CAP_PREAD>(fd);
+  TryTypedFileOps<CAP_WRITE>(fd);
+  TryTypedFileOps<CAP_PWRITE>(fd);
+  TryTypedFileOps<CAP_READ, CAP_WRITE>(fd);
+  TryTypedFileOps<CAP_PREAD, CAP_PWRITE>(fd);
+  TryTypedFileOps<CAP_SEEK>(fd);
+  TryTypedFileOps<CAP_FSTAT>(fd);
+  TryTypedFileOps<CAP_MMAP>(fd);
+  TryTypedFileOps<CAP_MMAP_R>(fd);
+  TryTypedFileOps<CAP_MMAP_W>(fd);
+  TryTypedFileOps<CAP_MMAP_X>(fd);
+  TryTypedFileOps<CAP_MMAP_RW>(fd);
+  TryTypedFileOps<CAP_MMAP_RX>(fd);
+  TryTypedFileOps<CAP_MMAP_WX>(fd);
+  TryTypedFileOps<CAP_MMAP_RWX>(fd);
+  TryTypedFileOps<CAP_FCNTL>(fd);
+  TryTypedFileOps<CAP_FSYNC>(fd);
+  TryTypedFileOps<CAP_FCHOWN>(fd);
+  TryTypedFileOps<CAP_FCHMOD>(fd);
+  TryTypedFileOps<CAP_FTRUNCATE>(fd);
+  TryTypedFileOps<CAP_FLOCK>(fd);
+  TryTypedFileOps<CAP_FSTATFS>(fd);
+  TryTypedFileOps<CAP_FPATHCONF>(fd);
+  TryTypedFileOps<CAP_FUTIMES>(fd);
+  TryTypedFileOps<>(fd);
+
+  close(fd);
+}
+
+TEST(Capability, TypedNarrow) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  auto full = cap_fd<CAP_READ, CAP_SEEK, CAP_FSTAT>::limit(fd);
+  EXPECT_TRUE(full.valid());
+  struct stat info;
+  EXPECT_OK(full.fstat(&info));
+
+  // A narrowed duplicate leaves the original alone...
+  cap_fd<CAP_READ, CAP_SEEK> no_stat = full.dup_narrow<CAP_READ, CAP_SEEK>();
+  EXPECT_TRUE(no_stat.valid());
+  EXPECT_TRUE(full.valid());
+  EXPECT_NOTCAPABLE(fstat(no_stat.get(), &info));
+  EXPECT_OK(full.fstat(&info));
+
+  // ...while narrowing in place consumes it.
+  int raw = full.get();
+  cap_fd<CAP_PREAD> pread_only = std::move(full).narrow<CAP_PREAD>();
+  EXPECT_FALSE(full.valid());
+  EXPECT_EQ(raw, pread_only.get());
+  char ch;
+  EXPECT_OK(pread_only.pread(&ch, 1, 0));
+  EXPECT_NOTCAPABLE(read(pread_only.get(), &ch, 1));
+  EXPECT_NOTCAPABLE(fstat(pread_only.get(), &info));
+  cap_rights_t rights;
+  EXPECT_OK(cap_rights_get(pread_only.get(), &rights));
+  EXPECT_RIGHTS_EQ(&cap_fd<CAP_PREAD>::rights, &rights);
+
+  // A failed limit gives an invalid descriptor.
+  auto bad = cap_fd<CAP_READ>::limit(-1);
+  EXPECT_FALSE(bad.valid());
+}
+#endif  /* CAP_RIGHTS_VERSION */
+
 #define TRY_DIR_OPS(dfd, ...) do {       \
   cap_rights_t rights;                   \
   cap_rights_init(&rights, __VA_ARGS__); \
@@ -1269,3 +1588,339 @@ TEST(Capability, NoBypassDAC) {
   close(fd);
   unlink(TmpFile("cap_root_owned"));
 }
+
+#ifdef __linux__
+TEST(Capability, LimitMany) {
+  const int kCount = 16;
+  int fds[kCount + 1];
+  int errors[kCount + 1];
+  for (int ii = 0; ii < kCount; ii++) {
+    fds[ii] = open("/etc/passwd", O_RDONLY);
+    EXPECT_OK(fds[ii]);
+  }
+  fds[kCount] = -1;  // One bad descriptor doesn't stop the others.
+
+  cap_rights_t r_rfi, r_got;
+  cap_rights_init(&r_rfi, CAP_READ, CAP_FSTAT, CAP_FCNTL, CAP_IOCTL);
+  memset(errors, 0xff, sizeof(errors));
+  EXPECT_SYSCALL_FAIL(EBADF, cap_rights_limit_many(fds, kCount + 1, &r_rfi, errors));
+  EXPECT_EQ(EBADF, errors[kCount]);
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_EQ(0, errors[ii]);
+    EXPECT_OK(cap_rights_get(fds[ii], &r_got));
+    EXPECT_RIGHTS_EQ(&r_rfi, &r_got);
+  }
+
+  cap_ioctl_t ioctl_nread = FIONREAD;
+  EXPECT_OK(cap_fcntls_limit_many(fds, kCount, CAP_FCNTL_GETFL, NULL));
+  EXPECT_OK(cap_ioctls_limit_many(fds, kCount, &ioctl_nread, 1, NULL));
+  // Narrower rights that keep CAP_FCNTL and CAP_IOCTL keep those limits...
+  cap_rights_t r_rfi_nostat;
+  cap_rights_init(&r_rfi_nostat, CAP_READ, CAP_FCNTL, CAP_IOCTL);
+  EXPECT_OK(cap_rights_limit_many(fds, kCount, &r_rfi_nostat, errors));
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_EQ(0, errors[ii]);
+    cap_fcntl_t fcntls;
+    EXPECT_OK(cap_fcntls_get(fds[ii], &fcntls));
+    EXPECT_EQ((cap_fcntl_t)CAP_FCNTL_GETFL, fcntls);
+    cap_ioctl_t ioctls[4];
+    EXPECT_EQ(1, cap_ioctls_get(fds[ii], ioctls, 4));
+    EXPECT_EQ(ioctl_nread, ioctls[0]);
+  }
+  // ...and rights without them drop them.
+  cap_rights_t r_r;
+  cap_rights_init(&r_r, CAP_READ);
+  EXPECT_OK(cap_rights_limit_many(fds, kCount, &r_r, NULL));
+  for (int ii = 0; ii < kCount; ii++) {
+    cap_fcntl_t fcntls;
+    EXPECT_OK(cap_fcntls_get(fds[ii], &fcntls));
+    EXPECT_EQ(0, (int)fcntls);
+    cap_ioctl_t ioctls[4];
+    EXPECT_EQ(0, cap_ioctls_get(fds[ii], ioctls, 4));
+  }
+  // Limits can't grow, whether one at a time or in bulk.
+  EXPECT_NOTCAPABLE(cap_rights_limit_many(fds, kCount, &r_rfi, errors));
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_EQ(ENOTCAPABLE, errors[ii]);
+  }
+
+  for (int ii = 0; ii < kCount; ii++) {
+    close(fds[ii]);
+  }
+}
+
+TEST(Capability, Policy) {
+  const char *text =
+      "# Roles for a small server\n"
+      "config  rights=READ,FSTAT,SEEK\n"
+      "log     rights=WRITE,FSTAT fcntls=GETFL   # append only\n"
+      "tty     rights=READ ioctls=0x541B,none\n"
+      "\n"
+      "plain   rights=READ,CAP_FCNTL,IOCTL\n";
+  int line = -1;
+  struct cap_policy *policy = cap_policy_compile(text, &line);
+  EXPECT_NE((struct cap_policy *)NULL, policy);
+  EXPECT_EQ(0, line);
+  if (!policy) return;
+  int r_config = cap_policy_role(policy, "config");
+  int r_log = cap_policy_role(policy, "log");
+  int r_tty = cap_policy_role(policy, "tty");
+  int r_plain = cap_policy_role(policy, "plain");
+  EXPECT_EQ(0, r_config);
+  EXPECT_EQ(1, r_log);
+  EXPECT_EQ(2, r_tty);
+  EXPECT_EQ(3, r_plain);
+  EXPECT_EQ(-1, cap_policy_role(policy, "other"));
+  EXPECT_EQ(ENOENT, errno);
+
+  const int kCount = 8;
+  int fds[kCount + 1];
+  int roles[kCount + 1];
+  int errors[kCount + 1];
+  for (int ii = 0; ii < kCount; ii++) {
+    fds[ii] = open("/etc/passwd", O_RDONLY);
+    EXPECT_OK(fds[ii]);
+    roles[ii] = ii % 5 - 1;  // -1 leaves the descriptor alone
+  }
+  fds[kCount] = -1;
+  roles[kCount] = r_config;
+  EXPECT_SYSCALL_FAIL(EBADF, cap_policy_apply(policy, fds, roles, kCount + 1, errors));
+  EXPECT_EQ(EBADF, errors[kCount]);
+
+  cap_rights_t r_all, r_rfs, r_wff, r_ri, r_rfi;
+  CAP_SET_ALL(&r_all);
+  cap_rights_init(&r_rfs, CAP_READ, CAP_FSTAT, CAP_SEEK);
+  cap_rights_init(&r_wff, CAP_WRITE, CAP_FSTAT, CAP_FCNTL);
+  cap_rights_init(&r_ri, CAP_READ, CAP_IOCTL);
+  cap_rights_init(&r_rfi, CAP_READ, CAP_FCNTL, CAP_IOCTL);
+  const cap_rights_t *expected[] = {&r_all, &r_rfs, &r_wff, &r_ri, &r_rfi};
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_EQ(0, errors[ii]);
+    cap_rights_t rights;
+    EXPECT_OK(cap_rights_get(fds[ii], &rights));
+    EXPECT_RIGHTS_EQ(expected[roles[ii] + 1], &rights);
+    if (roles[ii] >= 0) {
+      EXPECT_RIGHTS_EQ(cap_policy_rights(policy, roles[ii]), &rights);
+    }
+    cap_fcntl_t fcntls;
+    cap_ioctl_t ioctls[4];
+    EXPECT_OK(cap_fcntls_get(fds[ii], &fcntls));
+    if (roles[ii] == r_log) {
+      EXPECT_EQ((cap_fcntl_t)CAP_FCNTL_GETFL, fcntls);
+    } else if (roles[ii] == r_tty) {
+      EXPECT_EQ(1, cap_ioctls_get(fds[ii], ioctls, 4));
+      EXPECT_EQ((cap_ioctl_t)0x541B, ioctls[0]);
+    } else if (roles[ii] == r_plain) {
+      EXPECT_EQ((cap_fcntl_t)CAP_FCNTL_ALL, fcntls);
+      EXPECT_EQ(CAP_IOCTLS_ALL, cap_ioctls_get(fds[ii], ioctls, 4));
+    }
+  }
+  // Reapplying a narrower role works; a wider one doesn't.
+  int narrow[kCount], wide[kCount];
+  for (int ii = 0; ii < kCount; ii++) {
+    narrow[ii] = (roles[ii] == r_plain) ? r_tty : -1;
+    wide[ii] = (roles[ii] == r_tty) ? r_plain : -1;
+  }
+  EXPECT_OK(cap_policy_apply(policy, fds, narrow, kCount, NULL));
+  EXPECT_NOTCAPABLE(cap_policy_apply(policy, fds, wide, kCount, NULL));
+  cap_policy_free(policy);
+
+  // Mistakes are reported with their line.
+  const char *bad[] = {"ok rights=READ\nbad rights=READ,NOTARIGHT\n",
+                       "ok rights=READ\nok rights=WRITE\n",
+                       "ok fcntls=GETFL,SETFOO\n",
+                       "ok ioctls=0x54xx\n",
+                       "rights=READ\n",
+                       "ok rights=READ unknown=1\n"};
+  const int bad_line[] = {2, 2, 1, 1, 1, 1};
+  for (size_t ii = 0; ii < sizeof(bad) / sizeof(bad[0]); ii++) {
+    EXPECT_EQ((struct cap_policy *)NULL, cap_policy_compile(bad[ii], &line)) << bad[ii];
+    EXPECT_EQ(EINVAL, errno) << bad[ii];
+    EXPECT_EQ(bad_line[ii], line) << bad[ii];
+  }
+
+  for (int ii = 0; ii < kCount; ii++) {
+    close(fds[ii]);
+  }
+}
+#endif
+
+#if defined(__linux__) && defined(__NR_cap_rights_get)
+// What the kernel itself says, bypassing any library cache.
+static void KernelRights(int fd, cap_rights_t *rights, cap_fcntl_t *fcntls,
+                         int *nioctls, cap_ioctl_t *ioctls, int maxioctls) {
+  *nioctls = maxioctls;
+  EXPECT_OK(syscall(__NR_cap_rights_get, fd, rights, fcntls, nioctls, ioctls, 0));
+}
+
+static void ExpectCacheCoherent(int fd) {
+  cap_rights_t k_rights, c_rights;
+  cap_fcntl_t k_fcntls, c_fcntls;
+  cap_ioctl_t k_ioctls[8], c_ioctls[8];
+  int k_nioctls;
+  KernelRights(fd, &k_rights, &k_fcntls, &k_nioctls, k_ioctls, 8);
+  EXPECT_OK(cap_rights_get(fd, &c_rights));
+  EXPECT_RIGHTS_EQ(&k_rights, &c_rights);
+  EXPECT_OK(cap_fcntls_get(fd, &c_fcntls));
+  EXPECT_EQ(k_fcntls, c_fcntls) << " fd " << fd;
+  ssize_t c_nioctls = cap_ioctls_get(fd, c_ioctls, 8);
+  EXPECT_EQ((k_nioctls == -1) ? CAP_IOCTLS_ALL : k_nioctls, c_nioctls) << " fd " << fd;
+  for (int ii = 0; ii < k_nioctls && ii < 8; ii++) {
+    EXPECT_EQ(k_ioctls[ii], c_ioctls[ii]) << " fd " << fd;
+  }
+}
+
+FORK_TEST(Capability, RightsCacheCoherent) {
+  const int kCount = 8;
+  static const uint64_t droppable[] = {CAP_WRITE, CAP_SEEK, CAP_FSTAT, CAP_FCNTL,
+                                       CAP_IOCTL, CAP_MMAP_W, CAP_EVENT, CAP_FTRUNCATE};
+  const int kDroppable = sizeof(droppable) / sizeof(droppable[0]);
+  static const cap_ioctl_t all_ioctls[] = {FIONREAD, FIOCLEX, FIONCLEX, FIONBIO};
+  cap_rights_t r_start;
+  cap_rights_init(&r_start, CAP_READ, CAP_WRITE, CAP_SEEK, CAP_FSTAT, CAP_FCNTL,
+                  CAP_IOCTL, CAP_MMAP_RW, CAP_EVENT, CAP_FTRUNCATE);
+  int fds[kCount];
+  for (int ii = 0; ii < kCount; ii++) {
+    fds[ii] = open("/etc/passwd", O_RDONLY);
+    EXPECT_OK(fds[ii]);
+    EXPECT_OK(cap_rights_limit(fds[ii], &r_start));
+  }
+
+  cap_rights_cache_enable(true);
+  unsigned int seed = 1;
+  for (int round = 0; round < 2000; round++) {
+    seed = seed * 1103515245 + 12345;
+    int slot = (seed >> 8) % kCount;
+    int fd = fds[slot];
+    cap_rights_t rights;
+    EXPECT_OK(cap_rights_get(fd, &rights));
+    switch ((seed >> 16) % 6) {
+    case 0:  // drop a right
+      cap_rights_clear(&rights, droppable[(seed >> 20) % kDroppable]);
+      EXPECT_OK(cap_rights_limit(fd, &rights));
+      break;
+    case 1:  // narrow the fcntls
+      if (cap_rights_is_set(&rights, CAP_FCNTL)) {
+        cap_fcntl_t fcntls;
+        EXPECT_OK(cap_fcntls_get(fd, &fcntls));
+        EXPECT_OK(cap_fcntls_limit(fd, fcntls & (seed >> 20)));
+      }
+      break;
+    case 2:  // narrow the ioctls
+      if (cap_rights_is_set(&rights, CAP_IOCTL)) {
+        cap_ioctl_t ioctls[4];
+        ssize_t n = cap_ioctls_get(fd, ioctls, 4);
+        if (n == CAP_IOCTLS_ALL) {
+          EXPECT_OK(cap_ioctls_limit(fd, all_ioctls, 1 + (seed >> 20) % 4));
+        } else if (n > 0) {
+          EXPECT_OK(cap_ioctls_limit(fd, ioctls, n - 1));
+        }
+      }
+      break;
+    case 3:  // reuse the descriptor number for a fresh file
+      close(fd);
+      EXPECT_EQ(fd, open("/etc/passwd", O_RDONLY));
+      cap_rights_cache_invalidate(fd);
+      if ((seed >> 20) & 1) {
+        EXPECT_OK(cap_rights_limit(fd, &r_start));
+      }
+      break;
+    case 4:  // reuse it for another slot's descriptor
+      EXPECT_EQ(fd, dup2(fds[(slot + 1) % kCount], fd));
+      cap_rights_cache_invalidate(fd);
+      break;
+    case 5:  // batch call on two neighbours
+      {
+        int pair[2] = {fd, fds[(slot + 1) % kCount]};
+        cap_rights_t r_rs;
+        cap_rights_init(&r_rs, CAP_READ, CAP_SEEK);
+        cap_rights_limit_many(pair, 2, &r_rs, NULL);
+      }
+      break;
+    }
+    for (int ii = 0; ii < kCount; ii++) {
+      ExpectCacheCoherent(fds[ii]);
+    }
+  }
+
+  // The cache really is answering: a change made behind its back isn't
+  // seen until the descriptor is invalidated.
+  cap_rights_t r_r, r_got;
+  cap_rights_init(&r_r, CAP_READ);
+  close(fds[0]);
+  EXPECT_EQ(fds[0], open("/etc/passwd", O_RDONLY));
+  cap_rights_cache_invalidate(fds[0]);
+  EXPECT_OK(cap_rights_limit(fds[0], &r_start));
+  EXPECT_OK(syscall(__NR_cap_rights_limit, fds[0], &r_r, 0, 0, NULL, 0));
+  EXPECT_OK(cap_rights_get(fds[0], &r_got));
+  EXPECT_RIGHTS_EQ(&r_start, &r_got);
+  cap_rights_cache_invalidate(fds[0]);
+  EXPECT_OK(cap_rights_get(fds[0], &r_got));
+  EXPECT_RIGHTS_EQ(&r_r, &r_got);
+  ExpectCacheCoherent(fds[0]);
+
+  cap_rights_cache_enable(false);
+  for (int ii = 0; ii < kCount; ii++) {
+    ExpectCacheCoherent(fds[ii]);
+    close(fds[ii]);
+  }
+}
+
+// Threads narrowing (or refetching) the same descriptors race between the
+// kernel call and the cache update; however that goes, the cache mustn't end
+// up holding rights that the kernel has already dropped.
+static const int kRaceCount = 4;
+static int race_fds[kRaceCount];
+
+static void *RightsCacheNarrower(void *arg) {
+  const uint64_t *drops = (const uint64_t *)arg;  // 0-terminated
+  for (int ii = 0; drops[ii] != 0; ii++) {
+    for (int jj = 0; jj < kRaceCount; jj++) {
+      cap_rights_t rights;
+      if (cap_rights_get(race_fds[jj], &rights) < 0) continue;
+      cap_rights_clear(&rights, drops[ii]);
+      cap_rights_limit(race_fds[jj], &rights);  // may lose to the other thread
+    }
+  }
+  return NULL;
+}
+
+static void *RightsCacheRefetcher(void *) {
+  for (int ii = 0; ii < 16; ii++) {
+    int fd = race_fds[ii % kRaceCount];
+    cap_rights_t rights;
+    cap_rights_cache_invalidate(fd);
+    cap_rights_get(fd, &rights);
+  }
+  return NULL;
+}
+
+FORK_TEST(Capability, RightsCacheThreads) {
+  static const uint64_t drops1[] = {CAP_WRITE, CAP_FSTAT, CAP_EVENT, 0};
+  static const uint64_t drops2[] = {CAP_SEEK, CAP_FCNTL, CAP_FTRUNCATE, 0};
+  cap_rights_t r_start;
+  cap_rights_init(&r_start, CAP_READ, CAP_WRITE, CAP_SEEK, CAP_FSTAT, CAP_FCNTL,
+                  CAP_EVENT, CAP_FTRUNCATE);
+  cap_rights_cache_enable(true);
+  for (int round = 0; round < 200; round++) {
+    for (int ii = 0; ii < kRaceCount; ii++) {
+      race_fds[ii] = open("/etc/passwd", O_RDONLY);
+      EXPECT_OK(race_fds[ii]);
+      cap_rights_cache_invalidate(race_fds[ii]);
+      EXPECT_OK(cap_rights_limit(race_fds[ii], &r_start));
+    }
+    pthread_t threads[3];
+    EXPECT_OK(pthread_create(&threads[0], NULL, RightsCacheNarrower, (void *)drops1));
+    EXPECT_OK(pthread_create(&threads[1], NULL, RightsCacheNarrower, (void *)drops2));
+    EXPECT_OK(pthread_create(&threads[2], NULL, RightsCacheRefetcher, NULL));
+    for (int ii = 0; ii < 3; ii++) {
+      EXPECT_OK(pthread_join(threads[ii], NULL));
+    }
+    for (int ii = 0; ii < kRaceCount; ii++) {
+      ExpectCacheCoherent(race_fds[ii]);
+      close(race_fds[ii]);
+    }
+  }
+  cap_rights_cache_enable(false);
+}
+#endif
@@ -165,6 +165,26 @@ FORK_TEST_F(WithFiles, AllowedFileSyscalls) {
   if (!tmpdir_on_tmpfs) {  // tmpfs doesn't support readahead(2)
     EXPECT_OK(readahead(fd_file_, 0, 1));
   }
+#endif
+  // posix_fadvise(3) returns the error rather than setting errno.
+  EXPECT_EQ(0, posix_fadvise(fd_file_, 0, 0, POSIX_FADV_SEQUENTIAL));
+#ifdef HAVE_FALLOCATE
+  rc = fallocate(fd_file_, FALLOC_FL_KEEP_SIZE, 0, 1);
+  if (rc < 0) {
+    EXPECT_NE(ECAPMODE, errno);
+  }
+#endif
+#ifdef HAVE_PREADV2
+  EXPECT_OK(pwritev2_(fd_file_, &io, 1, -1, 0));
+  EXPECT_OK(preadv2_(fd_file_, &io, 1, -1, 0));
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+  loff_t off_in = 0;
+  loff_t off_out = 2;
+  rc = copy_file_range_(fd_file_, &off_in, fd_file_, &off_out, 1, 0);
+  if (rc < 0) {
+    EXPECT_NE(ECAPMODE, errno);
+  }
 #endif
 }
 
@@ -290,6 +310,12 @@ FORK_TEST(Capmode, AllowedSchedSyscalls) {
   struct timespec ts;
   EXPECT_OK(sched_rr_get_interval(0, &ts));
   EXPECT_OK(sched_yield());
+#ifdef HAVE_SCHED_GETAFFINITY
+  cpu_set_t cpus;
+  EXPECT_OK(sched_getaffinity(0, sizeof(cpus), &cpus));
+  // Only the current thread's affinity is visible.
+  EXPECT_CAPMODE(sched_getaffinity(getppid(), sizeof(cpus), &cpus));
+#endif
 }
 
 
@@ -307,6 +333,10 @@ FORK_TEST(Capmode, AllowedTimerSyscalls) {
   ts.tv_sec = 0;
   ts.tv_nsec = 1;
   EXPECT_OK(nanosleep(&ts, NULL));
+#ifdef HAVE_CLOCK_NANOSLEEP
+  // clock_nanosleep(2) returns the error rather than setting errno.
+  EXPECT_EQ(0, clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL));
+#endif
 }
 
 
@@ -354,6 +384,9 @@ FORK_TEST(CapMode, AllowedMmapSyscalls) {
     }
     EXPECT_OK(munlockall());
   }
+#ifdef HAVE_MREMAP
+  EXPECT_EQ(mem, mremap(mem, mem_size, mem_size, 0));
+#endif
   // Unmap the memory.
   EXPECT_OK(munmap(mem, mem_size));
 }
@@ -371,6 +404,19 @@ FORK_TEST(Capmode, AllowedPipeSyscalls) {
   iov.iov_len = sizeof(buf);
   EXPECT_FAIL_NOT_CAPMODE(vmsplice(fd2[0], &iov, 1, SPLICE_F_NONBLOCK));
 #endif
+#if defined(HAVE_SPLICE) || defined(HAVE_TEE)
+  // Both pipes are empty, so these fail with EAGAIN.
+  int fd3[2];
+  EXPECT_OK(pipe(fd3));
+#ifdef HAVE_SPLICE
+  EXPECT_FAIL_NOT_CAPMODE(splice(fd2[0], NULL, fd3[1], NULL, 1, SPLICE_F_NONBLOCK));
+#endif
+#ifdef HAVE_TEE
+  EXPECT_FAIL_NOT_CAPMODE(tee(fd2[0], fd3[1], 1, SPLICE_F_NONBLOCK));
+#endif
+  close(fd3[0]);
+  close(fd3[1]);
+#endif
 
   if (rc == 0) {
     close(fd2[0]);
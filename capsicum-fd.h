@@ -0,0 +1,189 @@
+/* -*- C++ -*- */
+#ifndef __CAPSICUM_FD_H__
+#define __CAPSICUM_FD_H__
+
+/*
+ * A file descriptor whose Capsicum rights are part of its type.
+ *
+ *   cap_fd<CAP_PREAD, CAP_FSTAT> fd = cap_fd<CAP_PREAD, CAP_FSTAT>::limit(raw);
+ *   fd.pread(buf, len, 0);   // fine
+ *   fd.write(buf, len);      // compile error: no CAP_WRITE
+ *
+ * Each operation is only declared for descriptors whose rights allow it, so
+ * code holding a cap_fd never needs to call cap_rights_get() to find out
+ * what it may do, and can't get ENOTCAPABLE for lack of a right.  Rights are
+ * dropped with narrow(), which checks at compile time that the new set is a
+ * subset and then makes a single cap_rights_limit() call.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <type_traits>
+#include <utility>
+
+#include "capsicum.h"
+#include "syscalls.h"
+#include "capsicum-rights-builder.h"
+
+#ifdef CAP_RIGHTS_VERSION
+
+namespace capsicum_rights {
+
+// Whether rights includes right; 0 (as for CAP_SEEK_ASWAS) is always allowed.
+constexpr bool Allows(const cap_rights_t& rights, uint64_t right) {
+  return right == 0 || CapRightsIsSet(rights, right);
+}
+
+// The mmap right needed for a given protection, as the kernel checks it.
+constexpr uint64_t MmapRight(int prot) {
+  return (prot & PROT_READ) ?
+           ((prot & PROT_WRITE) ? ((prot & PROT_EXEC) ? CAP_MMAP_RWX : CAP_MMAP_RW)
+                                : ((prot & PROT_EXEC) ? CAP_MMAP_RX : CAP_MMAP_R)) :
+           ((prot & PROT_WRITE) ? ((prot & PROT_EXEC) ? CAP_MMAP_WX : CAP_MMAP_W)
+                                : ((prot & PROT_EXEC) ? CAP_MMAP_X : CAP_MMAP));
+}
+
+}  // namespace capsicum_rights
+
+// Declares a member only if the descriptor's rights include all of R...
+#define CAP_FD_REQUIRES(TYPE, ...) \
+  template <bool Enable_ = true>   \
+  typename std::enable_if<Enable_ && allows(__VA_ARGS__), TYPE>::type
+
+template <uint64_t... Rights>
+class cap_fd {
+ public:
+  static constexpr cap_rights_t rights = CapRights(Rights...);
+
+  // Whether this descriptor type has all of the given rights.
+  static constexpr bool allows() { return true; }
+  template <typename... Rest>
+  static constexpr bool allows(uint64_t right, Rest... rest) {
+    return capsicum_rights::Allows(rights, right) && allows(rest...);
+  }
+
+  cap_fd() : fd_(-1) {}
+  cap_fd(cap_fd&& other) : fd_(other.release()) {}
+  cap_fd& operator=(cap_fd&& other) {
+    reset(other.release());
+    return *this;
+  }
+  cap_fd(const cap_fd&) = delete;
+  cap_fd& operator=(const cap_fd&) = delete;
+  ~cap_fd() { reset(); }
+
+  // Take ownership of fd, limiting it to Rights.  On failure, fd is closed
+  // and the result is invalid, with errno set.
+  static cap_fd limit(int fd) {
+    cap_fd result;
+    if (fd < 0) return result;
+    if (cap_rights_limit(fd, &rights) < 0) {
+      int error = errno;
+      ::close(fd);
+      errno = error;
+      return result;
+    }
+    result.fd_ = fd;
+    return result;
+  }
+
+  // Give up rights: this descriptor becomes invalid, and the result has
+  // only the rights Fewer..., which must be a subset of Rights...
+  template <uint64_t... Fewer>
+  cap_fd<Fewer...> narrow() && {
+    static_assert(CapRightsContains(rights, cap_fd<Fewer...>::rights),
+                  "narrow() can only remove rights");
+    return cap_fd<Fewer...>::limit(release());
+  }
+  // As narrow(), on a duplicate of this descriptor, which is left alone.
+  template <uint64_t... Fewer>
+  cap_fd<Fewer...> dup_narrow() const {
+    static_assert(CapRightsContains(rights, cap_fd<Fewer...>::rights),
+                  "dup_narrow() can only remove rights");
+    return cap_fd<Fewer...>::limit(valid() ? ::dup(fd_) : -1);
+  }
+
+  bool valid() const { return fd_ >= 0; }
+  int get() const { return fd_; }
+  int release() {
+    int fd = fd_;
+    fd_ = -1;
+    return fd;
+  }
+  void reset(int fd = -1) {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = fd;
+  }
+
+  // Operations, each available only with the rights it needs.
+  CAP_FD_REQUIRES(ssize_t, CAP_READ, CAP_SEEK_ASWAS) read(void *buf, size_t len) const {
+    return ::read(fd_, buf, len);
+  }
+  CAP_FD_REQUIRES(ssize_t, CAP_WRITE, CAP_SEEK_ASWAS) write(const void *buf, size_t len) const {
+    return ::write(fd_, buf, len);
+  }
+  CAP_FD_REQUIRES(ssize_t, CAP_PREAD) pread(void *buf, size_t len, off_t offset) const {
+    return ::pread(fd_, buf, len, offset);
+  }
+  CAP_FD_REQUIRES(ssize_t, CAP_PWRITE) pwrite(const void *buf, size_t len, off_t offset) const {
+    return ::pwrite(fd_, buf, len, offset);
+  }
+  CAP_FD_REQUIRES(off_t, CAP_SEEK) lseek(off_t offset, int whence) const {
+    return ::lseek(fd_, offset, whence);
+  }
+  CAP_FD_REQUIRES(int, CAP_FSTAT) fstat(struct stat *sb) const {
+    return ::fstat(fd_, sb);
+  }
+  CAP_FD_REQUIRES(int, CAP_FSTATFS) fstatfs(struct statfs *sf) const {
+    return ::fstatfs(fd_, sf);
+  }
+  CAP_FD_REQUIRES(int, CAP_FSYNC) fsync() const {
+    return ::fsync(fd_);
+  }
+  CAP_FD_REQUIRES(int, CAP_FTRUNCATE) ftruncate(off_t len) const {
+    return ::ftruncate(fd_, len);
+  }
+  CAP_FD_REQUIRES(int, CAP_FCHMOD) fchmod(mode_t mode) const {
+    return ::fchmod(fd_, mode);
+  }
+  CAP_FD_REQUIRES(int, CAP_FCHOWN) fchown(uid_t uid, gid_t gid) const {
+    return ::fchown(fd_, uid, gid);
+  }
+  CAP_FD_REQUIRES(int, CAP_FLOCK) flock(int operation) const {
+    return ::flock(fd_, operation);
+  }
+  CAP_FD_REQUIRES(int, CAP_FUTIMES) futimes(const struct timeval tv[2]) const {
+    return ::futimes(fd_, tv);
+  }
+  CAP_FD_REQUIRES(long, CAP_FPATHCONF) fpathconf(int name) const {
+    return ::fpathconf(fd_, name);
+  }
+  CAP_FD_REQUIRES(int, CAP_FCNTL) getfl() const {
+    return ::fcntl(fd_, F_GETFL);
+  }
+  CAP_FD_REQUIRES(int, CAP_FCNTL) setfl(int flags) const {
+    return ::fcntl(fd_, F_SETFL, flags);
+  }
+  // The protection is a template argument so its right can be checked.
+  template <int Prot>
+  typename std::enable_if<allows(capsicum_rights::MmapRight(Prot)), void *>::type
+  mmap(void *addr, size_t len, int flags, off_t offset) const {
+    return ::mmap(addr, len, Prot, flags, fd_, offset);
+  }
+
+ private:
+  int fd_;
+};
+
+template <uint64_t... Rights>
+constexpr cap_rights_t cap_fd<Rights...>::rights;
+
+#undef CAP_FD_REQUIRES
+
+#endif  /* CAP_RIGHTS_VERSION */
+
+#endif /*__CAPSICUM_FD_H__*/
@@ -25,6 +25,7 @@ extern "C" {
 #define HAVE_CAP_RIGHTS_GET
 #define HAVE_CAP_RIGHTS_LIMIT
 #define HAVE_PROCDESC_FSTAT
+#define HAVE_PD_KILL_ON_CLOSE
 #define HAVE_CAP_FCNTLS_LIMIT
 // fcntl(2) takes int, cap_fcntls_limit(2) takes uint32_t.
 typedef uint32_t cap_fcntl_t;
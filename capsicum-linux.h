@@ -6,6 +6,7 @@
  * Linux Capsicum Functionality.
  ************************************************************/
 #include <errno.h>
+#include <sys/syscall.h>
 #include <sys/procdesc.h>
 #include <sys/capsicum.h>
 
@@ -15,6 +16,12 @@
 #define HAVE_CAP_IOCTLS_LIMIT
 #define HAVE_PROC_FDINFO
 #define HAVE_PDWAIT4
+#define HAVE_PDSPAWN
+// Without clone4(2), process descriptors are pidfds, and closing the last one
+// doesn't kill the child (pdfork() only ties it to the parent's lifetime).
+#ifdef __NR_clone4
+#define HAVE_PD_KILL_ON_CLOSE
+#endif
 #define CAP_FROM_ACCEPT
 // TODO(drysdale): uncomment if/when Linux propagates rights on sctp_peeloff.
 // Linux does not generate a capability from sctp_peeloff(cap_fd,...).
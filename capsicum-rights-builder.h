@@ -0,0 +1,107 @@
+/* -*- C++ -*- */
+#ifndef __CAPSICUM_RIGHTS_BUILDER_H__
+#define __CAPSICUM_RIGHTS_BUILDER_H__
+
+/*
+ * Compile-time construction of cap_rights_t values for C++11 callers.
+ *
+ * cap_rights_init() and friends walk a varargs list at runtime, looking up
+ * the word for each right and asserting on its encoding.  For a fixed set of
+ * rights, all of that can happen in the compiler instead:
+ *
+ *   static constexpr cap_rights_t r_rs = CapRights(CAP_READ, CAP_SEEK);
+ *   cap_rights_limit(fd, &CapRightsConstant<CAP_READ, CAP_FSTAT>::value);
+ *
+ * The results are bit-for-bit identical to the C functions.  A malformed
+ * right (say CAP_READ|CAP_EVENT, which mixes words) makes the expression
+ * non-constant, so it fails to compile where a constant is required.
+ */
+#include "capsicum.h"
+
+#ifdef CAP_RIGHTS_VERSION
+#include <stdint.h>
+
+static_assert(CAP_RIGHTS_VERSION == CAP_RIGHTS_VERSION_00,
+              "rights builder only knows the two-word cap_rights_t layout");
+
+namespace capsicum_rights {
+
+// Not constexpr: reaching this in a constant expression is a compile error.
+inline int InvalidRight() { return -1; }
+
+// Word that a right lives in, from its CAPIDXBIT() marker (as right_to_index()).
+constexpr int Index(uint64_t right) {
+  return (right == 0 || CAPRVER(right) != 0) ? InvalidRight() :
+         (CAPIDXBIT(right) == 1) ? 0 :
+         (CAPIDXBIT(right) == 2) ? 1 : InvalidRight();
+}
+
+// The bits that rights... contribute to word index (marker included).
+constexpr uint64_t Word(int) { return 0; }
+template <typename... Rest>
+constexpr uint64_t Word(int index, uint64_t right, Rest... rest) {
+  return ((Index(right) == index) ? right : 0) | Word(index, rest...);
+}
+
+// Just the right bits, without the marker, as cleared by cap_rights_clear().
+constexpr uint64_t Bits(uint64_t word) {
+  return word & 0x01FFFFFFFFFFFFFFULL;
+}
+
+constexpr cap_rights_t Make(uint64_t word0, uint64_t word1) {
+  return cap_rights_t{{word0, word1}};
+}
+
+}  // namespace capsicum_rights
+
+// Equivalent to cap_rights_init(&rights, ...).
+template <typename... Rights>
+constexpr cap_rights_t CapRights(Rights... rights) {
+  return capsicum_rights::Make(
+      ((uint64_t)CAP_RIGHTS_VERSION << 62) | CAPRIGHT(0, 0ULL) |
+          capsicum_rights::Word(0, (uint64_t)rights...),
+      CAPRIGHT(1, 0ULL) | capsicum_rights::Word(1, (uint64_t)rights...));
+}
+
+// Equivalent to cap_rights_set() on a copy of base.
+template <typename... Rights>
+constexpr cap_rights_t CapRightsSet(const cap_rights_t& base, Rights... rights) {
+  return capsicum_rights::Make(
+      base.cr_rights[0] | capsicum_rights::Word(0, (uint64_t)rights...),
+      base.cr_rights[1] | capsicum_rights::Word(1, (uint64_t)rights...));
+}
+
+// Equivalent to cap_rights_clear() on a copy of base.
+template <typename... Rights>
+constexpr cap_rights_t CapRightsClear(const cap_rights_t& base, Rights... rights) {
+  return capsicum_rights::Make(
+      base.cr_rights[0] & ~capsicum_rights::Bits(capsicum_rights::Word(0, (uint64_t)rights...)),
+      base.cr_rights[1] & ~capsicum_rights::Bits(capsicum_rights::Word(1, (uint64_t)rights...)));
+}
+
+// Equivalent to cap_rights_is_set().
+template <typename... Rights>
+constexpr bool CapRightsIsSet(const cap_rights_t& base, Rights... rights) {
+  return (base.cr_rights[0] & capsicum_rights::Word(0, (uint64_t)rights...)) ==
+             capsicum_rights::Word(0, (uint64_t)rights...) &&
+         (base.cr_rights[1] & capsicum_rights::Word(1, (uint64_t)rights...)) ==
+             capsicum_rights::Word(1, (uint64_t)rights...);
+}
+
+// Equivalent to cap_rights_contains().
+constexpr bool CapRightsContains(const cap_rights_t& big, const cap_rights_t& little) {
+  return (big.cr_rights[0] & little.cr_rights[0]) == little.cr_rights[0] &&
+         (big.cr_rights[1] & little.cr_rights[1]) == little.cr_rights[1];
+}
+
+// A rights set as a static constant, guaranteed to be built at compile time.
+template <uint64_t... Rights>
+struct CapRightsConstant {
+  static constexpr cap_rights_t value = CapRights(Rights...);
+};
+template <uint64_t... Rights>
+constexpr cap_rights_t CapRightsConstant<Rights...>::value;
+
+#endif  /* CAP_RIGHTS_VERSION */
+
+#endif /*__CAPSICUM_RIGHTS_BUILDER_H__*/
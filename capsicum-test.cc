@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#ifdef __NR_io_uring_setup
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#endif
 
 #include <map>
 #include <vector>
@@ -77,6 +81,56 @@ char ProcessState(int pid) {
 #endif
 }
 
+#ifdef __NR_io_uring_setup
+bool TestRingMap(TestRing *ring, int fd, const struct io_uring_params *params) {
+  size_t sq_len = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+  size_t cq_len = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+  char *sq = (char *)mmap(NULL, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                          fd, IORING_OFF_SQ_RING);
+  char *cq = (char *)mmap(NULL, cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                          fd, IORING_OFF_CQ_RING);
+  void *sqes = mmap(NULL, params->sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) return false;
+  ring->fd = fd;
+  ring->sq_tail = (unsigned *)(sq + params->sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params->sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params->sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params->cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params->cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params->cq_off.ring_mask);
+  ring->sqes = (struct io_uring_sqe *)sqes;
+  ring->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+  ring->queued = 0;
+  return true;
+}
+
+struct io_uring_sqe *TestRingGetSqe(TestRing *ring) {
+  unsigned tail = *ring->sq_tail + ring->queued;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  ring->queued++;
+  return sqe;
+}
+
+int TestRingSubmit(TestRing *ring) {
+  unsigned count = ring->queued;
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE);
+  ring->queued = 0;
+  return syscall(__NR_io_uring_enter, ring->fd, count, count, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+bool TestRingReap(TestRing *ring, struct io_uring_cqe *cqe) {
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return false;
+  *cqe = ring->cqes[head & *ring->cq_mask];
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+#endif
+
 typedef std::vector<std::string> TestList;
 typedef std::map<std::string, TestList*> SkippedTestMap;
 static SkippedTestMap skipped_tests;
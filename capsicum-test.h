@@ -7,6 +7,9 @@
 #include <sys/wait.h>
 #include <sys/resource.h>
 #include <signal.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include <ios>
 #include <ostream>
@@ -241,6 +244,29 @@ char ProcessState(int pid);
 #define EXPECT_PID_ZOMBIE(pid)  EXPECT_PID_REACHES_STATES(pid, 'Z', 'Z');
 #define EXPECT_PID_GONE(pid)    EXPECT_PID_REACHES_STATES(pid, '\0', '\0');
 
+#ifdef __NR_io_uring_setup
+// Just enough of an io_uring to drive it from the tests, with no liburing.
+struct io_uring_params;
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct TestRing {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned queued;
+};
+// Map the rings of io_uring fd, as described by params.
+bool TestRingMap(TestRing *ring, int fd, const struct io_uring_params *params);
+// Return a zeroed submission queue entry, queued for the next submit.
+struct io_uring_sqe *TestRingGetSqe(TestRing *ring);
+// Submit everything queued and wait for that many completions.
+int TestRingSubmit(TestRing *ring);
+// Pop the next completion into *cqe, if there is one.
+bool TestRingReap(TestRing *ring, struct io_uring_cqe *cqe);
+#endif
+
 void ShowSkippedTests(std::ostream& os);
 void TestSkipped(const char *testcase, const char *test, const std::string& reason);
 #define TEST_SKIPPED(reason) \
@@ -66,6 +66,13 @@ typedef struct nvlist nvlist_t;
  * Perform case-insensitive lookups of provided names.
  */
 #define	NV_FLAG_IGNORE_CASE		0x01
+/*
+ * Allocate pairs, their names and small values from an arena owned by the
+ * list, all freed together by nvlist_destroy().  Suits lists that are built
+ * up and then destroyed whole, as the memory of pairs freed earlier is not
+ * reused.
+ */
+#define	NV_FLAG_ARENA			0x02
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,9 +91,11 @@ void nvlist_fdump(const nvlist_t *nvl, FILE *fp);
 size_t		 nvlist_size(const nvlist_t *nvl);
 void		*nvlist_pack(const nvlist_t *nvl, size_t *sizep);
 nvlist_t	*nvlist_unpack(const void *buf, size_t size);
+nvlist_t	*nvlist_unpack_move(void *buf, size_t size);
 
 int nvlist_send(int sock, const nvlist_t *nvl);
 nvlist_t *nvlist_recv(int sock);
+nvlist_t *nvlist_recv_move(int sock);
 nvlist_t *nvlist_xfer(int sock, nvlist_t *nvl);
 
 const char *nvlist_next(const nvlist_t *nvl, int *typep, void **cookiep);
@@ -34,6 +34,7 @@
 #include <sys/queue.h>
 #include <sys/socket.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -67,15 +68,36 @@
 #endif
 
 #define	NV_FLAG_PRIVATE_MASK	(NV_FLAG_BIG_ENDIAN)
-#define	NV_FLAG_PUBLIC_MASK	(NV_FLAG_IGNORE_CASE)
+#define	NV_FLAG_PUBLIC_MASK	(NV_FLAG_IGNORE_CASE | NV_FLAG_ARENA)
 #define	NV_FLAG_ALL_MASK	(NV_FLAG_PRIVATE_MASK | NV_FLAG_PUBLIC_MASK)
+#define	NV_FLAG_LOCAL_MASK	(NV_FLAG_ARENA)	/* Not packed. */
+
+/*
+ * Lists of at least NVLIST_INDEX_MIN pairs get a hash index by name, so that
+ * lookups don't have to walk the list.  The index is open-addressed with
+ * linear probing, and kept at most half full (counting tombstones).
+ */
+#define	NVLIST_INDEX_MIN	16
+struct nvl_index {
+	size_t		 nvi_size;	/* Number of slots, a power of two. */
+	size_t		 nvi_used;	/* Slots holding a pair or a tombstone. */
+	nvpair_t	*nvi_slots[];
+};
+static char nvl_index_tombstone;
+#define	NVL_INDEX_TOMBSTONE	((nvpair_t *)&nvl_index_tombstone)
 
 #define	NVLIST_MAGIC	0x6e766c	/* "nvl" */
 struct nvlist {
-	int		nvl_magic;
-	int		nvl_error;
-	int		nvl_flags;
-	struct nvl_head	nvl_head;
+	int		 nvl_magic;
+	int		 nvl_error;
+	int		 nvl_flags;
+	size_t		 nvl_npairs;
+	struct nvl_index *nvl_index;	/* NULL for short lists. */
+	struct nv_arena	*nvl_arena;	/* For NV_FLAG_ARENA, or NULL. */
+	size_t		 nvl_packsize;	/* Kept up to date for nvlist_size(). */
+	size_t		 nvl_ndescs;	/* Including those of nested lists. */
+	nvlist_t	*nvl_parent;	/* The list this one is nested in. */
+	struct nvl_head	 nvl_head;
 };
 
 #define	NVLIST_ASSERT(nvl)	do {					\
@@ -105,6 +127,15 @@ nvlist_create(int flags)
 	nvl = malloc(sizeof(*nvl));
 	nvl->nvl_error = 0;
 	nvl->nvl_flags = flags;
+	nvl->nvl_npairs = 0;
+	nvl->nvl_index = NULL;
+	nvl->nvl_packsize = sizeof(struct nvlist_header);
+	nvl->nvl_ndescs = 0;
+	nvl->nvl_parent = NULL;
+	nvl->nvl_arena = NULL;
+	/* If this fails, pairs just come from malloc(3) instead. */
+	if ((flags & NV_FLAG_ARENA) != 0)
+		nvl->nvl_arena = nv_arena_create();
 	TAILQ_INIT(&nvl->nvl_head);
 	nvl->nvl_magic = NVLIST_MAGIC;
 
@@ -124,10 +155,15 @@ nvlist_destroy(nvlist_t *nvl)
 
 	NVLIST_ASSERT(nvl);
 
+	/* No point keeping the index up to date as the list empties. */
+	free(nvl->nvl_index);
+	nvl->nvl_index = NULL;
 	while ((nvp = nvlist_first_nvpair(nvl)) != NULL) {
 		nvlist_remove_nvpair(nvl, nvp);
 		nvpair_free(nvp);
 	}
+	if (nvl->nvl_arena != NULL)
+		nv_arena_release(nvl->nvl_arena);
 	nvl->nvl_magic = 0;
 	free(nvl);
 
@@ -156,57 +192,231 @@ nvlist_empty(const nvlist_t *nvl)
 	return (nvlist_first_nvpair(nvl) == NULL);
 }
 
+int
+nvlist_arena_stats(const nvlist_t *nvl, size_t *nchunksp, size_t *nallocsp)
+{
+	const struct nv_arena *arena;
+	const nvpair_t *nvp;
+
+	NVLIST_ASSERT(nvl);
+
+	/* Unpacked lists don't hold their pairs' arena themselves. */
+	arena = nvl->nvl_arena;
+	if (arena == NULL) {
+		nvp = nvlist_first_nvpair(nvl);
+		if (nvp != NULL)
+			arena = nvpair_arena(nvp);
+	}
+	if (arena == NULL)
+		return (-1);
+	nv_arena_stats(arena, nchunksp, nallocsp);
+	return (0);
+}
+
+/*
+ * Name index.
+ */
+static uint32_t
+nvlist_hash(const nvlist_t *nvl, const char *name)
+{
+	const unsigned char *p;
+	uint32_t hash;
+
+	/* FNV-1a, case-folded for lists that ignore case. */
+	hash = 2166136261U;
+	if ((nvl->nvl_flags & NV_FLAG_IGNORE_CASE) != 0) {
+		for (p = (const unsigned char *)name; *p != '\0'; p++)
+			hash = (hash ^ tolower(*p)) * 16777619U;
+	} else {
+		for (p = (const unsigned char *)name; *p != '\0'; p++)
+			hash = (hash ^ *p) * 16777619U;
+	}
+	return (hash);
+}
+
+static bool
+nvlist_name_equal(const nvlist_t *nvl, const char *name1, const char *name2)
+{
+
+	if ((nvl->nvl_flags & NV_FLAG_IGNORE_CASE) != 0)
+		return (strcasecmp(name1, name2) == 0);
+	else
+		return (strcmp(name1, name2) == 0);
+}
+
+static void
+nvlist_index_put(nvlist_t *nvl, nvpair_t *nvp)
+{
+	struct nvl_index *idx;
+	size_t mask, ii;
+
+	idx = nvl->nvl_index;
+	mask = idx->nvi_size - 1;
+	for (ii = nvlist_hash(nvl, nvpair_name(nvp)) & mask;
+	    idx->nvi_slots[ii] != NULL && idx->nvi_slots[ii] != NVL_INDEX_TOMBSTONE;
+	    ii = (ii + 1) & mask)
+		;
+	if (idx->nvi_slots[ii] == NULL)
+		idx->nvi_used++;
+	idx->nvi_slots[ii] = nvp;
+}
+
+/*
+ * (Re)build the index from the list, sized for it to double before the next
+ * rebuild.  The index is only an accelerator, so if there's no memory for it
+ * lookups just go back to walking the list.
+ */
+static void
+nvlist_index_build(nvlist_t *nvl)
+{
+	struct nvl_index *idx;
+	nvpair_t *nvp;
+	size_t size;
+
+	free(nvl->nvl_index);
+	for (size = NVLIST_INDEX_MIN * 2; size < nvl->nvl_npairs * 4; size *= 2)
+		;
+	idx = calloc(1, sizeof(*idx) + size * sizeof(idx->nvi_slots[0]));
+	nvl->nvl_index = idx;
+	if (idx == NULL)
+		return;
+	idx->nvi_size = size;
+	for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
+	    nvp = nvlist_next_nvpair(nvl, nvp))
+		nvlist_index_put(nvl, nvp);
+}
+
+static nvpair_t *
+nvlist_index_find(const nvlist_t *nvl, const char *name)
+{
+	const struct nvl_index *idx;
+	nvpair_t *nvp;
+	size_t mask, ii;
+
+	idx = nvl->nvl_index;
+	mask = idx->nvi_size - 1;
+	for (ii = nvlist_hash(nvl, name) & mask;
+	    (nvp = idx->nvi_slots[ii]) != NULL; ii = (ii + 1) & mask) {
+		if (nvp != NVL_INDEX_TOMBSTONE &&
+		    nvlist_name_equal(nvl, nvpair_name(nvp), name))
+			return (nvp);
+	}
+	return (NULL);
+}
+
+/* Called by nvpair_insert(), once nvp is on the list. */
+void
+nvlist_index_insert(nvlist_t *nvl, nvpair_t *nvp)
+{
+
+	NVLIST_ASSERT(nvl);
+
+	nvl->nvl_npairs++;
+	if (nvl->nvl_index == NULL) {
+		if (nvl->nvl_npairs >= NVLIST_INDEX_MIN)
+			nvlist_index_build(nvl);
+	} else if ((nvl->nvl_index->nvi_used + 1) * 2 >
+	    nvl->nvl_index->nvi_size) {
+		nvlist_index_build(nvl);
+	} else {
+		nvlist_index_put(nvl, nvp);
+	}
+}
+
+/* Called by nvpair_remove(), before nvp leaves the list. */
+void
+nvlist_index_remove(nvlist_t *nvl, nvpair_t *nvp)
+{
+	struct nvl_index *idx;
+	size_t mask, ii;
+
+	NVLIST_ASSERT(nvl);
+	PJDLOG_ASSERT(nvl->nvl_npairs > 0);
+
+	nvl->nvl_npairs--;
+	idx = nvl->nvl_index;
+	if (idx == NULL)
+		return;
+	mask = idx->nvi_size - 1;
+	for (ii = nvlist_hash(nvl, nvpair_name(nvp)) & mask;
+	    idx->nvi_slots[ii] != nvp; ii = (ii + 1) & mask)
+		PJDLOG_ASSERT(idx->nvi_slots[ii] != NULL);
+	idx->nvi_slots[ii] = NVL_INDEX_TOMBSTONE;
+}
+
 static void
-nvlist_report_missing(int type, const char *namefmt, va_list nameap)
+nvlist_report_missing(int type, const char *name)
+{
+
+	PJDLOG_ABORT("Element '%s' of type %s doesn't exist.",
+	    name, nvpair_type_string(type));
+}
+
+static void
+nvlist_report_missingv(int type, const char *namefmt, va_list nameap)
 {
 	char *name;
 
 	int len = vasprintf(&name, namefmt, nameap);
-	PJDLOG_ABORT("Element '%s' of type %s doesn't exist.",
-	    (len > 0 && name != NULL) ? name : "N/A", nvpair_type_string(type));
+	nvlist_report_missing(type, (len > 0 && name != NULL) ? name : "N/A");
 }
 
+/*
+ * The plain name functions look up their name directly; only the *f and *v
+ * variants have to format it first, with nvlist_findv().
+ */
 static nvpair_t *
-nvlist_findv(const nvlist_t *nvl, int type, const char *namefmt, va_list nameap)
+nvlist_find(const nvlist_t *nvl, int type, const char *name)
 {
 	nvpair_t *nvp;
-	char *name;
 
 	NVLIST_ASSERT(nvl);
 	PJDLOG_ASSERT(nvl->nvl_error == 0);
 	PJDLOG_ASSERT(type == NV_TYPE_NONE ||
 	    (type >= NV_TYPE_FIRST && type <= NV_TYPE_LAST));
 
-	if (vasprintf(&name, namefmt, nameap) < 0)
-		return (NULL);
-
-	for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
-	    nvp = nvlist_next_nvpair(nvl, nvp)) {
-		if (type != NV_TYPE_NONE && nvpair_type(nvp) != type)
-			continue;
-		if ((nvl->nvl_flags & NV_FLAG_IGNORE_CASE) != 0) {
-			if (strcasecmp(nvpair_name(nvp), name) != 0)
+	if (nvl->nvl_index != NULL) {
+		/* Names are unique, so there's at most one candidate. */
+		nvp = nvlist_index_find(nvl, name);
+		if (nvp != NULL && type != NV_TYPE_NONE &&
+		    nvpair_type(nvp) != type)
+			nvp = NULL;
+	} else {
+		for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
+		    nvp = nvlist_next_nvpair(nvl, nvp)) {
+			if (type != NV_TYPE_NONE && nvpair_type(nvp) != type)
 				continue;
-		} else {
-			if (strcmp(nvpair_name(nvp), name) != 0)
+			if (!nvlist_name_equal(nvl, nvpair_name(nvp), name))
 				continue;
+			break;
 		}
-		break;
 	}
 
-	free(name);
-
 	if (nvp == NULL)
 		errno = ENOENT;
 
 	return (nvp);
 }
 
+static nvpair_t *
+nvlist_findv(const nvlist_t *nvl, int type, const char *namefmt, va_list nameap)
+{
+	nvpair_t *nvp;
+	char *name;
+
+	if (vasprintf(&name, namefmt, nameap) < 0)
+		return (NULL);
+	nvp = nvlist_find(nvl, type, name);
+	free(name);
+
+	return (nvp);
+}
+
 bool
 nvlist_exists_type(const nvlist_t *nvl, const char *name, int type)
 {
 
-	return (nvlist_existsf_type(nvl, type, "%s", name));
+	return (nvlist_find(nvl, type, name) != NULL);
 }
 
 bool
@@ -238,8 +448,13 @@ nvlist_existsv_type(const nvlist_t *nvl, int type, const char *namefmt,
 void
 nvlist_free_type(nvlist_t *nvl, const char *name, int type)
 {
+	nvpair_t *nvp;
 
-	nvlist_freef_type(nvl, type, "%s", name);
+	nvp = nvlist_find(nvl, type, name);
+	if (nvp != NULL)
+		nvlist_free_nvpair(nvl, nvp);
+	else
+		nvlist_report_missing(type, name);
 }
 
 void
@@ -269,7 +484,7 @@ nvlist_freev_type(nvlist_t *nvl, int type, const char *namefmt, va_list nameap)
 	if (nvp != NULL)
 		nvlist_free_nvpair(nvl, nvp);
 	else
-		nvlist_report_missing(type, namefmt, nameap);
+		nvlist_report_missingv(type, namefmt, nameap);
 }
 
 nvlist_t *
@@ -379,40 +594,69 @@ nvlist_fdump(const nvlist_t *nvl, FILE *fp)
 }
 
 /*
- * The function obtains size of the nvlist after nvlist_pack().
- * Additional argument 'level' allows to track how deep are we as we obtain
- * size of the NV_TYPE_NVLIST elements using recursion. We allow at most
- * three levels of recursion.
+ * The function obtains size of the nvlist after nvlist_pack().  This is
+ * kept as pairs come and go, by nvlist_update_totals().
  */
-static size_t
-nvlist_xsize(const nvlist_t *nvl, int level)
+size_t
+nvlist_size(const nvlist_t *nvl)
 {
-	const nvpair_t *nvp;
-	size_t size;
 
 	NVLIST_ASSERT(nvl);
 	PJDLOG_ASSERT(nvl->nvl_error == 0);
-	PJDLOG_ASSERT(level < 3);
 
-	size = sizeof(struct nvlist_header);
-	for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
-	    nvp = nvlist_next_nvpair(nvl, nvp)) {
-		size += nvpair_header_size();
-		size += strlen(nvpair_name(nvp)) + 1;
-		if (nvpair_type(nvp) == NV_TYPE_NVLIST)
-			size += nvlist_xsize(nvpair_get_nvlist(nvp), level + 1);
-		else
-			size += nvpair_size(nvp);
-	}
+	return (nvl->nvl_packsize);
+}
+
+/* Packed size of a pair, with its header and name. */
+static size_t
+nvlist_nvpair_size(const nvpair_t *nvp)
+{
+	size_t size;
+
+	size = nvpair_header_size() + strlen(nvpair_name(nvp)) + 1;
+	if (nvpair_type(nvp) == NV_TYPE_NVLIST)
+		size += nvpair_get_nvlist(nvp)->nvl_packsize;
+	else
+		size += nvpair_size(nvp);
 
 	return (size);
 }
 
-size_t
-nvlist_size(const nvlist_t *nvl)
+/*
+ * Account for nvp joining or leaving nvl, in the totals of nvl and of every
+ * list that it is nested in.
+ */
+static void
+nvlist_update_totals(nvlist_t *nvl, const nvpair_t *nvp, bool add)
 {
+	nvlist_t *child;
+	size_t size, ndescs;
+
+	size = nvlist_nvpair_size(nvp);
+	ndescs = 0;
+	switch (nvpair_type(nvp)) {
+	case NV_TYPE_DESCRIPTOR:
+		ndescs = 1;
+		break;
+	case NV_TYPE_NVLIST:
+		child = (nvlist_t *)(intptr_t)nvpair_get_nvlist(nvp);
+		PJDLOG_ASSERT(child->nvl_parent == (add ? NULL : nvl));
+		child->nvl_parent = add ? nvl : NULL;
+		ndescs = child->nvl_ndescs;
+		break;
+	}
 
-	return (nvlist_xsize(nvl, 0));
+	for (; nvl != NULL; nvl = nvl->nvl_parent) {
+		if (add) {
+			nvl->nvl_packsize += size;
+			nvl->nvl_ndescs += ndescs;
+		} else {
+			PJDLOG_ASSERT(nvl->nvl_packsize >= size);
+			PJDLOG_ASSERT(nvl->nvl_ndescs >= ndescs);
+			nvl->nvl_packsize -= size;
+			nvl->nvl_ndescs -= ndescs;
+		}
+	}
 }
 
 static int *
@@ -459,38 +703,14 @@ nvlist_descriptors(const nvlist_t *nvl, size_t *nitemsp)
 	return (fds);
 }
 
-static size_t
-nvlist_xndescriptors(const nvlist_t *nvl, int level)
+size_t
+nvlist_ndescriptors(const nvlist_t *nvl)
 {
-	const nvpair_t *nvp;
-	size_t ndescs;
 
 	NVLIST_ASSERT(nvl);
 	PJDLOG_ASSERT(nvl->nvl_error == 0);
-	PJDLOG_ASSERT(level < 3);
-
-	ndescs = 0;
-	for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
-	    nvp = nvlist_next_nvpair(nvl, nvp)) {
-		switch (nvpair_type(nvp)) {
-		case NV_TYPE_DESCRIPTOR:
-			ndescs++;
-			break;
-		case NV_TYPE_NVLIST:
-			ndescs += nvlist_xndescriptors(nvpair_get_nvlist(nvp),
-			    level + 1);
-			break;
-		}
-	}
-
-	return (ndescs);
-}
-
-size_t
-nvlist_ndescriptors(const nvlist_t *nvl)
-{
 
-	return (nvlist_xndescriptors(nvl, 0));
+	return (nvl->nvl_ndescs);
 }
 
 static unsigned char *
@@ -502,13 +722,13 @@ nvlist_pack_header(const nvlist_t *nvl, unsigned char *ptr, size_t *leftp)
 
 	nvlhdr.nvlh_magic = NVLIST_HEADER_MAGIC;
 	nvlhdr.nvlh_version = NVLIST_HEADER_VERSION;
-	nvlhdr.nvlh_flags = nvl->nvl_flags;
+	nvlhdr.nvlh_flags = nvl->nvl_flags & ~NV_FLAG_LOCAL_MASK;
 #if BYTE_ORDER == BIG_ENDIAN
 	nvlhdr.nvlh_flags |= NV_FLAG_BIG_ENDIAN;
 #endif
-	nvlhdr.nvlh_descriptors = nvlist_ndescriptors(nvl);
-	nvlhdr.nvlh_size = *leftp - sizeof(nvlhdr);
-	PJDLOG_ASSERT(*leftp >= sizeof(nvlhdr));
+	nvlhdr.nvlh_descriptors = nvl->nvl_ndescs;
+	nvlhdr.nvlh_size = nvl->nvl_packsize - sizeof(nvlhdr);
+	PJDLOG_ASSERT(*leftp >= nvl->nvl_packsize);
 	memcpy(ptr, &nvlhdr, sizeof(nvlhdr));
 	ptr += sizeof(nvlhdr);
 	*leftp -= sizeof(nvlhdr);
@@ -516,12 +736,41 @@ nvlist_pack_header(const nvlist_t *nvl, unsigned char *ptr, size_t *leftp)
 	return (ptr);
 }
 
+/*
+ * Pack nvl at ptr, in one pass that packs any nested lists in place.  Each
+ * descriptor is replaced by its index, counting from *fdidxp, in the array
+ * sent alongside; if fds isn't NULL, that array is filled in too.
+ */
+unsigned char *
+nvlist_xpack_buf(const nvlist_t *nvl, unsigned char *ptr, int64_t *fdidxp,
+    int *fds, size_t *leftp)
+{
+	nvpair_t *nvp;
+
+	NVLIST_ASSERT(nvl);
+
+	if (nvl->nvl_error != 0) {
+		errno = nvl->nvl_error;
+		return (NULL);
+	}
+
+	ptr = nvlist_pack_header(nvl, ptr, leftp);
+
+	for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
+	    nvp = nvlist_next_nvpair(nvl, nvp)) {
+		ptr = nvpair_pack(nvp, ptr, fdidxp, fds, leftp);
+		if (ptr == NULL)
+			return (NULL);
+	}
+
+	return (ptr);
+}
+
 void *
-nvlist_xpack(const nvlist_t *nvl, int64_t *fdidxp, size_t *sizep)
+nvlist_xpack(const nvlist_t *nvl, int64_t *fdidxp, int *fds, size_t *sizep)
 {
-	unsigned char *buf, *ptr;
+	unsigned char *buf;
 	size_t left, size;
-	nvpair_t *nvp;
 
 	NVLIST_ASSERT(nvl);
 
@@ -535,19 +784,12 @@ nvlist_xpack(const nvlist_t *nvl, int64_t *fdidxp, size_t *sizep)
 	if (buf == NULL)
 		return (NULL);
 
-	ptr = buf;
 	left = size;
-
-	ptr = nvlist_pack_header(nvl, ptr, &left);
-
-	for (nvp = nvlist_first_nvpair(nvl); nvp != NULL;
-	    nvp = nvlist_next_nvpair(nvl, nvp)) {
-		ptr = nvpair_pack(nvp, ptr, fdidxp, &left);
-		if (ptr == NULL) {
-			free(buf);
-			return (NULL);
-		}
+	if (nvlist_xpack_buf(nvl, buf, fdidxp, fds, &left) == NULL) {
+		free(buf);
+		return (NULL);
 	}
+	PJDLOG_ASSERT(left == 0);
 
 	if (sizep != NULL)
 		*sizep = size;
@@ -570,7 +812,7 @@ nvlist_pack(const nvlist_t *nvl, size_t *sizep)
 		return (NULL);
 	}
 
-	return (nvlist_xpack(nvl, NULL, sizep));
+	return (nvlist_xpack(nvl, NULL, NULL, sizep));
 }
 
 static bool
@@ -637,10 +879,17 @@ failed:
 	return (NULL);
 }
 
+/*
+ * The pairs of an unpacked list, and of any lists nested in it, all come out
+ * of the one arena, created here unless the caller passes one in.  The lists
+ * themselves don't allocate from it, so pairs added later use malloc(3).
+ */
 nvlist_t *
-nvlist_xunpack(const void *buf, size_t size, const int *fds, size_t nfds)
+nvlist_xunpack(const void *buf, size_t size, const int *fds, size_t nfds,
+    struct nv_arena *arena)
 {
 	const unsigned char *ptr;
+	struct nv_arena *newarena;
 	nvlist_t *nvl;
 	nvpair_t *nvp;
 	size_t left;
@@ -649,6 +898,10 @@ nvlist_xunpack(const void *buf, size_t size, const int *fds, size_t nfds)
 	left = size;
 	ptr = buf;
 
+	newarena = NULL;
+	if (arena == NULL)
+		arena = newarena = nv_arena_create();
+
 	nvl = nvlist_create(0);
 	if (nvl == NULL)
 		goto failed;
@@ -658,15 +911,20 @@ nvlist_xunpack(const void *buf, size_t size, const int *fds, size_t nfds)
 		goto failed;
 
 	while (left > 0) {
-		ptr = nvpair_unpack(flags, ptr, &left, fds, nfds, &nvp);
+		ptr = nvpair_unpack(flags, ptr, &left, fds, nfds, arena, &nvp);
 		if (ptr == NULL)
 			goto failed;
 		nvlist_move_nvpair(nvl, nvp);
 	}
 
+	/* From here on, the pairs hold the arena. */
+	if (newarena != NULL)
+		nv_arena_release(newarena);
 	return (nvl);
 failed:
 	nvlist_destroy(nvl);
+	if (newarena != NULL)
+		nv_arena_release(newarena);
 	return (NULL);
 }
 
@@ -674,7 +932,43 @@ nvlist_t *
 nvlist_unpack(const void *buf, size_t size)
 {
 
-	return (nvlist_xunpack(buf, size, NULL, 0));
+	return (nvlist_xunpack(buf, size, NULL, 0, NULL));
+}
+
+/*
+ * As nvlist_xunpack(), but taking over the malloc(3)ed buffer: string and
+ * binary values point into it rather than being copied out, and it is freed
+ * along with the last pair that does, or at once if unpacking fails.
+ */
+static nvlist_t *
+nvlist_xunpack_move(void *buf, size_t size, const int *fds, size_t nfds)
+{
+	struct nv_arena *arena;
+	nvlist_t *nvl;
+	int serrno;
+
+	arena = nv_arena_create();
+	if (arena == NULL) {
+		serrno = errno;
+		free(buf);
+		errno = serrno;
+		return (NULL);
+	}
+	nv_arena_adopt(arena, buf, size);
+
+	nvl = nvlist_xunpack(buf, size, fds, nfds, arena);
+
+	serrno = errno;
+	nv_arena_release(arena);
+	errno = serrno;
+	return (nvl);
+}
+
+nvlist_t *
+nvlist_unpack_move(void *buf, size_t size)
+{
+
+	return (nvlist_xunpack_move(buf, size, NULL, 0));
 }
 
 int
@@ -691,15 +985,20 @@ nvlist_send(int sock, const nvlist_t *nvl)
 		return (-1);
 	}
 
-	fds = nvlist_descriptors(nvl, &nfds);
-	if (fds == NULL)
-		return (-1);
+	/* Packing collects the descriptors, in the order it numbers them. */
+	nfds = nvlist_ndescriptors(nvl);
+	fds = NULL;
+	if (nfds > 0) {
+		fds = malloc(sizeof(fds[0]) * nfds);
+		if (fds == NULL)
+			return (-1);
+	}
 
 	ret = -1;
 	data = NULL;
 	fdidx = 0;
 
-	data = nvlist_xpack(nvl, &fdidx, &datasize);
+	data = nvlist_xpack(nvl, &fdidx, fds, &datasize);
 	if (data == NULL)
 		goto out;
 
@@ -720,8 +1019,12 @@ out:
 	return (ret);
 }
 
-nvlist_t *
-nvlist_recv(int sock)
+/*
+ * Receive an nvlist, either copying its values out of the receive buffer or
+ * (if move is set) leaving them there, as nvlist_unpack_move() does.
+ */
+static nvlist_t *
+nvlist_xrecv(int sock, bool move)
 {
 	struct nvlist_header nvlhdr;
 	nvlist_t *nvl, *ret;
@@ -758,7 +1061,13 @@ nvlist_recv(int sock)
 			goto out;
 	}
 
-	nvl = nvlist_xunpack(buf, size, fds, nfds);
+	if (move) {
+		/* The list keeps the buffer, rather than copying values out. */
+		nvl = nvlist_xunpack_move(buf, size, fds, nfds);
+		buf = NULL;
+	} else {
+		nvl = nvlist_xunpack(buf, size, fds, nfds, NULL);
+	}
 	if (nvl == NULL)
 		goto out;
 
@@ -772,6 +1081,20 @@ out:
 	return (ret);
 }
 
+nvlist_t *
+nvlist_recv(int sock)
+{
+
+	return (nvlist_xrecv(sock, false));
+}
+
+nvlist_t *
+nvlist_recv_move(int sock)
+{
+
+	return (nvlist_xrecv(sock, true));
+}
+
 nvlist_t *
 nvlist_xfer(int sock, nvlist_t *nvl)
 {
@@ -848,24 +1171,24 @@ bool
 nvlist_exists(const nvlist_t *nvl, const char *name)
 {
 
-	return (nvlist_existsf(nvl, "%s", name));
+	return (nvlist_find(nvl, NV_TYPE_NONE, name) != NULL);
 }
 
-#define	NVLIST_EXISTS(type)						\
+#define	NVLIST_EXISTS(type, TYPE)					\
 bool									\
 nvlist_exists_##type(const nvlist_t *nvl, const char *name)		\
 {									\
 									\
-	return (nvlist_existsf_##type(nvl, "%s", name));		\
+	return (nvlist_find(nvl, NV_TYPE_##TYPE, name) != NULL);	\
 }
 
-NVLIST_EXISTS(null)
-NVLIST_EXISTS(bool)
-NVLIST_EXISTS(number)
-NVLIST_EXISTS(string)
-NVLIST_EXISTS(nvlist)
-NVLIST_EXISTS(descriptor)
-NVLIST_EXISTS(binary)
+NVLIST_EXISTS(null, NULL)
+NVLIST_EXISTS(bool, BOOL)
+NVLIST_EXISTS(number, NUMBER)
+NVLIST_EXISTS(string, STRING)
+NVLIST_EXISTS(nvlist, NVLIST)
+NVLIST_EXISTS(descriptor, DESCRIPTOR)
+NVLIST_EXISTS(binary, BINARY)
 
 #undef	NVLIST_EXISTS
 
@@ -1116,7 +1439,7 @@ nvlist_addv_null(nvlist_t *nvl, const char *namefmt, va_list nameap)
 		return;
 	}
 
-	nvp = nvpair_createv_null(namefmt, nameap);
+	nvp = nvpair_xcreatev_null(nvl->nvl_arena, namefmt, nameap);
 	if (nvp == NULL)
 		nvl->nvl_error = errno = (errno != 0 ? errno : ENOMEM);
 	else
@@ -1133,7 +1456,7 @@ nvlist_addv_bool(nvlist_t *nvl, bool value, const char *namefmt, va_list nameap)
 		return;
 	}
 
-	nvp = nvpair_createv_bool(value, namefmt, nameap);
+	nvp = nvpair_xcreatev_bool(nvl->nvl_arena, value, namefmt, nameap);
 	if (nvp == NULL)
 		nvl->nvl_error = errno = (errno != 0 ? errno : ENOMEM);
 	else
@@ -1151,7 +1474,7 @@ nvlist_addv_number(nvlist_t *nvl, uint64_t value, const char *namefmt,
 		return;
 	}
 
-	nvp = nvpair_createv_number(value, namefmt, nameap);
+	nvp = nvpair_xcreatev_number(nvl->nvl_arena, value, namefmt, nameap);
 	if (nvp == NULL)
 		nvl->nvl_error = errno = (errno != 0 ? errno : ENOMEM);
 	else
@@ -1169,7 +1492,7 @@ nvlist_addv_string(nvlist_t *nvl, const char *value, const char *namefmt,
 		return;
 	}
 
-	nvp = nvpair_createv_string(value, namefmt, nameap);
+	nvp = nvpair_xcreatev_string(nvl->nvl_arena, value, namefmt, nameap);
 	if (nvp == NULL)
 		nvl->nvl_error = errno = (errno != 0 ? errno : ENOMEM);
 	else
@@ -1223,7 +1546,8 @@ nvlist_addv_binary(nvlist_t *nvl, const void *value, size_t size,
 		return;
 	}
 
-	nvp = nvpair_createv_binary(value, size, namefmt, nameap);
+	nvp = nvpair_xcreatev_binary(nvl->nvl_arena, value, size, namefmt,
+	    nameap);
 	if (nvp == NULL)
 		nvl->nvl_error = errno = (errno != 0 ? errno : ENOMEM);
 	else
@@ -1249,6 +1573,7 @@ nvlist_move_nvpair(nvlist_t *nvl, nvpair_t *nvp)
 	}
 
 	nvpair_insert(&nvl->nvl_head, nvp, nvl);
+	nvlist_update_totals(nvl, nvp, true);
 }
 
 #define	NVLIST_MOVE(vtype, type)					\
@@ -1377,28 +1702,43 @@ nvlist_movev_binary(nvlist_t *nvl, void *value, size_t size,
 		nvlist_move_nvpair(nvl, nvp);
 }
 
-#define	NVLIST_GET(ftype, type)						\
+const nvpair_t *
+nvlist_get_nvpair(const nvlist_t *nvl, const char *name)
+{
+
+	return (nvlist_find(nvl, NV_TYPE_NONE, name));
+}
+
+#define	NVLIST_GET(ftype, type, TYPE)					\
 ftype									\
 nvlist_get_##type(const nvlist_t *nvl, const char *name)		\
 {									\
+	const nvpair_t *nvp;						\
 									\
-	return (nvlist_getf_##type(nvl, "%s", name));			\
+	nvp = nvlist_find(nvl, NV_TYPE_##TYPE, name);			\
+	if (nvp == NULL)						\
+		nvlist_report_missing(NV_TYPE_##TYPE, name);		\
+	return (nvpair_get_##type(nvp));				\
 }
 
-NVLIST_GET(const nvpair_t *, nvpair)
-NVLIST_GET(bool, bool)
-NVLIST_GET(uint64_t, number)
-NVLIST_GET(const char *, string)
-NVLIST_GET(const nvlist_t *, nvlist)
-NVLIST_GET(int, descriptor)
+NVLIST_GET(bool, bool, BOOL)
+NVLIST_GET(uint64_t, number, NUMBER)
+NVLIST_GET(const char *, string, STRING)
+NVLIST_GET(const nvlist_t *, nvlist, NVLIST)
+NVLIST_GET(int, descriptor, DESCRIPTOR)
 
 #undef	NVLIST_GET
 
 const void *
 nvlist_get_binary(const nvlist_t *nvl, const char *name, size_t *sizep)
 {
+	const nvpair_t *nvp;
 
-	return (nvlist_getf_binary(nvl, sizep, "%s", name));
+	nvp = nvlist_find(nvl, NV_TYPE_BINARY, name);
+	if (nvp == NULL)
+		nvlist_report_missing(NV_TYPE_BINARY, name);
+
+	return (nvpair_get_binary(nvp, sizep));
 }
 
 #define	NVLIST_GETF(ftype, type)					\
@@ -1456,7 +1796,7 @@ nvlist_getv_##type(const nvlist_t *nvl, const char *namefmt,		\
 	nvp = nvlist_findv(nvl, NV_TYPE_##TYPE, namefmt, cnameap);	\
 	va_end(cnameap);						\
 	if (nvp == NULL)						\
-		nvlist_report_missing(NV_TYPE_##TYPE, namefmt, nameap);	\
+		nvlist_report_missingv(NV_TYPE_##TYPE, namefmt, nameap); \
 	return (nvpair_get_##type(nvp));				\
 }
 
@@ -1479,33 +1819,64 @@ nvlist_getv_binary(const nvlist_t *nvl, size_t *sizep, const char *namefmt,
 	nvp = nvlist_findv(nvl, NV_TYPE_BINARY, namefmt, cnameap);
 	va_end(cnameap);
 	if (nvp == NULL)
-		nvlist_report_missing(NV_TYPE_BINARY, namefmt, nameap);
+		nvlist_report_missingv(NV_TYPE_BINARY, namefmt, nameap);
 
 	return (nvpair_get_binary(nvp, sizep));
 }
 
-#define	NVLIST_TAKE(ftype, type)					\
+nvpair_t *
+nvlist_take_nvpair(nvlist_t *nvl, const char *name)
+{
+	nvpair_t *nvp;
+
+	nvp = nvlist_find(nvl, NV_TYPE_NONE, name);
+	if (nvp != NULL)
+		nvlist_remove_nvpair(nvl, nvp);
+	return (nvp);
+}
+
+#define	NVLIST_TAKE(ftype, type, TYPE)					\
 ftype									\
 nvlist_take_##type(nvlist_t *nvl, const char *name)			\
 {									\
+	nvpair_t *nvp;							\
+	ftype value;							\
 									\
-	return (nvlist_takef_##type(nvl, "%s", name));			\
+	nvp = nvlist_find(nvl, NV_TYPE_##TYPE, name);			\
+	if (nvp == NULL)						\
+		nvlist_report_missing(NV_TYPE_##TYPE, name);		\
+	if (nvpair_unshare(nvp) < 0)					\
+		return ((ftype)0);					\
+	value = (ftype)(intptr_t)nvpair_get_##type(nvp);		\
+	nvlist_remove_nvpair(nvl, nvp);					\
+	nvpair_free_structure(nvp);					\
+	return (value);							\
 }
 
-NVLIST_TAKE(nvpair_t *, nvpair)
-NVLIST_TAKE(bool, bool)
-NVLIST_TAKE(uint64_t, number)
-NVLIST_TAKE(char *, string)
-NVLIST_TAKE(nvlist_t *, nvlist)
-NVLIST_TAKE(int, descriptor)
+NVLIST_TAKE(bool, bool, BOOL)
+NVLIST_TAKE(uint64_t, number, NUMBER)
+NVLIST_TAKE(char *, string, STRING)
+NVLIST_TAKE(nvlist_t *, nvlist, NVLIST)
+NVLIST_TAKE(int, descriptor, DESCRIPTOR)
 
 #undef	NVLIST_TAKE
 
 void *
 nvlist_take_binary(nvlist_t *nvl, const char *name, size_t *sizep)
 {
+	nvpair_t *nvp;
+	void *value;
 
-	return (nvlist_takef_binary(nvl, sizep, "%s", name));
+	nvp = nvlist_find(nvl, NV_TYPE_BINARY, name);
+	if (nvp == NULL)
+		nvlist_report_missing(NV_TYPE_BINARY, name);
+
+	if (nvpair_unshare(nvp) < 0)
+		return (NULL);
+	value = (void *)(intptr_t)nvpair_get_binary(nvp, sizep);
+	nvlist_remove_nvpair(nvl, nvp);
+	nvpair_free_structure(nvp);
+	return (value);
 }
 
 #define	NVLIST_TAKEF(ftype, type)					\
@@ -1567,7 +1938,9 @@ nvlist_takev_##type(nvlist_t *nvl, const char *namefmt, va_list nameap)	\
 	nvp = nvlist_findv(nvl, NV_TYPE_##TYPE, namefmt, cnameap);	\
 	va_end(cnameap);						\
 	if (nvp == NULL)						\
-		nvlist_report_missing(NV_TYPE_##TYPE, namefmt, nameap);	\
+		nvlist_report_missingv(NV_TYPE_##TYPE, namefmt, nameap); \
+	if (nvpair_unshare(nvp) < 0)					\
+		return ((ftype)0);					\
 	value = (ftype)(intptr_t)nvpair_get_##type(nvp);		\
 	nvlist_remove_nvpair(nvl, nvp);					\
 	nvpair_free_structure(nvp);					\
@@ -1594,8 +1967,10 @@ nvlist_takev_binary(nvlist_t *nvl, size_t *sizep, const char *namefmt,
 	nvp = nvlist_findv(nvl, NV_TYPE_BINARY, namefmt, cnameap);
 	va_end(cnameap);
 	if (nvp == NULL)
-		nvlist_report_missing(NV_TYPE_BINARY, namefmt, nameap);
+		nvlist_report_missingv(NV_TYPE_BINARY, namefmt, nameap);
 
+	if (nvpair_unshare(nvp) < 0)
+		return (NULL);
 	value = (void *)(intptr_t)nvpair_get_binary(nvp, sizep);
 	nvlist_remove_nvpair(nvl, nvp);
 	nvpair_free_structure(nvp);
@@ -1610,6 +1985,7 @@ nvlist_remove_nvpair(nvlist_t *nvl, nvpair_t *nvp)
 	NVPAIR_ASSERT(nvp);
 	PJDLOG_ASSERT(nvpair_nvlist(nvp) == nvl);
 
+	nvlist_update_totals(nvl, nvp, false);
 	nvpair_remove(&nvl->nvl_head, nvp, nvl);
 }
 
@@ -1617,24 +1993,24 @@ void
 nvlist_free(nvlist_t *nvl, const char *name)
 {
 
-	nvlist_freef(nvl, "%s", name);
+	nvlist_free_type(nvl, name, NV_TYPE_NONE);
 }
 
-#define	NVLIST_FREE(type)						\
+#define	NVLIST_FREE(type, TYPE)						\
 void									\
 nvlist_free_##type(nvlist_t *nvl, const char *name)			\
 {									\
 									\
-	nvlist_freef_##type(nvl, "%s", name);				\
+	nvlist_free_type(nvl, name, NV_TYPE_##TYPE);			\
 }
 
-NVLIST_FREE(null)
-NVLIST_FREE(bool)
-NVLIST_FREE(number)
-NVLIST_FREE(string)
-NVLIST_FREE(nvlist)
-NVLIST_FREE(descriptor)
-NVLIST_FREE(binary)
+NVLIST_FREE(null, NULL)
+NVLIST_FREE(bool, BOOL)
+NVLIST_FREE(number, NUMBER)
+NVLIST_FREE(string, STRING)
+NVLIST_FREE(nvlist, NVLIST)
+NVLIST_FREE(descriptor, DESCRIPTOR)
+NVLIST_FREE(binary, BINARY)
 
 #undef	NVLIST_FREE
 
@@ -36,8 +36,31 @@
 
 #include "nv.h"
 
-void *nvlist_xpack(const nvlist_t *nvl, int64_t *fdidxp, size_t *sizep);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *nvlist_xpack(const nvlist_t *nvl, int64_t *fdidxp, int *fds,
+    size_t *sizep);
+unsigned char *nvlist_xpack_buf(const nvlist_t *nvl, unsigned char *ptr,
+    int64_t *fdidxp, int *fds, size_t *leftp);
+struct nv_arena;
 nvlist_t *nvlist_xunpack(const void *buf, size_t size, const int *fds,
-    size_t nfds);
+    size_t nfds, struct nv_arena *arena);
+
+/* Name index maintenance, for nvpair_insert() and nvpair_remove(). */
+void nvlist_index_insert(nvlist_t *nvl, nvpair_t *nvp);
+void nvlist_index_remove(nvlist_t *nvl, nvpair_t *nvp);
+
+/*
+ * Statistics for the arena that the list's pairs come from, as for
+ * nv_arena_stats().  Returns -1 if they aren't in an arena.
+ */
+int nvlist_arena_stats(const nvlist_t *nvl, size_t *nchunksp,
+    size_t *nallocsp);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif	/* !_NVLIST_IMPL_H_ */
@@ -69,6 +69,8 @@ struct nvpair {
 	uint64_t	 nvp_data;
 	size_t		 nvp_datasize;
 	nvlist_t	*nvp_list;	/* Used for sanity checks. */
+	struct nv_arena	*nvp_arena;	/* Holds the pair, if not NULL. */
+	bool		 nvp_arenadata;	/* nvp_arena owns the value. */
 	TAILQ_ENTRY(nvpair) nvp_next;
 };
 
@@ -83,6 +85,255 @@ struct nvpair_header {
 	uint64_t	nvph_datasize;
 } __packed;
 
+/*
+ * Pairs (with their names) and small string and binary values can be carved
+ * out of an arena, a chain of chunks that are only freed all together.  Each
+ * pair in an arena holds a reference to it, as does a list that allocates
+ * from it, so a pair removed from its list stays valid for as long as it
+ * lives; the memory of pairs freed early is not reused, though.
+ */
+#define	NV_ARENA_CHUNK		4096	/* Size of the first chunk */
+#define	NV_ARENA_CHUNK_MAX	65536	/* Chunks double up to this */
+#define	NV_ARENA_DATA_MAX	1024	/* Larger values use malloc(3) */
+#define	NV_ARENA_ALIGN		16
+#define	NV_ARENA_ROUND(size)						\
+	(((size) + NV_ARENA_ALIGN - 1) & ~(size_t)(NV_ARENA_ALIGN - 1))
+
+struct nv_arena_chunk {
+	struct nv_arena_chunk	*nac_next;
+	size_t			 nac_size;
+	size_t			 nac_used;
+};
+
+/*
+ * An arena is held by every pair allocated from it, so lists that share one
+ * (say a sublist taken out of a received list, and the rest of that list)
+ * needn't be freed in the same thread; nva_refs is only changed atomically.
+ * Allocation is not locked: only the arena's creator allocates from it.
+ */
+struct nv_arena {
+	unsigned int		 nva_refs;
+	struct nv_arena_chunk	*nva_chunk;	/* Newest first. */
+	unsigned char		*nva_buf;	/* Adopted unpack buffer. */
+	size_t			 nva_bufsize;
+	size_t			 nva_nchunks;	/* Statistics, for tests. */
+	size_t			 nva_nallocs;
+};
+
+struct nv_arena *
+nv_arena_create(void)
+{
+	struct nv_arena_chunk *chunk;
+	struct nv_arena *arena;
+
+	/* The arena and its first chunk share a single allocation. */
+	arena = malloc(NV_ARENA_CHUNK);
+	if (arena == NULL)
+		return (NULL);
+	chunk = (struct nv_arena_chunk *)((unsigned char *)arena +
+	    NV_ARENA_ROUND(sizeof(*arena)));
+	chunk->nac_next = NULL;
+	chunk->nac_size = NV_ARENA_CHUNK - NV_ARENA_ROUND(sizeof(*arena));
+	chunk->nac_used = NV_ARENA_ROUND(sizeof(*chunk));
+	arena->nva_refs = 1;
+	arena->nva_chunk = chunk;
+	arena->nva_buf = NULL;
+	arena->nva_bufsize = 0;
+	arena->nva_nchunks = 1;
+	arena->nva_nallocs = 0;
+
+	return (arena);
+}
+
+struct nv_arena *
+nv_arena_hold(struct nv_arena *arena)
+{
+
+	PJDLOG_ASSERT(__atomic_load_n(&arena->nva_refs, __ATOMIC_RELAXED) > 0);
+
+	__atomic_add_fetch(&arena->nva_refs, 1, __ATOMIC_RELAXED);
+	return (arena);
+}
+
+void
+nv_arena_release(struct nv_arena *arena)
+{
+	struct nv_arena_chunk *chunk, *next;
+
+	PJDLOG_ASSERT(__atomic_load_n(&arena->nva_refs, __ATOMIC_RELAXED) > 0);
+
+	if (__atomic_sub_fetch(&arena->nva_refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	for (chunk = arena->nva_chunk; chunk->nac_next != NULL; chunk = next) {
+		next = chunk->nac_next;
+		free(chunk);
+	}
+	free(arena->nva_buf);
+	free(arena);
+}
+
+void
+nv_arena_adopt(struct nv_arena *arena, void *buf, size_t size)
+{
+
+	PJDLOG_ASSERT(arena->nva_refs > 0);
+	PJDLOG_ASSERT(arena->nva_buf == NULL);
+
+	arena->nva_buf = buf;
+	arena->nva_bufsize = size;
+}
+
+void
+nv_arena_stats(const struct nv_arena *arena, size_t *nchunksp,
+    size_t *nallocsp)
+{
+
+	PJDLOG_ASSERT(arena->nva_refs > 0);
+
+	*nchunksp = arena->nva_nchunks;
+	*nallocsp = arena->nva_nallocs;
+}
+
+/* Can [ptr, ptr + size) be borrowed from the arena's adopted buffer? */
+static bool
+nv_arena_borrows(const struct nv_arena *arena, const void *ptr, size_t size)
+{
+	const unsigned char *p;
+
+	p = ptr;
+	return (arena->nva_buf != NULL && p >= arena->nva_buf &&
+	    size <= arena->nva_bufsize &&
+	    (size_t)(p - arena->nva_buf) <= arena->nva_bufsize - size);
+}
+
+static void *
+nv_arena_alloc(struct nv_arena *arena, size_t size)
+{
+	struct nv_arena_chunk *chunk;
+	size_t chunksize;
+	void *ptr;
+
+	size = NV_ARENA_ROUND(size);
+	chunk = arena->nva_chunk;
+	if (chunk->nac_size - chunk->nac_used < size) {
+		chunksize = MIN(chunk->nac_size * 2, NV_ARENA_CHUNK_MAX);
+		chunksize = MAX(chunksize,
+		    NV_ARENA_ROUND(sizeof(*chunk)) + size);
+		chunk = malloc(chunksize);
+		if (chunk == NULL)
+			return (NULL);
+		chunk->nac_next = arena->nva_chunk;
+		chunk->nac_size = chunksize;
+		chunk->nac_used = NV_ARENA_ROUND(sizeof(*chunk));
+		arena->nva_chunk = chunk;
+		arena->nva_nchunks++;
+	}
+	ptr = (unsigned char *)chunk + chunk->nac_used;
+	chunk->nac_used += size;
+	arena->nva_nallocs++;
+
+	return (ptr);
+}
+
+/*
+ * Allocate a pair named name (of namelen bytes, without the terminating NUL),
+ * from the arena if there is one.
+ */
+static nvpair_t *
+nvpair_alloc(struct nv_arena *arena, const char *name, size_t namelen)
+{
+	nvpair_t *nvp;
+	size_t size;
+
+	size = sizeof(*nvp) + namelen + 1;
+	if (arena != NULL)
+		nvp = nv_arena_alloc(arena, size);
+	else
+		nvp = malloc(size);
+	if (nvp == NULL)
+		return (NULL);
+	memset(nvp, 0, sizeof(*nvp));
+	nvp->nvp_name = (char *)(nvp + 1);
+	memcpy(nvp->nvp_name, name, namelen + 1);
+	if (arena != NULL)
+		nvp->nvp_arena = nv_arena_hold(arena);
+
+	return (nvp);
+}
+
+static void
+nvpair_release(nvpair_t *nvp)
+{
+
+	if (nvp->nvp_arena != NULL)
+		nv_arena_release(nvp->nvp_arena);
+	else
+		free(nvp);
+}
+
+/*
+ * Set a string or binary value to a copy of the given one, in the pair's
+ * arena if it has one and the value is small.
+ */
+static int
+nvpair_copy_data(nvpair_t *nvp, const void *value, size_t size)
+{
+	void *data;
+
+	PJDLOG_ASSERT(nvp->nvp_type == NV_TYPE_STRING ||
+	    nvp->nvp_type == NV_TYPE_BINARY);
+
+	data = NULL;
+	if (nvp->nvp_arena != NULL && size <= NV_ARENA_DATA_MAX)
+		data = nv_arena_alloc(nvp->nvp_arena, size);
+	nvp->nvp_arenadata = (data != NULL);
+	if (data == NULL) {
+		data = malloc(size);
+		if (data == NULL)
+			return (-1);
+	}
+	memcpy(data, value, size);
+	nvp->nvp_data = (uint64_t)(uintptr_t)data;
+	nvp->nvp_datasize = size;
+
+	return (0);
+}
+
+/*
+ * Set an unpacked string or binary value, pointing into the buffer it came
+ * from if the pair's arena owns that, or else to a copy of it.
+ */
+static int
+nvpair_unpack_data(nvpair_t *nvp, const unsigned char *ptr)
+{
+
+	if (nvp->nvp_arena != NULL &&
+	    nv_arena_borrows(nvp->nvp_arena, ptr, nvp->nvp_datasize)) {
+		nvp->nvp_data = (uint64_t)(uintptr_t)ptr;
+		nvp->nvp_arenadata = true;
+		return (0);
+	}
+	return (nvpair_copy_data(nvp, ptr, nvp->nvp_datasize));
+}
+
+int
+nvpair_unshare(nvpair_t *nvp)
+{
+	void *data;
+
+	NVPAIR_ASSERT(nvp);
+
+	if (!nvp->nvp_arenadata)
+		return (0);
+	data = malloc(nvp->nvp_datasize);
+	if (data == NULL)
+		return (-1);
+	memcpy(data, (const void *)(uintptr_t)nvp->nvp_data, nvp->nvp_datasize);
+	nvp->nvp_data = (uint64_t)(uintptr_t)data;
+	nvp->nvp_arenadata = false;
+
+	return (0);
+}
 
 void
 nvpair_assert(const nvpair_t *nvp)
@@ -100,6 +351,15 @@ nvpair_nvlist(const nvpair_t *nvp)
 	return (nvp->nvp_list);
 }
 
+struct nv_arena *
+nvpair_arena(const nvpair_t *nvp)
+{
+
+	NVPAIR_ASSERT(nvp);
+
+	return (nvp->nvp_arena);
+}
+
 nvpair_t *
 nvpair_next(const nvpair_t *nvp)
 {
@@ -130,15 +390,17 @@ nvpair_insert(struct nvl_head *head, nvpair_t *nvp, nvlist_t *nvl)
 
 	TAILQ_INSERT_TAIL(head, nvp, nvp_next);
 	nvp->nvp_list = nvl;
+	nvlist_index_insert(nvl, nvp);
 }
 
 void
-nvpair_remove(struct nvl_head *head, nvpair_t *nvp, const nvlist_t *nvl)
+nvpair_remove(struct nvl_head *head, nvpair_t *nvp, nvlist_t *nvl)
 {
 
 	NVPAIR_ASSERT(nvp);
 	PJDLOG_ASSERT(nvp->nvp_list == nvl);
 
+	nvlist_index_remove(nvl, nvp);
 	TAILQ_REMOVE(head, nvp, nvp_next);
 	nvp->nvp_list = NULL;
 }
@@ -292,10 +554,9 @@ nvpair_pack_string(const nvpair_t *nvp, unsigned char *ptr, size_t *leftp)
 
 static unsigned char *
 nvpair_pack_nvlist(const nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp,
-    size_t *leftp)
+    int *fds, size_t *leftp)
 {
-	unsigned char *data;
-	size_t size;
+	size_t left;
 
 	NVPAIR_ASSERT(nvp);
 	PJDLOG_ASSERT(nvp->nvp_type == NV_TYPE_NVLIST);
@@ -303,26 +564,21 @@ nvpair_pack_nvlist(const nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp,
 	if (nvp->nvp_datasize == 0)
 		return (ptr);
 
-	data = nvlist_xpack((const nvlist_t *)(intptr_t)nvp->nvp_data, fdidxp,
-	    &size);
-	if (data == NULL)
+	/* Pack the nested list in place, rather than copying it in. */
+	left = *leftp;
+	ptr = nvlist_xpack_buf((const nvlist_t *)(intptr_t)nvp->nvp_data, ptr,
+	    fdidxp, fds, leftp);
+	if (ptr == NULL)
 		return (NULL);
 
-	PJDLOG_ASSERT(size == nvp->nvp_datasize);
-	PJDLOG_ASSERT(*leftp >= nvp->nvp_datasize);
-
-	memcpy(ptr, data, nvp->nvp_datasize);
-	free(data);
-
-	ptr += nvp->nvp_datasize;
-	*leftp -= nvp->nvp_datasize;
+	PJDLOG_ASSERT(left - *leftp == nvp->nvp_datasize);
 
 	return (ptr);
 }
 
 static unsigned char *
 nvpair_pack_descriptor(const nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp,
-    size_t *leftp)
+    int *fds, size_t *leftp)
 {
 	int64_t value;
 
@@ -338,6 +594,8 @@ nvpair_pack_descriptor(const nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp,
 		 */
 		PJDLOG_ASSERT(fdidxp != NULL);
 
+		if (fds != NULL)
+			fds[*fdidxp] = (int)value;
 		value = *fdidxp;
 		(*fdidxp)++;
 	}
@@ -366,7 +624,8 @@ nvpair_pack_binary(const nvpair_t *nvp, unsigned char *ptr, size_t *leftp)
 }
 
 unsigned char *
-nvpair_pack(nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp, size_t *leftp)
+nvpair_pack(nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp, int *fds,
+    size_t *leftp)
 {
 
 	NVPAIR_ASSERT(nvp);
@@ -403,10 +662,10 @@ nvpair_pack(nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp, size_t *leftp)
 		ptr = nvpair_pack_string(nvp, ptr, leftp);
 		break;
 	case NV_TYPE_NVLIST:
-		ptr = nvpair_pack_nvlist(nvp, ptr, fdidxp, leftp);
+		ptr = nvpair_pack_nvlist(nvp, ptr, fdidxp, fds, leftp);
 		break;
 	case NV_TYPE_DESCRIPTOR:
-		ptr = nvpair_pack_descriptor(nvp, ptr, fdidxp, leftp);
+		ptr = nvpair_pack_descriptor(nvp, ptr, fdidxp, fds, leftp);
 		break;
 	case NV_TYPE_BINARY:
 		ptr = nvpair_pack_binary(nvp, ptr, leftp);
@@ -568,8 +827,7 @@ nvpair_unpack_string(int flags __unused, nvpair_t *nvp,
 		return (NULL);
 	}
 
-	nvp->nvp_data = (uint64_t)(uintptr_t)strdup((const char *)ptr);
-	if (nvp->nvp_data == 0)
+	if (nvpair_unpack_data(nvp, ptr) == -1)
 		return (NULL);
 
 	ptr += nvp->nvp_datasize;
@@ -580,7 +838,8 @@ nvpair_unpack_string(int flags __unused, nvpair_t *nvp,
 
 static const unsigned char *
 nvpair_unpack_nvlist(int flags __unused, nvpair_t *nvp,
-    const unsigned char *ptr, size_t *leftp, const int *fds, size_t nfds)
+    const unsigned char *ptr, size_t *leftp, const int *fds, size_t nfds,
+    struct nv_arena *arena)
 {
 	nvlist_t *value;
 
@@ -591,7 +850,7 @@ nvpair_unpack_nvlist(int flags __unused, nvpair_t *nvp,
 		return (NULL);
 	}
 
-	value = nvlist_xunpack(ptr, nvp->nvp_datasize, fds, nfds);
+	value = nvlist_xunpack(ptr, nvp->nvp_datasize, fds, nfds, arena);
 	if (value == NULL)
 		return (NULL);
 
@@ -647,7 +906,6 @@ static const unsigned char *
 nvpair_unpack_binary(int flags __unused, nvpair_t *nvp,
     const unsigned char *ptr, size_t *leftp)
 {
-	void *value;
 
 	PJDLOG_ASSERT(nvp->nvp_type == NV_TYPE_BINARY);
 
@@ -656,39 +914,32 @@ nvpair_unpack_binary(int flags __unused, nvpair_t *nvp,
 		return (NULL);
 	}
 
-	value = malloc(nvp->nvp_datasize);
-	if (value == NULL)
+	if (nvpair_unpack_data(nvp, ptr) == -1)
 		return (NULL);
 
-	memcpy(value, ptr, nvp->nvp_datasize);
 	ptr += nvp->nvp_datasize;
 	*leftp -= nvp->nvp_datasize;
 
-	nvp->nvp_data = (uint64_t)(uintptr_t)value;
-
 	return (ptr);
 }
 
 const unsigned char *
 nvpair_unpack(int flags, const unsigned char *ptr, size_t *leftp,
-    const int *fds, size_t nfds, nvpair_t **nvpp)
+    const int *fds, size_t nfds, struct nv_arena *arena, nvpair_t **nvpp)
 {
-	nvpair_t *nvp, *tmp;
+	nvpair_t *nvp, hdr;
+	char name[NV_NAME_MAX];
 
-	nvp = calloc(1, sizeof(*nvp) + NV_NAME_MAX);
+	/* Unpack the header on the stack, to know how big the pair is. */
+	hdr.nvp_name = name;
+	ptr = nvpair_unpack_header(flags, &hdr, ptr, leftp);
+	if (ptr == NULL)
+		return (NULL);
+	nvp = nvpair_alloc(arena, name, strlen(name));
 	if (nvp == NULL)
 		return (NULL);
-	nvp->nvp_name = (char *)(nvp + 1);
-
-	ptr = nvpair_unpack_header(flags, nvp, ptr, leftp);
-	if (ptr == NULL)
-		goto failed;
-	tmp = realloc(nvp, sizeof(*nvp) + strlen(nvp->nvp_name) + 1);
-	if (tmp == NULL)
-		goto failed;
-	nvp = tmp;
-	/* Update nvp_name after realloc(). */
-	nvp->nvp_name = (char *)(nvp + 1);
+	nvp->nvp_type = hdr.nvp_type;
+	nvp->nvp_datasize = hdr.nvp_datasize;
 
 	switch (nvp->nvp_type) {
 	case NV_TYPE_NULL:
@@ -705,7 +956,7 @@ nvpair_unpack(int flags, const unsigned char *ptr, size_t *leftp,
 		break;
 	case NV_TYPE_NVLIST:
 		ptr = nvpair_unpack_nvlist(flags, nvp, ptr, leftp, fds,
-		    nfds);
+		    nfds, arena);
 		break;
 	case NV_TYPE_DESCRIPTOR:
 		ptr = nvpair_unpack_descriptor(flags, nvp, ptr, leftp, fds,
@@ -725,7 +976,7 @@ nvpair_unpack(int flags, const unsigned char *ptr, size_t *leftp,
 	*nvpp = nvp;
 	return (ptr);
 failed:
-	free(nvp);
+	nvpair_release(nvp);
 	return (NULL);
 }
 
@@ -748,36 +999,32 @@ nvpair_name(const nvpair_t *nvp)
 }
 
 static nvpair_t *
-nvpair_allocv(int type, uint64_t data, size_t datasize, const char *namefmt,
-    va_list nameap)
+nvpair_allocv(struct nv_arena *arena, int type, uint64_t data,
+    size_t datasize, const char *namefmt, va_list nameap)
 {
 	nvpair_t *nvp;
-	char *name;
+	char name[NV_NAME_MAX];
 	int namelen;
 
 	PJDLOG_ASSERT(type >= NV_TYPE_FIRST && type <= NV_TYPE_LAST);
 
-	namelen = vasprintf(&name, namefmt, nameap);
+	namelen = vsnprintf(name, sizeof(name), namefmt, nameap);
 	if (namelen < 0)
 		return (NULL);
 
 	PJDLOG_ASSERT(namelen > 0);
 	if (namelen >= NV_NAME_MAX) {
-		free(name);
 		errno = ENAMETOOLONG;
 		return (NULL);
 	}
 
-	nvp = calloc(1, sizeof(*nvp) + namelen + 1);
+	nvp = nvpair_alloc(arena, name, namelen);
 	if (nvp != NULL) {
-		nvp->nvp_name = (char *)(nvp + 1);
-		memcpy(nvp->nvp_name, name, namelen + 1);
 		nvp->nvp_type = type;
 		nvp->nvp_data = data;
 		nvp->nvp_datasize = datasize;
 		nvp->nvp_magic = NVPAIR_MAGIC;
 	}
-	free(name);
 
 	return (nvp);
 }
@@ -955,48 +1202,28 @@ nvpair_t *
 nvpair_createv_null(const char *namefmt, va_list nameap)
 {
 
-	return (nvpair_allocv(NV_TYPE_NULL, 0, 0, namefmt, nameap));
+	return (nvpair_xcreatev_null(NULL, namefmt, nameap));
 }
 
 nvpair_t *
 nvpair_createv_bool(bool value, const char *namefmt, va_list nameap)
 {
 
-	return (nvpair_allocv(NV_TYPE_BOOL, value ? 1 : 0, sizeof(uint8_t),
-	    namefmt, nameap));
+	return (nvpair_xcreatev_bool(NULL, value, namefmt, nameap));
 }
 
 nvpair_t *
 nvpair_createv_number(uint64_t value, const char *namefmt, va_list nameap)
 {
 
-	return (nvpair_allocv(NV_TYPE_NUMBER, value, sizeof(value), namefmt,
-	    nameap));
+	return (nvpair_xcreatev_number(NULL, value, namefmt, nameap));
 }
 
 nvpair_t *
 nvpair_createv_string(const char *value, const char *namefmt, va_list nameap)
 {
-	nvpair_t *nvp;
-	size_t size;
-	char *data;
-
-	if (value == NULL) {
-		errno = EINVAL;
-		return (NULL);
-	}
 
-	data = strdup(value);
-	if (data == NULL)
-		return (NULL);
-	size = strlen(value) + 1;
-
-	nvp = nvpair_allocv(NV_TYPE_STRING, (uint64_t)(uintptr_t)data, size,
-	    namefmt, nameap);
-	if (nvp == NULL)
-		free(data);
-
-	return (nvp);
+	return (nvpair_xcreatev_string(NULL, value, namefmt, nameap));
 }
 
 nvpair_t *
@@ -1015,7 +1242,7 @@ nvpair_createv_nvlist(const nvlist_t *value, const char *namefmt,
 	if (nvl == NULL)
 		return (NULL);
 
-	nvp = nvpair_allocv(NV_TYPE_NVLIST, (uint64_t)(uintptr_t)nvl, 0,
+	nvp = nvpair_allocv(NULL, NV_TYPE_NVLIST, (uint64_t)(uintptr_t)nvl, 0,
 	    namefmt, nameap);
 	if (nvp == NULL)
 		nvlist_destroy(nvl);
@@ -1037,7 +1264,7 @@ nvpair_createv_descriptor(int value, const char *namefmt, va_list nameap)
 	if (value < 0)
 		return (NULL);
 
-	nvp = nvpair_allocv(NV_TYPE_DESCRIPTOR, (uint64_t)value,
+	nvp = nvpair_allocv(NULL, NV_TYPE_DESCRIPTOR, (uint64_t)value,
 	    sizeof(int64_t), namefmt, nameap);
 	if (nvp == NULL)
 		close(value);
@@ -1049,23 +1276,73 @@ nvpair_t *
 nvpair_createv_binary(const void *value, size_t size, const char *namefmt,
     va_list nameap)
 {
+
+	return (nvpair_xcreatev_binary(NULL, value, size, namefmt, nameap));
+}
+
+nvpair_t *
+nvpair_xcreatev_null(struct nv_arena *arena, const char *namefmt,
+    va_list nameap)
+{
+
+	return (nvpair_allocv(arena, NV_TYPE_NULL, 0, 0, namefmt, nameap));
+}
+
+nvpair_t *
+nvpair_xcreatev_bool(struct nv_arena *arena, bool value, const char *namefmt,
+    va_list nameap)
+{
+
+	return (nvpair_allocv(arena, NV_TYPE_BOOL, value ? 1 : 0,
+	    sizeof(uint8_t), namefmt, nameap));
+}
+
+nvpair_t *
+nvpair_xcreatev_number(struct nv_arena *arena, uint64_t value,
+    const char *namefmt, va_list nameap)
+{
+
+	return (nvpair_allocv(arena, NV_TYPE_NUMBER, value, sizeof(value),
+	    namefmt, nameap));
+}
+
+nvpair_t *
+nvpair_xcreatev_string(struct nv_arena *arena, const char *value,
+    const char *namefmt, va_list nameap)
+{
 	nvpair_t *nvp;
-	void *data;
 
-	if (value == NULL || size == 0) {
+	if (value == NULL) {
 		errno = EINVAL;
 		return (NULL);
 	}
 
-	data = malloc(size);
-	if (data == NULL)
+	nvp = nvpair_allocv(arena, NV_TYPE_STRING, 0, 0, namefmt, nameap);
+	if (nvp != NULL &&
+	    nvpair_copy_data(nvp, value, strlen(value) + 1) < 0) {
+		nvpair_release(nvp);
+		nvp = NULL;
+	}
+
+	return (nvp);
+}
+
+nvpair_t *
+nvpair_xcreatev_binary(struct nv_arena *arena, const void *value, size_t size,
+    const char *namefmt, va_list nameap)
+{
+	nvpair_t *nvp;
+
+	if (value == NULL || size == 0) {
+		errno = EINVAL;
 		return (NULL);
-	memcpy(data, value, size);
+	}
 
-	nvp = nvpair_allocv(NV_TYPE_BINARY, (uint64_t)(uintptr_t)data, size,
-	    namefmt, nameap);
-	if (nvp == NULL)
-		free(data);
+	nvp = nvpair_allocv(arena, NV_TYPE_BINARY, 0, 0, namefmt, nameap);
+	if (nvp != NULL && nvpair_copy_data(nvp, value, size) < 0) {
+		nvpair_release(nvp);
+		nvp = NULL;
+	}
 
 	return (nvp);
 }
@@ -1160,7 +1437,7 @@ nvpair_movev_string(char *value, const char *namefmt, va_list nameap)
 		return (NULL);
 	}
 
-	nvp = nvpair_allocv(NV_TYPE_STRING, (uint64_t)(uintptr_t)value,
+	nvp = nvpair_allocv(NULL, NV_TYPE_STRING, (uint64_t)(uintptr_t)value,
 	    strlen(value) + 1, namefmt, nameap);
 	if (nvp == NULL)
 		free(value);
@@ -1178,7 +1455,7 @@ nvpair_movev_nvlist(nvlist_t *value, const char *namefmt, va_list nameap)
 		return (NULL);
 	}
 
-	nvp = nvpair_allocv(NV_TYPE_NVLIST, (uint64_t)(uintptr_t)value, 0,
+	nvp = nvpair_allocv(NULL, NV_TYPE_NVLIST, (uint64_t)(uintptr_t)value, 0,
 	    namefmt, nameap);
 	if (nvp == NULL)
 		nvlist_destroy(value);
@@ -1195,7 +1472,7 @@ nvpair_movev_descriptor(int value, const char *namefmt, va_list nameap)
 		return (NULL);
 	}
 
-	return (nvpair_allocv(NV_TYPE_DESCRIPTOR, (uint64_t)value,
+	return (nvpair_allocv(NULL, NV_TYPE_DESCRIPTOR, (uint64_t)value,
 	    sizeof(int64_t), namefmt, nameap));
 }
 
@@ -1209,8 +1486,8 @@ nvpair_movev_binary(void *value, size_t size, const char *namefmt,
 		return (NULL);
 	}
 
-	return (nvpair_allocv(NV_TYPE_BINARY, (uint64_t)(uintptr_t)value, size,
-	    namefmt, nameap));
+	return (nvpair_allocv(NULL, NV_TYPE_BINARY, (uint64_t)(uintptr_t)value,
+	    size, namefmt, nameap));
 }
 
 bool
@@ -1289,13 +1566,12 @@ nvpair_free(nvpair_t *nvp)
 		nvlist_destroy((nvlist_t *)(intptr_t)nvp->nvp_data);
 		break;
 	case NV_TYPE_STRING:
-		free((char *)(intptr_t)nvp->nvp_data);
-		break;
 	case NV_TYPE_BINARY:
-		free((void *)(intptr_t)nvp->nvp_data);
+		if (!nvp->nvp_arenadata)
+			free((void *)(intptr_t)nvp->nvp_data);
 		break;
 	}
-	free(nvp);
+	nvpair_release(nvp);
 }
 
 void
@@ -1306,7 +1582,7 @@ nvpair_free_structure(nvpair_t *nvp)
 	PJDLOG_ASSERT(nvp->nvp_list == NULL);
 
 	nvp->nvp_magic = 0;
-	free(nvp);
+	nvpair_release(nvp);
 }
 
 const char *
@@ -40,19 +40,53 @@
 
 TAILQ_HEAD(nvl_head, nvpair);
 
+struct nv_arena;
+
+struct nv_arena *nv_arena_create(void);
+struct nv_arena *nv_arena_hold(struct nv_arena *arena);
+void nv_arena_release(struct nv_arena *arena);
+/*
+ * Give the arena a malloc(3)ed buffer to free along with it, so that string
+ * and binary values unpacked from the buffer can point into it.
+ */
+void nv_arena_adopt(struct nv_arena *arena, void *buf, size_t size);
+/*
+ * The number of chunks the arena has taken from malloc(3), and of blocks
+ * (pairs and values) carved out of them.
+ */
+void nv_arena_stats(const struct nv_arena *arena, size_t *nchunksp,
+    size_t *nallocsp);
+
 void nvpair_assert(const nvpair_t *nvp);
 const nvlist_t *nvpair_nvlist(const nvpair_t *nvp);
+/* The arena holding the pair, or NULL. */
+struct nv_arena *nvpair_arena(const nvpair_t *nvp);
 nvpair_t *nvpair_next(const nvpair_t *nvp);
 nvpair_t *nvpair_prev(const nvpair_t *nvp);
 void nvpair_insert(struct nvl_head *head, nvpair_t *nvp, nvlist_t *nvl);
-void nvpair_remove(struct nvl_head *head, nvpair_t *nvp, const nvlist_t *nvl);
+void nvpair_remove(struct nvl_head *head, nvpair_t *nvp, nvlist_t *nvl);
 size_t nvpair_header_size(void);
 size_t nvpair_size(const nvpair_t *nvp);
 unsigned char *nvpair_pack(nvpair_t *nvp, unsigned char *ptr, int64_t *fdidxp,
-    size_t *leftp);
+    int *fds, size_t *leftp);
 const unsigned char *nvpair_unpack(int flags, const unsigned char *ptr,
-    size_t *leftp, const int *fds, size_t nfds, nvpair_t **nvpp);
+    size_t *leftp, const int *fds, size_t nfds, struct nv_arena *arena,
+    nvpair_t **nvpp);
 void nvpair_free_structure(nvpair_t *nvp);
+/* Move a value held in an arena out to the heap, for nvlist_take_*(). */
+int nvpair_unshare(nvpair_t *nvp);
+
+/* As nvpair_createv_*(), allocating from the arena if it isn't NULL. */
+nvpair_t *nvpair_xcreatev_null(struct nv_arena *arena, const char *namefmt,
+    va_list nameap);
+nvpair_t *nvpair_xcreatev_bool(struct nv_arena *arena, bool value,
+    const char *namefmt, va_list nameap);
+nvpair_t *nvpair_xcreatev_number(struct nv_arena *arena, uint64_t value,
+    const char *namefmt, va_list nameap);
+nvpair_t *nvpair_xcreatev_string(struct nv_arena *arena, const char *value,
+    const char *namefmt, va_list nameap);
+nvpair_t *nvpair_xcreatev_binary(struct nv_arena *arena, const void *value,
+    size_t size, const char *namefmt, va_list nameap);
 const char *nvpair_type_string(int type);
 
 #endif	/* !_NVPAIR_IMPL_H_ */
@@ -1,4 +1,12 @@
 #include "nv.h"
+#if defined(__has_include)
+#if __has_include("nvlist_impl.h")
+// Internal headers (only in-tree builds have them), for arena statistics.
+#define HAVE_ARENA_STATS
+#include "nv_impl.h"
+#include "nvlist_impl.h"
+#endif
+#endif
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -6,6 +14,10 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <string>
@@ -15,6 +27,7 @@
 extern bool verbose;
 static nvlist_t *nvnull = NULL;
 
+
 // Param indicates whether names are case-sensitive
 class NVListTest : public ::testing::TestWithParam<bool> {
 };
@@ -128,8 +141,542 @@ TEST_P(NVListTest, Basic) {
   nvlist_destroy(list2);
   nvlist_destroy(list3);
 }
+
+// Enough pairs for lookups to go through the name index.
+TEST_P(NVListTest, ManyPairs) {
+  bool case_sensitive = GetParam();
+  const int kCount = 500;
+  nvlist_t *list = nvlist_create(case_sensitive ? 0 : NV_FLAG_IGNORE_CASE);
+  for (int ii = 0; ii < kCount; ii++) {
+    nvlist_addf_number(list, ii, "field%d", ii);
+  }
+  EXPECT_EQ(0, nvlist_error(list));
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_TRUE(nvlist_existsf_number(list, "field%d", ii));
+    EXPECT_EQ(!case_sensitive, nvlist_existsf(list, "FIELD%d", ii));
+    EXPECT_FALSE(nvlist_existsf_string(list, "field%d", ii));
+    EXPECT_EQ((uint64_t)ii, nvlist_getf_number(list, "field%d", ii));
+  }
+  EXPECT_FALSE(nvlist_exists(list, "field500"));
+
+  // Duplicate names are still refused.
+  nvlist_t *dup = nvlist_clone(list);
+  nvlist_add_string(dup, case_sensitive ? "field7" : "Field7", "again");
+  EXPECT_EQ(EEXIST, nvlist_error(dup));
+  nvlist_destroy(dup);
+
+  // Remove the even pairs, then add some back with a different type.
+  for (int ii = 0; ii < kCount; ii += 2) {
+    EXPECT_EQ((uint64_t)ii, nvlist_takef_number(list, "field%d", ii));
+  }
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_EQ(ii % 2 == 1, nvlist_existsf(list, "field%d", ii));
+  }
+  for (int ii = 0; ii < kCount; ii += 4) {
+    nvlist_addf_bool(list, true, "field%d", ii);
+  }
+  EXPECT_EQ(0, nvlist_error(list));
+  for (int ii = 0; ii < kCount; ii += 4) {
+    EXPECT_TRUE(nvlist_existsf_bool(list, "field%d", ii));
+    EXPECT_FALSE(nvlist_existsf_number(list, "field%d", ii));
+  }
+
+  // Iteration is still in insertion order.
+  void *cookie = NULL;
+  int type, count = 0, last = -1;
+  const char *name;
+  while ((name = nvlist_next(list, &type, &cookie)) != NULL) {
+    int index = atoi(name + strlen("field"));
+    if (type == NV_TYPE_NUMBER) {
+      EXPECT_LT(last, index);
+      last = index;
+    } else {
+      EXPECT_EQ(NV_TYPE_BOOL, type);
+      last = kCount;
+    }
+    count++;
+  }
+  EXPECT_EQ(kCount / 2 + kCount / 4, count);
+
+  // Unpacked and cloned lists find everything too.
+  size_t size;
+  void *data = nvlist_pack(list, &size);
+  nvlist_t *list2 = nvlist_unpack(data, size);
+  free(data);
+  nvlist_t *list3 = nvlist_clone(list);
+  for (int ii = 1; ii < kCount; ii += 2) {
+    EXPECT_EQ((uint64_t)ii, nvlist_getf_number(list2, "field%d", ii));
+    EXPECT_EQ((uint64_t)ii, nvlist_getf_number(list3, "field%d", ii));
+  }
+  nvlist_destroy(list);
+  nvlist_destroy(list2);
+  nvlist_destroy(list3);
+}
+
 INSTANTIATE_TEST_CASE_P(CaseSensitive, NVListTest, ::testing::Bool());
 
+// Time to look up every name in a list of count pairs, rounds times.
+static double LookupTime(int count, int rounds, int flags) {
+  nvlist_t *list = nvlist_create(flags);
+  char name[32];
+  for (int ii = 0; ii < count; ii++) {
+    snprintf(name, sizeof(name), "name_%d", ii);
+    nvlist_add_number(list, name, ii);
+  }
+  uint64_t sum = 0;
+  const clock_t t0 = clock();
+  for (int round = 0; round < rounds; round++) {
+    for (int ii = 0; ii < count; ii++) {
+      snprintf(name, sizeof(name), "name_%d", ii);
+      sum += nvlist_get_number(list, name);
+      sum += nvlist_exists_string(list, name);
+    }
+  }
+  const clock_t t1 = clock();
+  EXPECT_EQ((uint64_t)rounds * count * (count - 1) / 2, sum);
+  nvlist_destroy(list);
+  return (t1 - t0) / (double)CLOCKS_PER_SEC;
+}
+
+TEST(NVList, LookupOverhead) {
+  const int kLookups = 200000;
+  for (int flags = 0; flags <= NV_FLAG_IGNORE_CASE; flags += NV_FLAG_IGNORE_CASE) {
+    double small = LookupTime(16, kLookups / 16, flags);
+    double large = LookupTime(1024, kLookups / 1024, flags);
+    if (verbose) fprintf(stderr, "%d lookups%s: 16 pairs=%fs 1024 pairs=%fs\n",
+                         2 * kLookups, flags ? " (ignoring case)" : "", small, large);
+    // Lookups are indexed, so don't slow down with the length of the list.
+    EXPECT_GE(8 * small + 0.05, large);
+  }
+}
+
+TEST(NVList, PlainLookupOverhead) {
+  const int kLookups = 1000000;
+  nvlist_t *list = nvlist_create(0);
+  nvlist_add_number(list, "error", 42);
+  nvlist_add_string(list, "name", "value");
+  uint64_t sum = 0;
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < kLookups; ii++) {
+    sum += nvlist_get_number(list, "error");
+  }
+  const clock_t t1 = clock();
+  for (int ii = 0; ii < kLookups; ii++) {
+    sum += nvlist_getf_number(list, "%s", "error");
+  }
+  const clock_t t2 = clock();
+  EXPECT_EQ((uint64_t)2 * kLookups * 42, sum);
+  nvlist_destroy(list);
+  double plain = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double formatted = (t2 - t1) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "per lookup: nvlist_get_number()=%.1fns nvlist_getf_number()=%.1fns\n",
+                       1e9 * plain / kLookups, 1e9 * formatted / kLookups);
+  // Plain names are looked up as given, without formatting a copy.
+  EXPECT_GE(2 * formatted + 0.05, plain);
+}
+
+TEST(NVList, Arena) {
+  nvlist_t *list = nvlist_create(NV_FLAG_ARENA);
+  for (int ii = 0; ii < 200; ii++) {
+    nvlist_addf_string(list, "value", "string%d", ii);
+  }
+  // Values too big for the arena, whether copied or moved in.
+  static char big[3000];
+  memset(big, 'x', sizeof(big) - 1);
+  nvlist_add_string(list, "big", big);
+  const size_t kMoved = 100000;
+  void *moved = calloc(1, kMoved);
+  nvlist_move_binary(list, "moved", moved, kMoved);
+  nvlist_move_string(list, "movedstr", strdup("moved"));
+  nvlist_t *child = nvlist_create(NV_FLAG_ARENA);
+  nvlist_add_number(child, "number", 42);
+  nvlist_add_binary(child, "binary", "data", 4);
+  nvlist_move_nvlist(list, "child", child);
+  EXPECT_EQ(0, nvlist_error(list));
+
+  for (int ii = 0; ii < 200; ii++) {
+    EXPECT_EQ("value", std::string(nvlist_getf_string(list, "string%d", ii)));
+  }
+  EXPECT_EQ(std::string(big), nvlist_get_string(list, "big"));
+  size_t size;
+  EXPECT_EQ(moved, nvlist_get_binary(list, "moved", &size));
+  EXPECT_EQ(kMoved, size);
+
+  // Taken values belong to the caller, wherever they were held.
+  char *str = nvlist_take_string(list, "string7");
+  EXPECT_EQ("value", std::string(str));
+  free(str);
+  free(nvlist_take_string(list, "big"));
+  free(nvlist_take_string(list, "movedstr"));
+  EXPECT_FALSE(nvlist_exists(list, "string7"));
+  nvlist_free_string(list, "string8");
+  nvlist_add_string(list, "string8", "again");
+  EXPECT_EQ("again", std::string(nvlist_get_string(list, "string8")));
+
+  // The arena isn't packed; the unpacked list is an ordinary one.
+  void *data = nvlist_pack(list, &size);
+  nvlist_t *list2 = nvlist_unpack(data, size);
+  free(data);
+  EXPECT_EQ(0, nvlist_error(list2));
+  EXPECT_EQ("value", std::string(nvlist_get_string(list2, "string100")));
+  EXPECT_EQ(42, (int)nvlist_get_number(nvlist_get_nvlist(list2, "child"), "number"));
+  nvlist_t *clone = nvlist_clone(list2);
+
+  // A nested list outlives the list it was unpacked with.
+  nvlist_t *child2 = nvlist_take_nvlist(list2, "child");
+  nvlist_destroy(list2);
+  nvlist_destroy(list);
+  EXPECT_EQ(42, (int)nvlist_get_number(child2, "number"));
+  EXPECT_EQ(0, memcmp("data", nvlist_get_binary(child2, "binary", NULL), 4));
+  nvlist_add_string(child2, "added", "later");
+  nvlist_destroy(child2);
+
+  // As does a clone.
+  nvlist_get_binary(clone, "moved", &size);
+  EXPECT_EQ(kMoved, size);
+  EXPECT_EQ("again", std::string(nvlist_get_string(clone, "string8")));
+  nvlist_destroy(clone);
+}
+
+static void *DestroyList(void *arg) {
+  nvlist_destroy((nvlist_t *)arg);
+  return NULL;
+}
+
+TEST(NVList, ArenaSharedThreads) {
+  nvlist_t *list = nvlist_create(0);
+  nvlist_t *child = nvlist_create(0);
+  nvlist_add_string(child, "string", "value");
+  nvlist_move_nvlist(list, "child", child);
+  nvlist_add_string(list, "string", "value");
+  size_t size;
+  void *data = nvlist_pack(list, &size);
+  nvlist_destroy(list);
+
+  // A sublist taken out of an unpacked list shares its arena, but each can
+  // be destroyed in a thread of its own.
+  for (int ii = 0; ii < 1000; ii++) {
+    nvlist_t *list2 = nvlist_unpack(data, size);
+    nvlist_t *child2 = nvlist_take_nvlist(list2, "child");
+    pthread_t thread;
+    EXPECT_EQ(0, pthread_create(&thread, NULL, DestroyList, child2));
+    nvlist_destroy(list2);
+    EXPECT_EQ(0, pthread_join(thread, NULL));
+  }
+  free(data);
+}
+
+// Something like a casper DNS reply (see hostent_pack()).
+static nvlist_t *BuildHostent(int flags) {
+  nvlist_t *list = nvlist_create(flags);
+  nvlist_add_string(list, "name", "host.example.com");
+  nvlist_add_number(list, "addrtype", AF_INET);
+  nvlist_add_number(list, "length", 4);
+  nvlist_add_number(list, "naliases", 8);
+  for (unsigned ii = 0; ii < 8; ii++) {
+    nvlist_addf_string(list, "alias.example.com", "alias%u", ii);
+  }
+  nvlist_add_number(list, "naddrs", 8);
+  for (unsigned ii = 0; ii < 8; ii++) {
+    unsigned char addr[4] = {192, 0, 2, (unsigned char)ii};
+    nvlist_addf_binary(list, addr, sizeof(addr), "addr%u", ii);
+  }
+  return list;
+}
+
+// BuildHostent() adds 21 pairs, 17 of them with string or binary values.
+static const size_t kHostentAllocs = 21 + 17;
+
+TEST(NVList, ArenaOverhead) {
+  const int kCycles = 20000;
+  double seconds[2];
+  for (int arena = 0; arena <= 1; arena++) {
+    const clock_t t0 = clock();
+    for (int ii = 0; ii < kCycles; ii++) {
+      nvlist_destroy(BuildHostent(arena ? NV_FLAG_ARENA : 0));
+    }
+    seconds[arena] = (clock() - t0) / (double)CLOCKS_PER_SEC;
+  }
+  if (verbose) fprintf(stderr, "build+destroy: %.2fus, with arena %.2fus\n",
+                       1e6 * seconds[0] / kCycles, 1e6 * seconds[1] / kCycles);
+  EXPECT_GE(2 * seconds[0] + 0.05, seconds[1]);
+
+  // Unpacked lists always allocate from an arena.
+  nvlist_t *list = BuildHostent(0);
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < kCycles; ii++) {
+    size_t size;
+    void *data = nvlist_pack(list, &size);
+    nvlist_destroy(nvlist_unpack(data, size));
+    free(data);
+  }
+  double unpack = (clock() - t0) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "pack+unpack+destroy: %.2fus\n", 1e6 * unpack / kCycles);
+
+#ifdef HAVE_ARENA_STATS
+  // Every pair and value comes out of a chunk or two, rather than a
+  // malloc(3) each.
+  size_t nchunks, nallocs;
+  EXPECT_EQ(-1, nvlist_arena_stats(list, &nchunks, &nallocs));
+  nvlist_t *arena_list = BuildHostent(NV_FLAG_ARENA);
+  EXPECT_EQ(0, nvlist_arena_stats(arena_list, &nchunks, &nallocs));
+  EXPECT_EQ(kHostentAllocs, nallocs);
+  EXPECT_GE(2U, nchunks);
+  nvlist_destroy(arena_list);
+
+  size_t size;
+  void *data = nvlist_pack(list, &size);
+  nvlist_t *unpacked = nvlist_unpack(data, size);
+  EXPECT_EQ(0, nvlist_arena_stats(unpacked, &nchunks, &nallocs));
+  EXPECT_EQ(kHostentAllocs, nallocs);
+  EXPECT_GE(2U, nchunks);
+  nvlist_destroy(unpacked);
+  free(data);
+#endif
+  nvlist_destroy(list);
+}
+
+TEST(NVList, PackedTotals) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  nvlist_t *list = nvlist_create(0);
+  nvlist_add_string(list, "string", "value");
+  nvlist_t *child = nvlist_create(0);
+  nvlist_add_number(child, "number", 42);
+  nvlist_t *grandchild = nvlist_create(0);
+  nvlist_add_descriptor(grandchild, "fd", fd);
+  nvlist_add_binary(grandchild, "binary", "data", 4);
+  nvlist_move_nvlist(child, "grandchild", grandchild);
+  nvlist_move_nvlist(list, "child", child);
+  nvlist_add_descriptor(list, "fd", fd);
+  EXPECT_EQ(0, nvlist_error(list));
+
+  // Lists with descriptors, even nested ones, can only be sent.
+  size_t size;
+  errno = 0;
+  EXPECT_EQ(nullptr, nvlist_pack(list, &size));
+  EXPECT_EQ(EOPNOTSUPP, errno);
+  close(nvlist_take_descriptor(list, "fd"));
+  EXPECT_EQ(nullptr, nvlist_pack(list, &size));
+
+  child = nvlist_take_nvlist(list, "child");
+  size_t childsize = nvlist_size(child);
+  void *data = nvlist_pack(list, &size);
+  EXPECT_NE(nullptr, data);
+  EXPECT_EQ(nvlist_size(list), size);
+  free(data);
+
+  // Sizes go back up when a list is nested again.
+  grandchild = nvlist_take_nvlist(child, "grandchild");
+  close(nvlist_take_descriptor(grandchild, "fd"));
+  nvlist_move_nvlist(child, "grandchild", grandchild);
+  EXPECT_GT(childsize, nvlist_size(child));
+  size_t before = nvlist_size(list);
+  nvlist_move_nvlist(list, "child", child);
+  EXPECT_LT(before + nvlist_size(child), nvlist_size(list));
+  data = nvlist_pack(list, &size);
+  EXPECT_NE(nullptr, data);
+  EXPECT_EQ(nvlist_size(list), size);
+
+  // The unpacked copy comes to the same size.
+  nvlist_t *list2 = nvlist_unpack(data, size);
+  free(data);
+  EXPECT_EQ(size, nvlist_size(list2));
+  const nvlist_t *grandchild2 = nvlist_get_nvlist(nvlist_get_nvlist(list2, "child"), "grandchild");
+  EXPECT_EQ(0, memcmp("data", nvlist_get_binary(grandchild2, "binary", NULL), 4));
+  nvlist_free_nvlist(list2, "child");
+  nvlist_free_nvlist(list, "child");
+  EXPECT_EQ(nvlist_size(list), nvlist_size(list2));
+  nvlist_free_string(list, "string");
+  nvlist_t *empty = nvlist_create(0);
+  EXPECT_EQ(nvlist_size(empty), nvlist_size(list));
+  nvlist_destroy(empty);
+  nvlist_destroy(list2);
+  nvlist_destroy(list);
+}
+
+// A list nested depth deep, with count pairs at each level.
+static nvlist_t *DeepList(int depth, int count) {
+  nvlist_t *list = nvlist_create(0);
+  for (int ii = 0; ii < count; ii++) {
+    nvlist_addf_string(list, "value", "name%d", ii);
+  }
+  if (depth > 1) nvlist_move_nvlist(list, "child", DeepList(depth - 1, count));
+  return list;
+}
+
+static double PackTime(const nvlist_t *list, int rounds) {
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < rounds; ii++) {
+    size_t size;
+    free(nvlist_pack(list, &size));
+  }
+  return (clock() - t0) / (double)CLOCKS_PER_SEC;
+}
+
+TEST(NVList, PackOverhead) {
+  const int kPairs = 3000;
+  const int kRounds = 200;
+  nvlist_t *wide = DeepList(1, kPairs);
+  nvlist_t *deep = DeepList(3, kPairs / 3);
+  nvlist_t *small = DeepList(1, 1);
+
+  // The packed size is kept up to date, rather than worked out.
+  size_t total = 0;
+  clock_t t0 = clock();
+  for (int ii = 0; ii < kRounds * 1000; ii++) {
+    total += nvlist_size(small);
+  }
+  clock_t t1 = clock();
+  for (int ii = 0; ii < kRounds * 1000; ii++) {
+    total += nvlist_size(wide);
+  }
+  clock_t t2 = clock();
+  EXPECT_LT(0U, total);
+  double smallsize = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double widesize = (t2 - t1) / (double)CLOCKS_PER_SEC;
+
+  double widepack = PackTime(wide, kRounds);
+  double deeppack = PackTime(deep, kRounds);
+  if (verbose) {
+    fprintf(stderr, "nvlist_size(): 1 pair=%.3fus %d pairs=%.3fus\n",
+            1e6 * smallsize / (kRounds * 1000), kPairs, 1e6 * widesize / (kRounds * 1000));
+    fprintf(stderr, "nvlist_pack() of %d pairs: wide=%.1fus deep=%.1fus\n",
+            kPairs, 1e6 * widepack / kRounds, 1e6 * deeppack / kRounds);
+  }
+  EXPECT_GE(8 * smallsize + 0.05, widesize);
+  // Nested lists are packed in place, in the same pass.
+  EXPECT_GE(4 * widepack + 0.05, deeppack);
+  const nvlist_t *lists[] = {small, wide, deep};
+  for (const nvlist_t *list : lists) {
+    size_t size;
+    void *data = nvlist_pack(list, &size);
+    EXPECT_NE(nullptr, data);
+    EXPECT_EQ(nvlist_size(list), size);
+    free(data);
+  }
+  nvlist_destroy(small);
+  nvlist_destroy(wide);
+  nvlist_destroy(deep);
+}
+
+TEST(NVList, UnpackMove) {
+  const size_t kBig = 1024 * 1024;
+  unsigned char *big = (unsigned char *)malloc(kBig);
+  for (size_t ii = 0; ii < kBig; ii++) big[ii] = (unsigned char)ii;
+  nvlist_t *list = nvlist_create(0);
+  nvlist_add_string(list, "name", "root");
+  nvlist_add_binary(list, "data", big, kBig);
+  nvlist_t *child = DeepList(2, 3);
+  nvlist_add_binary(child, "data", "abc", 3);
+  nvlist_move_nvlist(list, "child", child);
+  size_t size;
+  unsigned char *data = (unsigned char *)nvlist_pack(list, &size);
+  const unsigned char *end = data + size;
+
+  // Values, nested ones included, point into the buffer the list took over.
+  nvlist_t *list2 = nvlist_unpack_move(data, size);
+  ASSERT_NE(nullptr, list2);
+  EXPECT_EQ(0, nvlist_error(list2));
+  const unsigned char *value = (const unsigned char *)nvlist_get_binary(list2, "data", &size);
+  EXPECT_EQ(kBig, size);
+  EXPECT_EQ(0, memcmp(big, value, kBig));
+  EXPECT_TRUE(value > data && value < end);
+  const nvlist_t *child2 = nvlist_get_nvlist(list2, "child");
+  const char *str = nvlist_get_string(nvlist_get_nvlist(child2, "child"), "name2");
+  EXPECT_EQ("value", std::string(str));
+  EXPECT_TRUE((const unsigned char *)str > data && (const unsigned char *)str < end);
+
+  // Only taking a value copies it, and the copy belongs to the caller.
+  char *name = nvlist_take_string(list2, "name");
+  EXPECT_EQ("root", std::string(name));
+  EXPECT_FALSE((unsigned char *)name >= data && (unsigned char *)name < end);
+  free(name);
+  void *taken = nvlist_take_binary(list2, "data", &size);
+  EXPECT_EQ(0, memcmp(big, taken, kBig));
+  free(taken);
+  nvlist_add_string(list2, "name", "again");
+  EXPECT_EQ("again", std::string(nvlist_get_string(list2, "name")));
+
+  // The buffer lasts as long as anything in it.
+  nvlist_t *child3 = nvlist_take_nvlist(list2, "child");
+  nvlist_destroy(list2);
+  EXPECT_EQ(0, memcmp("abc", nvlist_get_binary(child3, "data", NULL), 3));
+  nvlist_t *clone = nvlist_clone(child3);
+  nvlist_destroy(child3);
+  EXPECT_EQ("value", std::string(nvlist_get_string(clone, "name1")));
+  nvlist_destroy(clone);
+
+  // As does the list, with a value moved out of it.
+  data = (unsigned char *)nvlist_pack(list, &size);
+  list2 = nvlist_unpack_move(data, size);
+  char *root = nvlist_take_string(list2, "name");
+  nvlist_destroy(list2);
+  EXPECT_EQ("root", std::string(root));
+  free(root);
+
+  // The buffer is freed even if unpacking fails.
+  data = (unsigned char *)nvlist_pack(list, &size);
+  EXPECT_EQ(nullptr, nvlist_unpack_move(data, size - 1));
+  data = (unsigned char *)calloc(1, 64);
+  EXPECT_EQ(nullptr, nvlist_unpack_move(data, 64));
+
+  nvlist_destroy(list);
+  free(big);
+}
+
+static double UnpackTime(const void *data, size_t size, bool move, int rounds) {
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < rounds; ii++) {
+    // As nvlist_recv_move() has it, in a buffer of its own.
+    void *buf = malloc(size);
+    memcpy(buf, data, size);
+    nvlist_t *list;
+    if (move) {
+      list = nvlist_unpack_move(buf, size);
+    } else {
+      list = nvlist_unpack(buf, size);
+      free(buf);
+    }
+    nvlist_destroy(list);
+  }
+  return (clock() - t0) / (double)CLOCKS_PER_SEC;
+}
+
+TEST(NVList, UnpackMoveOverhead) {
+  // Something like a cap_random_buf() reply.
+  const size_t kBig = 1024 * 1024;
+  const int kRounds = 200;
+  void *big = calloc(1, kBig);
+  nvlist_t *list = nvlist_create(0);
+  nvlist_add_number(list, "error", 0);
+  nvlist_add_binary(list, "data", big, kBig);
+  size_t size;
+  void *data = nvlist_pack(list, &size);
+
+  double copy = UnpackTime(data, size, false, kRounds);
+  double move = UnpackTime(data, size, true, kRounds);
+  if (verbose) {
+    fprintf(stderr, "unpack of %zu bytes: copy=%.0fMB/s move=%.0fMB/s\n",
+            size, kRounds * size / 1e6 / copy, kRounds * size / 1e6 / move);
+  }
+  EXPECT_GE(2 * copy + 0.05, move);
+
+  // The moved unpack hands out the binary in place rather than copying it.
+  void *buf = malloc(size);
+  memcpy(buf, data, size);
+  nvlist_t *moved = nvlist_unpack_move(buf, size);
+  EXPECT_NE(nullptr, moved);
+  size_t datasize = 0;
+  const char *value = (const char *)nvlist_get_binary(moved, "data", &datasize);
+  EXPECT_EQ(kBig, datasize);
+  EXPECT_LE((const char *)buf, value);
+  EXPECT_GE((const char *)buf + size, value + datasize);
+  nvlist_destroy(moved);
+  free(data);
+  nvlist_destroy(list);
+  free(big);
+}
+
 TEST(NVList, SocketSend) {
   int fds[2];
   EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
@@ -183,6 +730,39 @@ TEST(NVList, SocketSend) {
   unlink("/tmp/nvtest_xfer");
 }
 
+TEST(NVList, SocketRecvMove) {
+  int fds[2];
+  EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  nvlist_t *list = nvlist_create(0);
+  nvlist_add_string(list, "field1", "value1");
+  nvlist_t *child = DeepList(2, 3);
+  nvlist_add_binary(child, "data", "abc", 3);
+  nvlist_move_nvlist(list, "child", child);
+  nvlist_add_descriptor(list, "field2", fds[1]);
+
+  // The reply is small enough to sit in the socket until we read it.
+  EXPECT_EQ(0, nvlist_send(fds[1], list));
+  nvlist_t *list2 = nvlist_recv_move(fds[0]);
+  ASSERT_NE(nullptr, list2);
+  EXPECT_EQ(0, nvlist_error(list2));
+  EXPECT_EQ("value1", std::string(nvlist_get_string(list2, "field1")));
+  int fd = nvlist_get_descriptor(list2, "field2");
+  EXPECT_NE(fds[1], fd);
+  EXPECT_LE(0, fcntl(fd, F_GETFD));
+
+  // A nested list keeps the receive buffer after its parent has gone.
+  nvlist_t *child2 = nvlist_take_nvlist(list2, "child");
+  nvlist_destroy(list2);
+  EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+  EXPECT_EQ(0, memcmp("abc", nvlist_get_binary(child2, "data", NULL), 3));
+  EXPECT_EQ("value", std::string(nvlist_get_string(child2, "name1")));
+  nvlist_destroy(child2);
+
+  nvlist_destroy(list);
+  close(fds[1]);
+  close(fds[0]);
+}
+
 TEST(NVList, SocketXfer) {
   int fds[2];
   EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
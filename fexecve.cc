@@ -171,3 +171,144 @@ TEST(Execveat, NoUpwardTraversal) {
   close(dfd);
 }
 #endif
+
+#ifdef HAVE_PDSPAWN
+static char* argv_capmode[] = {(char*)EXEC_PROG, (char*)"--capmode", NULL};
+
+// Wait for a pdspawn()ed child, returning its exit code.
+static int PdspawnExitCode(pid_t pid, int pd) {
+  int status = 0;
+  EXPECT_EQ(pid, pdwait4(pd, &status, 0, NULL));
+  EXPECT_TRUE(WIFEXITED(status)) << "0x" << std::hex << status;
+  close(pd);
+  return WEXITSTATUS(status);
+}
+
+TEST_F(Execve, PdspawnBasic) {
+  int pd = -1;
+  pid_t pid = pdspawn(&pd, exec_fd_, NULL, argv_pass, null_envp, 0);
+  EXPECT_OK(pid);
+  EXPECT_OK(pd);
+  EXPECT_EQ(0, fcntl(pd, F_GETFD));
+  EXPECT_EQ(0, PdspawnExitCode(pid, pd));
+
+  pid = pdspawn(&pd, exec_fd_, NULL, argv_fail, null_envp, PD_CLOEXEC);
+  EXPECT_OK(pid);
+  EXPECT_EQ(FD_CLOEXEC, fcntl(pd, F_GETFD));
+  EXPECT_EQ(1, PdspawnExitCode(pid, pd));
+}
+
+TEST_F(Execve, PdspawnInCapMode) {
+  struct pd_spawn_actions *actions = pd_spawn_actions_create();
+  EXPECT_OK(pd_spawn_actions_addcapenter(actions));
+  int pd = -1;
+  pid_t pid = pdspawn(&pd, exec_fd_, actions, argv_capmode, null_envp, 0);
+  EXPECT_OK(pid);
+  EXPECT_EQ(0, PdspawnExitCode(pid, pd));
+  // The child ran in our memory until its exec, but only it entered capability mode.
+  unsigned int mode = 1;
+  EXPECT_OK(cap_getmode(&mode));
+  EXPECT_EQ(0, (int)mode);
+  pd_spawn_actions_free(actions);
+}
+
+FORK_TEST_F(Execve, PdspawnCapEnterTwice) {
+  struct pd_spawn_actions *actions = pd_spawn_actions_create();
+  EXPECT_OK(pd_spawn_actions_addcapenter(actions));
+  EXPECT_OK(pd_spawn_actions_addcapenter(actions));
+  int pd = -1;
+  pid_t pid = pdspawn(&pd, exec_fd_, actions, argv_capmode, null_envp, 0);
+  EXPECT_OK(pid);
+  EXPECT_EQ(0, PdspawnExitCode(pid, pd));
+  pd_spawn_actions_free(actions);
+  // Nothing the child did in our memory marks us as sandboxed...
+  EXPECT_FALSE(cap_sandboxed());
+  // ...so cap_enter() still installs the filter.
+  EXPECT_OK(cap_enter());
+  EXPECT_TRUE(cap_sandboxed());
+  EXPECT_CAPMODE(open("/etc/passwd", O_RDONLY));
+}
+
+FORK_TEST_F(Execve, PdspawnFailWithoutCap) {
+  struct pd_spawn_actions *actions = pd_spawn_actions_create();
+  cap_rights_t rights;
+  cap_rights_init(&rights, 0);
+  EXPECT_OK(pd_spawn_actions_addlimit(actions, exec_fd_, &rights));
+  EXPECT_OK(pd_spawn_actions_addcapenter(actions));
+  int pd = -1;
+  EXPECT_EQ(-1, pdspawn(&pd, exec_fd_, actions, argv_fail, null_envp, 0));
+  EXPECT_EQ(ENOTCAPABLE, errno);
+  EXPECT_EQ(-1, pd);
+  // The failed child has already been reaped...
+  EXPECT_EQ(-1, waitpid(-1, NULL, __WALL|WNOHANG));
+  EXPECT_EQ(ECHILD, errno);
+  // ...and the limit only applied to its copy of the descriptor.
+  pid_t pid = pdspawn(&pd, exec_fd_, NULL, argv_pass, null_envp, 0);
+  EXPECT_OK(pid);
+  EXPECT_EQ(0, PdspawnExitCode(pid, pd));
+  pd_spawn_actions_free(actions);
+}
+
+TEST_F(Execve, PdspawnSucceedWithCap) {
+  struct pd_spawn_actions *actions = pd_spawn_actions_create();
+  cap_rights_t rights;
+  cap_rights_init(&rights, CAP_FEXECVE, CAP_LOOKUP, CAP_READ);
+  EXPECT_OK(pd_spawn_actions_addlimit(actions, exec_fd_, &rights));
+  EXPECT_OK(pd_spawn_actions_addcapenter(actions));
+  int pd = -1;
+  pid_t pid = pdspawn(&pd, exec_fd_, actions, argv_pass, null_envp, 0);
+  EXPECT_OK(pid);
+  EXPECT_EQ(0, PdspawnExitCode(pid, pd));
+  pd_spawn_actions_free(actions);
+}
+
+TEST_F(Execve, PdspawnActions) {
+  // Collect the child's stderr through a pipe.
+  int pipefds[2];
+  EXPECT_OK(pipe(pipefds));
+  struct pd_spawn_actions *actions = pd_spawn_actions_create();
+  EXPECT_OK(pd_spawn_actions_adddup2(actions, pipefds[1], STDERR_FILENO));
+  EXPECT_OK(pd_spawn_actions_addclose(actions, pipefds[0]));
+  EXPECT_OK(pd_spawn_actions_addclose(actions, pipefds[1]));
+  int pd = -1;
+  pid_t pid = pdspawn(&pd, exec_fd_, actions, argv_pass, null_envp, 0);
+  EXPECT_OK(pid);
+  close(pipefds[1]);
+  char buffer[1024];
+  size_t len = 0;
+  ssize_t rc;
+  while ((rc = read(pipefds[0], buffer + len, sizeof(buffer) - 1 - len)) > 0) {
+    len += rc;
+  }
+  buffer[len] = '\0';
+  EXPECT_NE((char*)NULL, strstr(buffer, "immediately returning 0")) << buffer;
+  EXPECT_EQ(0, PdspawnExitCode(pid, pd));
+  close(pipefds[0]);
+
+  // A failing action stops the spawn.
+  EXPECT_OK(pd_spawn_actions_addclose(actions, pipefds[1]));
+  EXPECT_EQ(-1, pdspawn(&pd, exec_fd_, actions, argv_pass, null_envp, 0));
+  EXPECT_EQ(EBADF, errno);
+  pd_spawn_actions_free(actions);
+}
+
+TEST_F(Execve, PdspawnInvalid) {
+  int pd = -1;
+  EXPECT_EQ(-1, pdspawn(&pd, exec_fd_, NULL, argv_pass, null_envp, 0x80));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, pdspawn(&pd, -1, NULL, argv_pass, null_envp, 0));
+  EXPECT_EQ(EBADF, errno);
+  EXPECT_EQ(-1, pd);
+
+  struct pd_spawn_actions *actions = pd_spawn_actions_create();
+  EXPECT_EQ(-1, pd_spawn_actions_addclose(actions, -1));
+  EXPECT_EQ(EBADF, errno);
+  EXPECT_EQ(-1, pd_spawn_actions_adddup2(actions, 0, -1));
+  EXPECT_EQ(EBADF, errno);
+  cap_rights_t rights;
+  memset(&rights, 0, sizeof(rights));
+  EXPECT_EQ(-1, pd_spawn_actions_addlimit(actions, 0, &rights));
+  EXPECT_EQ(EINVAL, errno);
+  pd_spawn_actions_free(actions);
+}
+#endif
@@ -231,4 +231,60 @@ TEST(Ioctl, ManySubRights) {
 }
 #endif
 
+#ifdef __linux__
+// The library hands the kernel a sorted list without duplicates.
+TEST(Ioctl, SubRightsSorted) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  cap_ioctl_t unsorted[] = {FIONREAD, FIOCLEX, FIONREAD, FIONBIO, FIOCLEX};
+  EXPECT_OK(cap_ioctls_limit(fd, unsorted, 5));
+  cap_ioctl_t ioctls[16];
+  memset(ioctls, 0, sizeof(ioctls));
+  EXPECT_EQ(3, cap_ioctls_get(fd, ioctls, 16));
+  EXPECT_LT(ioctls[0], ioctls[1]);
+  EXPECT_LT(ioctls[1], ioctls[2]);
+  EXPECT_EQ(1, cap_ioctls_allowed(fd, FIONREAD));
+  EXPECT_EQ(1, cap_ioctls_allowed(fd, FIONBIO));
+  EXPECT_EQ(0, cap_ioctls_allowed(fd, FIONCLEX));
+
+  // Narrowing with an unsorted list still works.
+  cap_ioctl_t narrower[] = {FIOCLEX, FIONREAD};
+  EXPECT_OK(cap_ioctls_limit(fd, narrower, 2));
+  EXPECT_EQ(2, cap_ioctls_get(fd, ioctls, 16));
+  EXPECT_EQ(0, cap_ioctls_allowed(fd, FIONBIO));
+  int bytes;
+  EXPECT_OK(ioctl(fd, FIONREAD, &bytes));
+  close(fd);
+}
+
+TEST(Ioctl, Allowed) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  int fd_none = dup(fd);
+  EXPECT_OK(fd_none);
+  // All ioctls allowed until limited.
+  EXPECT_EQ(1, cap_ioctls_allowed(fd, FIONREAD));
+  cap_rights_t r_ioctl, r_read;
+  cap_rights_init(&r_ioctl, CAP_IOCTL);
+  cap_rights_init(&r_read, CAP_READ);
+  EXPECT_OK(cap_rights_limit(fd, &r_ioctl));
+  EXPECT_OK(cap_rights_limit(fd_none, &r_read));
+  cap_ioctl_t ioctl_nread = FIONREAD;
+  EXPECT_OK(cap_ioctls_limit(fd, &ioctl_nread, 1));
+
+  // Same answers whether they come from the kernel or the cache.
+  for (int cached = 0; cached <= 1; cached++) {
+    cap_rights_cache_enable(cached);
+    EXPECT_EQ(1, cap_ioctls_allowed(fd, FIONREAD));
+    EXPECT_EQ(0, cap_ioctls_allowed(fd, FIOCLEX));
+    EXPECT_EQ(0, cap_ioctls_allowed(fd_none, FIONREAD));
+    EXPECT_EQ(-1, cap_ioctls_allowed(-1, FIONREAD));
+    EXPECT_EQ(EBADF, errno);
+  }
+  cap_rights_cache_enable(false);
+  close(fd);
+  close(fd_none);
+}
+#endif
+
 #endif
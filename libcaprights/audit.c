@@ -0,0 +1,530 @@
+/*
+ * Whole-system audit of Capsicum rights, from /proc/<pid>/fdinfo/<fd>.
+ *
+ * Each fdinfo file for a descriptor with Capsicum rights has a line of the
+ * form "rights:\t0x%016llx 0x%016llx".  Scanning every descriptor of every
+ * process is dominated by the open/read/close of those small files, so the
+ * processes are shared out among a pool of threads, each of which collects
+ * its results separately; they're merged and sorted once at the end.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capsicum.h"
+#include "capaudit.h"
+
+/************************************************************
+ * Rights Names.
+ ************************************************************/
+
+/* Word index, bits (without the index marker) and name of each right. */
+struct right_name {
+  int index;
+  uint64_t bits;
+  const char *name;
+};
+#define RIGHT_NAME(RR) { (CAPIDXBIT(RR) == 1) ? 0 : 1, (RR) & 0x01FFFFFFFFFFFFFFULL, #RR + 4 }
+
+static const struct right_name right_names[] = {
+  RIGHT_NAME(CAP_READ),
+  RIGHT_NAME(CAP_WRITE),
+  RIGHT_NAME(CAP_SEEK_TELL),
+  RIGHT_NAME(CAP_SEEK),
+  RIGHT_NAME(CAP_PREAD),
+  RIGHT_NAME(CAP_PWRITE),
+  RIGHT_NAME(CAP_MMAP),
+  RIGHT_NAME(CAP_MMAP_R),
+  RIGHT_NAME(CAP_MMAP_W),
+  RIGHT_NAME(CAP_MMAP_X),
+  RIGHT_NAME(CAP_MMAP_RW),
+  RIGHT_NAME(CAP_MMAP_RX),
+  RIGHT_NAME(CAP_MMAP_WX),
+  RIGHT_NAME(CAP_MMAP_RWX),
+  RIGHT_NAME(CAP_CREATE),
+  RIGHT_NAME(CAP_FEXECVE),
+  RIGHT_NAME(CAP_FSYNC),
+  RIGHT_NAME(CAP_FTRUNCATE),
+  RIGHT_NAME(CAP_LOOKUP),
+  RIGHT_NAME(CAP_FCHDIR),
+  RIGHT_NAME(CAP_FCHFLAGS),
+  RIGHT_NAME(CAP_CHFLAGSAT),
+  RIGHT_NAME(CAP_FCHMOD),
+  RIGHT_NAME(CAP_FCHMODAT),
+  RIGHT_NAME(CAP_FCHOWN),
+  RIGHT_NAME(CAP_FCHOWNAT),
+  RIGHT_NAME(CAP_FCNTL),
+  RIGHT_NAME(CAP_FLOCK),
+  RIGHT_NAME(CAP_FPATHCONF),
+  RIGHT_NAME(CAP_FSCK),
+  RIGHT_NAME(CAP_FSTAT),
+  RIGHT_NAME(CAP_FSTATAT),
+  RIGHT_NAME(CAP_FSTATFS),
+  RIGHT_NAME(CAP_FUTIMES),
+  RIGHT_NAME(CAP_FUTIMESAT),
+  RIGHT_NAME(CAP_LINKAT_SOURCE),
+  RIGHT_NAME(CAP_LINKAT_TARGET),
+  RIGHT_NAME(CAP_MKDIRAT),
+  RIGHT_NAME(CAP_MKFIFOAT),
+  RIGHT_NAME(CAP_MKNODAT),
+  RIGHT_NAME(CAP_RENAMEAT_SOURCE),
+  RIGHT_NAME(CAP_RENAMEAT_TARGET),
+  RIGHT_NAME(CAP_SYMLINKAT),
+  RIGHT_NAME(CAP_UNLINKAT),
+  RIGHT_NAME(CAP_ACCEPT),
+  RIGHT_NAME(CAP_BIND),
+  RIGHT_NAME(CAP_CONNECT),
+  RIGHT_NAME(CAP_GETPEERNAME),
+  RIGHT_NAME(CAP_GETSOCKNAME),
+  RIGHT_NAME(CAP_GETSOCKOPT),
+  RIGHT_NAME(CAP_LISTEN),
+  RIGHT_NAME(CAP_PEELOFF),
+  RIGHT_NAME(CAP_RECV),
+  RIGHT_NAME(CAP_SEND),
+  RIGHT_NAME(CAP_SETSOCKOPT),
+  RIGHT_NAME(CAP_SHUTDOWN),
+  RIGHT_NAME(CAP_BINDAT),
+  RIGHT_NAME(CAP_CONNECTAT),
+  RIGHT_NAME(CAP_SOCK_CLIENT),
+  RIGHT_NAME(CAP_SOCK_SERVER),
+  RIGHT_NAME(CAP_MAC_GET),
+  RIGHT_NAME(CAP_MAC_SET),
+  RIGHT_NAME(CAP_SEM_GETVALUE),
+  RIGHT_NAME(CAP_SEM_POST),
+  RIGHT_NAME(CAP_SEM_WAIT),
+  RIGHT_NAME(CAP_EVENT),
+  RIGHT_NAME(CAP_KQUEUE_EVENT),
+  RIGHT_NAME(CAP_IOCTL),
+  RIGHT_NAME(CAP_TTYHOOK),
+  RIGHT_NAME(CAP_PDWAIT),
+  RIGHT_NAME(CAP_PDGETPID),
+  RIGHT_NAME(CAP_PDKILL),
+  RIGHT_NAME(CAP_EXTATTR_DELETE),
+  RIGHT_NAME(CAP_EXTATTR_GET),
+  RIGHT_NAME(CAP_EXTATTR_LIST),
+  RIGHT_NAME(CAP_EXTATTR_SET),
+  RIGHT_NAME(CAP_ACL_CHECK),
+  RIGHT_NAME(CAP_ACL_DELETE),
+  RIGHT_NAME(CAP_ACL_GET),
+  RIGHT_NAME(CAP_ACL_SET),
+  RIGHT_NAME(CAP_KQUEUE_CHANGE),
+  RIGHT_NAME(CAP_KQUEUE),
+#ifdef CAP_PDGETPID_FREEBSD
+  RIGHT_NAME(CAP_PDGETPID_FREEBSD),
+#endif
+#ifdef CAP_PDKILL_FREEBSD
+  RIGHT_NAME(CAP_PDKILL_FREEBSD),
+#endif
+#ifdef CAP_FSIGNAL
+  RIGHT_NAME(CAP_FSIGNAL),
+#endif
+#ifdef CAP_EPOLL_CTL
+  RIGHT_NAME(CAP_EPOLL_CTL),
+#endif
+#ifdef CAP_NOTIFY
+  RIGHT_NAME(CAP_NOTIFY),
+#endif
+#ifdef CAP_SETNS
+  RIGHT_NAME(CAP_SETNS),
+#endif
+#ifdef CAP_PERFMON
+  RIGHT_NAME(CAP_PERFMON),
+#endif
+#ifdef CAP_BPF
+  RIGHT_NAME(CAP_BPF),
+#endif
+};
+
+size_t cap_rights_names(const cap_rights_t *rights, const char **names,
+                        size_t maxnames) {
+  size_t count = 0;
+  size_t ii;
+  for (ii = 0; ii < sizeof(right_names) / sizeof(right_names[0]); ii++) {
+    const struct right_name *rn = &right_names[ii];
+    if (rn->bits && (rights->cr_rights[rn->index] & rn->bits) == rn->bits) {
+      if (count < maxnames)
+        names[count] = rn->name;
+      count++;
+    }
+  }
+  return count;
+}
+
+uint64_t cap_right_by_name(const char *name) {
+  size_t ii;
+  if (strncmp(name, "CAP_", 4) == 0)
+    name += 4;
+  for (ii = 0; ii < sizeof(right_names) / sizeof(right_names[0]); ii++) {
+    const struct right_name *rn = &right_names[ii];
+    if (strcmp(rn->name, name) == 0)
+      return CAPRIGHT(rn->index, rn->bits);
+  }
+  return 0;
+}
+
+/************************************************************
+ * Scanning.
+ ************************************************************/
+
+/* Results from one worker thread. */
+struct audit_results {
+  struct cap_audit_fd *fds;
+  size_t nfds;
+  size_t size;
+  size_t nprocs;
+  int error;
+};
+
+struct audit_scan {
+  int procfd;
+  const pid_t *pids;
+  size_t npids;
+  size_t next;  /* Next entry of pids[] to take, updated atomically */
+  int options;
+  cap_rights_t allrights;
+};
+
+static bool all_digits(const char *name) {
+  if (!*name)
+    return false;
+  for (; *name; name++)
+    if (!isdigit((unsigned char)*name))
+      return false;
+  return true;
+}
+
+/* Parse the rights line out of an fdinfo file's contents. */
+static int parse_fdinfo(const char *buf, cap_rights_t *rights) {
+  const char *line = buf;
+  char *end;
+  while (line && strncmp(line, "rights:", 7) != 0) {
+    line = strchr(line, '\n');
+    if (line)
+      line++;
+  }
+  if (line == NULL)
+    return 0;
+  rights->cr_rights[0] = strtoull(line + 7, &end, 16);
+  rights->cr_rights[1] = strtoull(end, &end, 16);
+  return CAP_AUDIT_RIGHTS;
+}
+
+static int audit_add(struct audit_results *results, const struct cap_audit_fd *entry) {
+  if (results->nfds == results->size) {
+    size_t size = results->size ? 2 * results->size : 256;
+    struct cap_audit_fd *fds = realloc(results->fds, size * sizeof(*fds));
+    if (fds == NULL)
+      return -1;
+    results->fds = fds;
+    results->size = size;
+  }
+  results->fds[results->nfds++] = *entry;
+  return 0;
+}
+
+/*
+ * Read all of fd into *buf (of *size bytes, grown as needed) and NUL
+ * terminate it.  The fdinfo of an epoll, inotify or fanotify descriptor
+ * lists every watch, so can run to many kilobytes before the rights.
+ */
+static ssize_t read_all(int fd, char **buf, size_t *size) {
+  size_t len = 0;
+  for (;;) {
+    ssize_t n;
+    if (*size - len < 2) {
+      size_t more_size = *size ? 2 * *size : 1024;
+      char *more = realloc(*buf, more_size);
+      if (more == NULL) {
+        errno = ENOMEM;
+        return -1;
+      }
+      *buf = more;
+      *size = more_size;
+    }
+    n = read(fd, *buf + len, *size - len - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    len += n;
+  }
+  (*buf)[len] = '\0';
+  return len;
+}
+
+static void audit_pid(struct audit_scan *scan, pid_t pid, struct audit_results *results) {
+  char path[64];
+  char *buf = NULL;
+  size_t size = 0;
+  struct dirent *de;
+  DIR *dir;
+  int infofd;
+
+  snprintf(path, sizeof(path), "%d/fdinfo", (int)pid);
+  infofd = openat(scan->procfd, path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (infofd < 0)
+    return;  /* Exited, or not ours to look at */
+  dir = fdopendir(infofd);
+  if (dir == NULL) {
+    close(infofd);
+    return;
+  }
+  results->nprocs++;
+  while ((de = readdir(dir)) != NULL) {
+    struct cap_audit_fd entry;
+    ssize_t len;
+    int fd;
+    if (!all_digits(de->d_name))
+      continue;
+    fd = openat(infofd, de->d_name, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+      continue;  /* Closed since the readdir */
+    len = read_all(fd, &buf, &size);
+    close(fd);
+    if (len < 0 && errno == ENOMEM) {
+      results->error = ENOMEM;
+      break;
+    }
+    if (len < 0)
+      continue;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.pid = pid;
+    entry.fd = atoi(de->d_name);
+    entry.flags = parse_fdinfo(buf, &entry.rights);
+    if ((entry.flags & CAP_AUDIT_RIGHTS) &&
+        !cap_rights_contains(&entry.rights, &scan->allrights))
+      entry.flags |= CAP_AUDIT_LIMITED;
+    if ((scan->options & CAP_AUDIT_ONLY_LIMITED) && !(entry.flags & CAP_AUDIT_LIMITED))
+      continue;
+    if (audit_add(results, &entry) < 0) {
+      results->error = ENOMEM;
+      break;
+    }
+  }
+  closedir(dir);
+  free(buf);
+}
+
+static void *audit_worker(void *arg) {
+  struct audit_scan *scan = arg;
+  struct audit_results *results = calloc(1, sizeof(*results));
+  if (results == NULL)
+    return NULL;
+  while (results->error == 0) {
+    size_t ii = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+    if (ii >= scan->npids)
+      break;
+    audit_pid(scan, scan->pids[ii], results);
+  }
+  return results;
+}
+
+/* Every numeric entry of the proc directory, in *pids. */
+static int list_pids(int procfd, pid_t **pids, size_t *npids) {
+  size_t size = 0;
+  struct dirent *de;
+  DIR *dir;
+  int fd = dup(procfd);
+  if (fd < 0)
+    return -1;
+  dir = fdopendir(fd);
+  if (dir == NULL) {
+    close(fd);
+    return -1;
+  }
+  *pids = NULL;
+  *npids = 0;
+  while ((de = readdir(dir)) != NULL) {
+    if (!all_digits(de->d_name))
+      continue;
+    if (*npids == size) {
+      pid_t *more;
+      size = size ? 2 * size : 1024;
+      more = realloc(*pids, size * sizeof(pid_t));
+      if (more == NULL) {
+        free(*pids);
+        closedir(dir);
+        errno = ENOMEM;
+        return -1;
+      }
+      *pids = more;
+    }
+    (*pids)[(*npids)++] = atoi(de->d_name);
+  }
+  closedir(dir);
+  return 0;
+}
+
+static int audit_fd_cmp(const void *a, const void *b) {
+  const struct cap_audit_fd *x = a, *y = b;
+  if (x->pid != y->pid)
+    return (x->pid > y->pid) - (x->pid < y->pid);
+  return (x->fd > y->fd) - (x->fd < y->fd);
+}
+
+int cap_audit_scan(const char *procdir, const pid_t *pids, size_t npids,
+                   int nthreads, int options, struct cap_audit_report *report) {
+  struct audit_scan scan;
+  struct audit_results **results;
+  pthread_t *threads;
+  pid_t *all_pids = NULL;
+  size_t total = 0;
+  int started = 0, ii;
+  int error = 0;
+
+  if (report == NULL || (npids > 0 && pids == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(report, 0, sizeof(*report));
+  memset(&scan, 0, sizeof(scan));
+  scan.options = options;
+  CAP_SET_ALL(&scan.allrights);
+  scan.procfd = open(procdir ? procdir : "/proc", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (scan.procfd < 0)
+    return -1;
+  if (pids == NULL) {
+    if (list_pids(scan.procfd, &all_pids, &npids) < 0) {
+      close(scan.procfd);
+      return -1;
+    }
+    pids = all_pids;
+  }
+  scan.pids = pids;
+  scan.npids = npids;
+
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if ((size_t)nthreads > npids)
+    nthreads = npids;
+  if (nthreads < 1)
+    nthreads = 1;
+  results = calloc(nthreads, sizeof(*results));
+  threads = calloc(nthreads, sizeof(*threads));
+  if (results == NULL || threads == NULL) {
+    error = ENOMEM;
+    goto out;
+  }
+
+  /* This thread is worker 0; if some others fail to start, it does more. */
+  for (started = 1; started < nthreads; started++) {
+    if (pthread_create(&threads[started], NULL, audit_worker, &scan) != 0)
+      break;
+  }
+  results[0] = audit_worker(&scan);
+  for (ii = 1; ii < started; ii++) {
+    void *rv = NULL;
+    pthread_join(threads[ii], &rv);
+    results[ii] = rv;
+  }
+
+  for (ii = 0; ii < started; ii++) {
+    if (results[ii] == NULL || results[ii]->error)
+      error = results[ii] ? results[ii]->error : ENOMEM;
+    else
+      total += results[ii]->nfds;
+  }
+  if (error == 0 && total > 0) {
+    report->fds = malloc(total * sizeof(*report->fds));
+    if (report->fds == NULL)
+      error = ENOMEM;
+  }
+  if (error == 0) {
+    for (ii = 0; ii < started; ii++) {
+      if (results[ii]->nfds > 0)
+        memcpy(&report->fds[report->nfds], results[ii]->fds,
+               results[ii]->nfds * sizeof(*report->fds));
+      report->nfds += results[ii]->nfds;
+      report->nprocs += results[ii]->nprocs;
+    }
+    qsort(report->fds, report->nfds, sizeof(*report->fds), audit_fd_cmp);
+  }
+  for (ii = 0; ii < started; ii++) {
+    if (results[ii]) {
+      free(results[ii]->fds);
+      free(results[ii]);
+    }
+  }
+
+out:
+  free(results);
+  free(threads);
+  free(all_pids);
+  close(scan.procfd);
+  if (error) {
+    cap_audit_free(report);
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+void cap_audit_free(struct cap_audit_report *report) {
+  free(report->fds);
+  memset(report, 0, sizeof(*report));
+}
+
+/************************************************************
+ * Reports.
+ ************************************************************/
+
+static void write_json_fd(FILE *out, const struct cap_audit_fd *entry) {
+  const char *names[sizeof(right_names) / sizeof(right_names[0])];
+  size_t nnames, ii;
+  fprintf(out, "{\"fd\":%d", entry->fd);
+  if (entry->flags & CAP_AUDIT_RIGHTS) {
+    fprintf(out, ",\"rights\":[\"0x%016llx\",\"0x%016llx\"],\"limited\":%s",
+            (unsigned long long)entry->rights.cr_rights[0],
+            (unsigned long long)entry->rights.cr_rights[1],
+            (entry->flags & CAP_AUDIT_LIMITED) ? "true" : "false");
+    if (entry->flags & CAP_AUDIT_LIMITED) {
+      nnames = cap_rights_names(&entry->rights, names, sizeof(names) / sizeof(names[0]));
+      fputs(",\"names\":[", out);
+      for (ii = 0; ii < nnames; ii++)
+        fprintf(out, "%s\"%s\"", ii ? "," : "", names[ii]);
+      fputc(']', out);
+    }
+  }
+  fputc('}', out);
+}
+
+int cap_audit_write_json(FILE *out, const struct cap_audit_report *report) {
+  size_t ii;
+  fputs("{\"processes\":[", out);
+  for (ii = 0; ii < report->nfds; ii++) {
+    const struct cap_audit_fd *entry = &report->fds[ii];
+    bool first_of_pid = (ii == 0 || report->fds[ii - 1].pid != entry->pid);
+    if (first_of_pid)
+      fprintf(out, "%s\n{\"pid\":%d,\"fds\":[", ii ? "]}," : "", (int)entry->pid);
+    else
+      fputc(',', out);
+    write_json_fd(out, entry);
+  }
+  fputs(report->nfds ? "]}\n]}\n" : "]}\n", out);
+  return ferror(out) ? -1 : 0;
+}
+
+int cap_audit_write_binary(FILE *out, const struct cap_audit_report *report) {
+  uint64_t count = report->nfds;
+  size_t ii;
+  fwrite("CAPAUDT1", 8, 1, out);
+  fwrite(&count, sizeof(count), 1, out);
+  for (ii = 0; ii < report->nfds; ii++) {
+    const struct cap_audit_fd *entry = &report->fds[ii];
+    int32_t header[4] = {entry->pid, entry->fd, entry->flags, 0};
+    fwrite(header, sizeof(header), 1, out);
+    fwrite(entry->rights.cr_rights, sizeof(uint64_t), 2, out);
+  }
+  return ferror(out) ? -1 : 0;
+}
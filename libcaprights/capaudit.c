@@ -0,0 +1,77 @@
+/*
+ * Report the Capsicum rights of every descriptor of every process.
+ *
+ * Usage: capaudit [-b] [-l] [-v] [-t threads] [-p procdir] [pid ...]
+ *   -b : write the compact binary report rather than JSON
+ *   -l : only report descriptors whose rights have been limited
+ *   -v : print a summary (processes, descriptors, time taken) to stderr
+ *   -t : number of scanning threads (default: one per CPU)
+ *   -p : proc filesystem to scan (default: /proc)
+ * With pids given, only those processes are scanned.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capaudit.h"
+
+int main(int argc, char *argv[]) {
+  struct cap_audit_report report;
+  struct timespec t0, t1;
+  const char *procdir = NULL;
+  pid_t *pids = NULL;
+  size_t npids = 0;
+  bool binary = false, verbose = false;
+  int options = 0, nthreads = 0;
+  int opt, ii, rc;
+
+  while ((opt = getopt(argc, argv, "blvt:p:")) != -1) {
+    switch (opt) {
+    case 'b': binary = true; break;
+    case 'l': options |= CAP_AUDIT_ONLY_LIMITED; break;
+    case 'v': verbose = true; break;
+    case 't': nthreads = atoi(optarg); break;
+    case 'p': procdir = optarg; break;
+    default:
+      fprintf(stderr, "Usage: %s [-b] [-l] [-v] [-t threads] [-p procdir] [pid ...]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (optind < argc) {
+    npids = argc - optind;
+    pids = calloc(npids, sizeof(pid_t));
+    if (pids == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    for (ii = optind; ii < argc; ii++)
+      pids[ii - optind] = atoi(argv[ii]);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (cap_audit_scan(procdir, pids, npids, nthreads, options, &report) < 0) {
+    fprintf(stderr, "failed to scan %s: %s\n", procdir ? procdir : "/proc", strerror(errno));
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  rc = binary ? cap_audit_write_binary(stdout, &report)
+              : cap_audit_write_json(stdout, &report);
+  if (fflush(stdout) != 0)
+    rc = -1;
+  if (verbose)
+    fprintf(stderr, "%zu processes, %zu descriptors in %.3fs\n",
+            report.nprocs, report.nfds,
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  cap_audit_free(&report);
+  free(pids);
+  if (rc < 0) {
+    fprintf(stderr, "failed to write report\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef _SYS_CAPAUDIT_H
+#define _SYS_CAPAUDIT_H
+
+/************************************************************
+ * Capsicum Descriptor Auditing.
+ ************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "capsicum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One descriptor, as described by /proc/<pid>/fdinfo/<fd>. */
+struct cap_audit_fd {
+  pid_t pid;
+  int fd;
+  int flags;
+  cap_rights_t rights;  /* Valid if CAP_AUDIT_RIGHTS is set */
+};
+#define CAP_AUDIT_RIGHTS	0x01  /* fdinfo had a rights line */
+#define CAP_AUDIT_LIMITED	0x02  /* ...and it was short of all rights */
+
+struct cap_audit_report {
+  struct cap_audit_fd *fds;  /* Sorted by pid, then fd */
+  size_t nfds;
+  size_t nprocs;  /* Processes whose fdinfo could be read */
+};
+
+/* Options for cap_audit_scan(). */
+#define CAP_AUDIT_ONLY_LIMITED	0x01  /* Only report descriptors with CAP_AUDIT_LIMITED */
+
+/*
+ * Scan the fdinfo of every process under procdir (NULL for "/proc"), or
+ * just the npids processes in pids[] if that's non-NULL, using nthreads
+ * worker threads (0 picks one per online CPU).  Processes that exit or that
+ * can't be read are skipped.  Returns 0, or -1 with errno set; on success
+ * the report must be released with cap_audit_free().
+ */
+int cap_audit_scan(const char *procdir, const pid_t *pids, size_t npids,
+                   int nthreads, int options, struct cap_audit_report *report);
+void cap_audit_free(struct cap_audit_report *report);
+
+/*
+ * Decode rights into names (without the CAP_ prefix), storing up to
+ * maxnames of them; returns the total number that match.  Compound rights
+ * (such as SEEK, which includes SEEK_TELL) are listed alongside their parts.
+ */
+size_t cap_rights_names(const cap_rights_t *rights, const char **names,
+                        size_t maxnames);
+
+/*
+ * The right (such as CAP_READ) with the given name, with or without the
+ * CAP_ prefix, or 0 if there is no such right.
+ */
+uint64_t cap_right_by_name(const char *name);
+
+/*
+ * Write a report as JSON (one object per process, with each descriptor's
+ * rights as raw words and decoded names), or in a compact binary form:
+ * the 8-byte magic "CAPAUDT1", a uint64_t count, then count records of
+ * { int32_t pid, fd, flags, pad; uint64_t rights[2]; } in host byte order.
+ */
+int cap_audit_write_json(FILE *out, const struct cap_audit_report *report);
+int cap_audit_write_binary(FILE *out, const struct cap_audit_report *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_SYS_CAPAUDIT_H*/
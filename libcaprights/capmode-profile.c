@@ -0,0 +1,549 @@
+/*
+ * Host-side emulator and cost profiler for the capability mode filter.
+ *
+ * Builds the same BPF program that cap_enter() installs, then interprets it in
+ * userspace for every syscall number of each architecture, with a selection of
+ * representative argument values.  For each syscall it reports the verdict and
+ * the number of BPF instructions executed to reach it, and it fails if any
+ * verdict differs from that of a linear chain built from the same rules.
+ *
+ * Usage: capmode-profile [-d] [-v] [-a max-average] [-w max-worst]
+ *                        [-l data-length] [-t tgid]
+ *        capmode-profile -p strace-output
+ *   -d : dump the BPF program
+ *   -v : show the cost table for every syscall number, not just the summary
+ *   -a : fail if the average path length for allowed syscalls exceeds this
+ *   -w : fail if the longest path for any syscall exceeds this
+ *   -l : length of the seccomp_data the kernel provides (default: all of it),
+ *        for kernels that don't fill in the .tgid and .tid fields
+ *   -t : thread group (and thread) ID of the caller, which is also tried as
+ *        an argument value
+ *   -p : count the syscalls in the output of strace (either a trace or a -c
+ *        summary) and write a syscall profile, in the form of
+ *        linux-bpf-capmode-profile.h, to stdout
+ */
+#include "linux-bpf-capmode.c"
+#include <ctype.h>
+#include <limits.h>
+
+#define NR_LIMIT	1024  /* syscall numbers to try on each architecture */
+#define PROFILE_MAX	32  /* most frequent syscalls to include in a profile */
+
+/*
+ * Argument values that the argument checks in the filter care about.  The
+ * last slot holds the caller's tgid, for the kill(2) and tgkill(2) checks.
+ */
+static uint64_t arg_values[] = {
+	0, 1, 2, 3,
+	(uint32_t)AT_FDCWD, (uint64_t)(int64_t)AT_FDCWD, 0x100000000ULL,
+	MAP_ANONYMOUS, MAP_SHARED, MAP_PRIVATE|MAP_FIXED,
+	O_RDWR|O_CREAT,
+	PR_GET_NAME, PR_SET_NAME, PR_GET_SECCOMP, PR_SET_SECCOMP,
+	SYS_SOCKET, SYS_CONNECT, SYS_ACCEPT4,
+	0x80000000ULL, 0xFFFFFFFFULL,
+	0,
+};
+#define DEFAULT_TGID	1000
+
+/* Every kernel provides at least .nr, .arch, .instruction_pointer and .args */
+#define SECCOMP_DATA_MIN_LEN	\
+	(offsetof(struct seccomp_data, args) + sizeof(((struct seccomp_data *)0)->args))
+
+struct arch_desc {
+	const char *name;
+	unsigned int arch;
+	unsigned int nr_bits;  /* OR-ed into syscall numbers */
+};
+
+static const struct arch_desc archs[] = {
+#if defined(__i386__)
+	{"i386", AUDIT_ARCH_I386, 0},
+	{"x86_64", AUDIT_ARCH_X86_64, 0},
+#elif defined(__x86_64__)
+	{"x86_64", AUDIT_ARCH_X86_64, 0},
+#ifdef __X32_SYSCALL_BIT
+	{"x32", AUDIT_ARCH_X86_64, __X32_SYSCALL_BIT},
+#endif
+	{"i386", AUDIT_ARCH_I386, 0},
+#endif
+	{"other", AUDIT_ARCH_ARM, 0},  /* unexpected architecture */
+};
+
+/*
+ * Run the program against the first len bytes of data, returning the verdict
+ * and setting *steps to the number of instructions executed.  The program is
+ * only expected to use the instructions that the generator and the rules in
+ * linux-bpf-capmode.h emit; anything else is an error.
+ */
+static int run_filter(const struct sock_fprog *fprog, const struct seccomp_data *data,
+		      size_t len, unsigned int *verdict, unsigned int *steps) {
+	unsigned int pc = 0;
+	uint32_t A = 0, X = 0;
+
+	*steps = 0;
+	while (pc < fprog->len) {
+		const struct sock_filter *insn = &fprog->filter[pc];
+		(*steps)++;
+		switch (insn->code) {
+		case BPF_LD+BPF_W+BPF_ABS:
+			if (len < sizeof(A) || insn->k > len - sizeof(A) || (insn->k & 3))
+				goto bad;
+			memcpy(&A, (const char *)data + insn->k, sizeof(A));
+			pc++;
+			break;
+		case BPF_LD+BPF_W+BPF_LEN:
+			A = len;
+			pc++;
+			break;
+		case BPF_MISC+BPF_TAX:
+			X = A;
+			pc++;
+			break;
+		case BPF_ALU+BPF_AND+BPF_K:
+			A &= insn->k;
+			pc++;
+			break;
+		case BPF_JMP+BPF_JA:
+			pc += 1 + insn->k;
+			break;
+		case BPF_JMP+BPF_JEQ+BPF_K:
+			pc += 1 + ((A == insn->k) ? insn->jt : insn->jf);
+			break;
+		case BPF_JMP+BPF_JGE+BPF_K:
+			pc += 1 + ((A >= insn->k) ? insn->jt : insn->jf);
+			break;
+		case BPF_JMP+BPF_JGT+BPF_K:
+			pc += 1 + ((A > insn->k) ? insn->jt : insn->jf);
+			break;
+		case BPF_JMP+BPF_JSET+BPF_K:
+			pc += 1 + ((A & insn->k) ? insn->jt : insn->jf);
+			break;
+		case BPF_JMP+BPF_JEQ+BPF_X:
+			pc += 1 + ((A == X) ? insn->jt : insn->jf);
+			break;
+		case BPF_RET+BPF_K:
+			*verdict = insn->k;
+			return 0;
+		default:
+			goto bad;
+		}
+	}
+	fprintf(stderr, "program runs off the end\n");
+	return -1;
+bad:
+	fprintf(stderr, "unexpected instruction 0x%02x (k=0x%x) at %u\n",
+		fprog->filter[pc].code, fprog->filter[pc].k, pc);
+	return -1;
+}
+
+static const char *verdict_name(unsigned int verdict) {
+	static char buffer[32];
+	switch (verdict & SECCOMP_RET_ACTION) {
+	case SECCOMP_RET_ALLOW:
+		return "ALLOW";
+	case SECCOMP_RET_KILL:
+		return "KILL";
+	case SECCOMP_RET_ERRNO:
+		if ((verdict & SECCOMP_RET_DATA) == ECAPMODE)
+			return "ECAPMODE";
+		snprintf(buffer, sizeof(buffer), "ERRNO(%u)", verdict & SECCOMP_RET_DATA);
+		return buffer;
+	default:
+		snprintf(buffer, sizeof(buffer), "0x%08x", verdict);
+		return buffer;
+	}
+}
+
+static void dump_filter(const struct sock_fprog *fprog) {
+	unsigned int pc;
+	printf(" line  OP   JT   JF   K\n");
+	printf("=================================\n");
+	for (pc = 0; pc < fprog->len; pc++) {
+		const struct sock_filter *insn = &fprog->filter[pc];
+		printf(" %04d: 0x%02x 0x%02x 0x%02x 0x%08x\n",
+		       pc, insn->code, insn->jt, insn->jf, insn->k);
+	}
+}
+
+/*
+ * Reference program: the same rules as a linear chain, testing each rule's
+ * syscall number in turn with the first match winning, as the filter was
+ * built before the search tree.  The search tree must give the same verdict
+ * as this for every input.  Only ever interpreted, so it may be longer than
+ * the kernel would accept.
+ */
+static struct sock_filter linear_insns[4 * BPF_MAXINSNS];
+static struct sock_fprog linear_fprog = {0, linear_insns};
+
+static bool linear_insn(struct sock_filter insn) {
+	if (linear_fprog.len >= COUNT_OF(linear_insns))
+		return false;
+	linear_insns[linear_fprog.len++] = insn;
+	return true;
+}
+
+static bool linear_rules(const struct capmode_rule *rules, unsigned int nrules) {
+	unsigned int ii, jj;
+
+	if (!linear_insn((struct sock_filter)
+			 BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr))) ||
+	    !linear_insn((struct sock_filter)
+			 BPF_STMT(BPF_ALU+BPF_AND+BPF_K, SYSCALL_NUM_MASK)))
+		return false;
+	for (ii = 0; ii < nrules; ii++) {
+		const struct capmode_rule *rule = &rules[ii];
+		if (rule->check == NULL) {
+			if (!linear_insn((struct sock_filter)
+					 BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, rule->nr, 0, 1)) ||
+			    !linear_insn((struct sock_filter)ALLOW))
+				return false;
+			continue;
+		}
+		/* Checks always return, so never fall through to the next rule */
+		if (rule->check_len > 255 ||
+		    !linear_insn((struct sock_filter)
+				 BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, rule->nr, 0, rule->check_len)))
+			return false;
+		for (jj = 0; jj < rule->check_len; jj++) {
+			if (!linear_insn(rule->check[jj]))
+				return false;
+		}
+	}
+	return linear_insn((struct sock_filter)FAIL_ECAPMODE);
+}
+
+static bool linear_build(void) {
+	unsigned int skip;
+
+	linear_fprog.len = 0;
+	if (!linear_insn((struct sock_filter)
+			 BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, arch))) ||
+	    !linear_insn((struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, BASE_ARCH, 1, 0)))
+		return false;
+	/* Jump over the base architecture's chain, patched in below */
+	skip = linear_fprog.len;
+	if (!linear_insn((struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JA, 0, 0, 0)) ||
+	    !linear_rules(capmode_rules, COUNT_OF(capmode_rules)))
+		return false;
+	linear_insns[skip].k = linear_fprog.len - skip - 1;
+#ifdef HAVE_ALTFILTER
+	if (!linear_insn((struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ALT_ARCH, 1, 0)) ||
+	    !linear_insn((struct sock_filter)KILL) ||
+	    !linear_rules(capmode_altrules, COUNT_OF(capmode_altrules)))
+		return false;
+	return true;
+#else
+	return linear_insn((struct sock_filter)KILL);
+#endif
+}
+
+/* Syscall numbers past NR_LIMIT, including ones with the x32 bit set */
+static const unsigned int far_nrs[] = {
+	0x0000FFFF, 0x3FFFFFFF, 0x40000000, 0x40000400, 0x7FFFFFFF,
+	0x80000000, 0xBFFFFFFF, 0xFFFFFFFE, 0xFFFFFFFF,
+};
+
+/*
+ * Check that the search tree gives the same verdict as the linear chain, for
+ * every architecture (including an unexpected one) and syscall number, with
+ * each interesting value in each argument.  Returns the number of mismatches.
+ */
+static unsigned int compare_linear(size_t len, unsigned int tgid) {
+	unsigned int mismatches = 0;
+	unsigned int aa, ii, arg, vv;
+
+	for (aa = 0; aa < COUNT_OF(archs); aa++) {
+		for (ii = 0; ii < NR_LIMIT + COUNT_OF(far_nrs); ii++) {
+			unsigned int nr = (ii < NR_LIMIT) ? ii : far_nrs[ii - NR_LIMIT];
+			for (arg = 0; arg < 6; arg++) {
+				for (vv = 0; vv < COUNT_OF(arg_values); vv++) {
+					struct seccomp_data data;
+					unsigned int tree, linear, steps;
+					memset(&data, 0, sizeof(data));
+					data.arch = archs[aa].arch;
+					data.nr = nr | archs[aa].nr_bits;
+					data.args[arg] = arg_values[vv];
+#ifdef SECCOMP_DATA_TID_PRESENT
+					data.tgid = tgid;
+					data.tid = tgid;
+#endif
+					if (run_filter(&capmode_fprog, &data, len, &tree, &steps) != 0 ||
+					    run_filter(&linear_fprog, &data, len, &linear, &steps) != 0)
+						return mismatches + 1;
+					if (tree == linear)
+						continue;
+					if (mismatches++ < 10) {
+						fprintf(stderr, "%s syscall %u arg %u=0x%llx: tree %s, ",
+							archs[aa].name, data.nr, arg,
+							(unsigned long long)arg_values[vv], verdict_name(tree));
+						fprintf(stderr, "linear %s\n", verdict_name(linear));
+					}
+				}
+			}
+		}
+	}
+	return mismatches;
+}
+
+struct syscall_count {
+	char name[64];
+	unsigned long count;
+};
+
+static int compare_count(const void *a, const void *b) {
+	const struct syscall_count *x = a;
+	const struct syscall_count *y = b;
+	if (x->count != y->count)
+		return (x->count < y->count) ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+static bool is_number(const char *word) {
+	if (*word == '\0')
+		return false;
+	for (; *word; word++) {
+		if (!isdigit((unsigned char)*word) && *word != '.' && *word != ':')
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Extract the syscall name and count from a line of strace output.  Trace
+ * lines look like "[pid] [time] name(args...) = result", with each call
+ * counting once; summary (-c) lines look like
+ * "% time  seconds  usecs/call  calls  [errors]  name".
+ */
+static bool parse_strace_line(char *line, char *name, size_t len, unsigned long *count) {
+	char *words[8];
+	unsigned int nwords = 0;
+	char *word, *paren;
+
+	for (word = strtok(line, " \t\n"); word != NULL && nwords < COUNT_OF(words);
+	     word = strtok(NULL, " \t\n"))
+		words[nwords++] = word;
+	if (nwords >= 5 && is_number(words[0]) && strchr(words[0], '.') &&
+	    isalpha((unsigned char)words[nwords - 1][0])) {
+		/* Summary row; the calls column is the fourth */
+		if (strcmp(words[nwords - 1], "total") == 0)
+			return false;
+		snprintf(name, len, "%s", words[nwords - 1]);
+		*count = strtoul(words[3], NULL, 10);
+		return true;
+	}
+
+	/* Skip any pid and timestamp, then expect name( */
+	while (nwords > 0 && (is_number(words[0]) || strcmp(words[0], "[pid") == 0 ||
+			      (isdigit((unsigned char)words[0][0]) && strchr(words[0], ']')))) {
+		memmove(words, words + 1, (nwords - 1) * sizeof(words[0]));
+		nwords--;
+	}
+	if (nwords == 0 || !(isalpha((unsigned char)words[0][0]) || words[0][0] == '_'))
+		return false;
+	paren = strchr(words[0], '(');
+	if (paren == NULL)
+		return false;
+	*paren = '\0';
+	for (word = words[0]; *word; word++) {
+		if (!isalnum((unsigned char)*word) && *word != '_')
+			return false;
+	}
+	snprintf(name, len, "%s", words[0]);
+	*count = 1;
+	return true;
+}
+
+/* Write a syscall profile for the strace output in filename. */
+static int write_profile(const char *filename) {
+	FILE *f = fopen(filename, "r");
+	struct syscall_count *counts = NULL;
+	unsigned int ncounts = 0, ii;
+	char line[4096];
+
+	if (f == NULL) {
+		perror(filename);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char name[64];
+		unsigned long count;
+		if (!parse_strace_line(line, name, sizeof(name), &count) || count == 0)
+			continue;
+		for (ii = 0; ii < ncounts; ii++) {
+			if (strcmp(counts[ii].name, name) == 0)
+				break;
+		}
+		if (ii == ncounts) {
+			struct syscall_count *more = realloc(counts, (ncounts + 1) * sizeof(*counts));
+			if (more == NULL) {
+				fprintf(stderr, "out of memory\n");
+				free(counts);
+				fclose(f);
+				return 1;
+			}
+			counts = more;
+			snprintf(counts[ncounts].name, sizeof(counts[ncounts].name), "%s", name);
+			counts[ncounts].count = 0;
+			ncounts++;
+		}
+		counts[ii].count += count;
+	}
+	fclose(f);
+	if (ncounts == 0) {
+		fprintf(stderr, "%s: no syscalls found\n", filename);
+		return 1;
+	}
+	qsort(counts, ncounts, sizeof(*counts), compare_count);
+
+	printf("/*\n"
+	       " * Syscall profile for the capability mode filter: relative frequencies of the\n"
+	       " * most common syscalls, used to put them nearer the root of the search tree.\n"
+	       " *\n"
+	       " * Generated by capmode-profile -p from strace output.\n"
+	       " *\n"
+	       " * Entries for syscalls that this architecture lacks are skipped.\n"
+	       " */\n"
+	       "static const struct capmode_weight capmode_weights[] = {\n");
+	for (ii = 0; ii < ncounts && ii < PROFILE_MAX; ii++) {
+		printf("#ifdef __NR_%s\n", counts[ii].name);
+		printf("\tSYSCALL_WEIGHT(%s, %lu),\n", counts[ii].name,
+		       counts[ii].count > UINT_MAX ? (unsigned long)UINT_MAX : counts[ii].count);
+		printf("#endif\n");
+	}
+	printf("};\n");
+	free(counts);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	double max_average = 0;
+	unsigned int max_worst = 0;
+	unsigned int worst = 0, mismatches;
+	bool dump = false, verbose = false, failed = false;
+	size_t len = sizeof(struct seccomp_data);
+	unsigned int tgid = DEFAULT_TGID;
+	unsigned int aa, nr, arg, vv;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "dva:w:l:t:p:")) != -1) {
+		switch (opt) {
+		case 'p': return write_profile(optarg);
+		case 'd': dump = true; break;
+		case 'v': verbose = true; break;
+		case 'a': max_average = atof(optarg); break;
+		case 'w': max_worst = atoi(optarg); break;
+		case 'l': len = strtoul(optarg, NULL, 0); break;
+		case 't': tgid = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-d] [-v] [-a max-average] [-w max-worst]\n"
+				"       %*s [-l data-length] [-t tgid]\n"
+				"       %s -p strace-output\n",
+				argv[0], (int)strlen(argv[0]), "", argv[0]);
+			return 2;
+		}
+	}
+	if (len < SECCOMP_DATA_MIN_LEN || len > sizeof(struct seccomp_data)) {
+		fprintf(stderr, "data length must be from %zu to %zu\n",
+			SECCOMP_DATA_MIN_LEN, sizeof(struct seccomp_data));
+		return 2;
+	}
+	arg_values[COUNT_OF(arg_values) - 1] = tgid;
+	if (capmode_error) {
+		fprintf(stderr, "failed to generate filter: %s\n", strerror(capmode_error));
+		return 1;
+	}
+	if (dump)
+		dump_filter(&capmode_fprog);
+	printf("program length %u instructions\n", capmode_fprog.len);
+	if (!linear_build()) {
+		fprintf(stderr, "failed to generate linear reference program\n");
+		return 1;
+	}
+	mismatches = compare_linear(len, tgid);
+	if (mismatches > 0) {
+		fprintf(stderr, "%u verdicts differ from the linear rule chain\n", mismatches);
+		failed = true;
+	}
+	if (verbose)
+		printf("%-8s %5s  %-10s %s\n", "arch", "nr", "verdict", "insns");
+
+	for (aa = 0; aa < COUNT_OF(archs); aa++) {
+		unsigned int allowed = 0, checked = 0;
+		unsigned long allowed_steps = 0;
+		unsigned long long profile_steps = 0, profile_total = 0;
+		unsigned int arch_worst = 0;
+		for (nr = 0; nr < NR_LIMIT; nr++) {
+			struct seccomp_data data;
+			unsigned int verdict, steps, first = 0;
+			unsigned int min_steps = UINT_MAX, max_steps = 0;
+			bool varies = false;
+
+			/* Try each argument in turn with each of the interesting values. */
+			for (arg = 0; arg < 6; arg++) {
+				for (vv = 0; vv < COUNT_OF(arg_values); vv++) {
+					memset(&data, 0, sizeof(data));
+					data.arch = archs[aa].arch;
+					data.nr = nr | archs[aa].nr_bits;
+					data.args[arg] = arg_values[vv];
+#ifdef SECCOMP_DATA_TID_PRESENT
+					data.tgid = tgid;
+					data.tid = tgid;
+#endif
+					if (run_filter(&capmode_fprog, &data, len, &verdict, &steps) != 0)
+						return 1;
+					if (arg == 0 && vv == 0)
+						first = verdict;
+					else if (verdict != first)
+						varies = true;
+					if (steps < min_steps) min_steps = steps;
+					if (steps > max_steps) max_steps = steps;
+				}
+			}
+			if (varies) {
+				checked++;
+			} else if (first == SECCOMP_RET_ALLOW) {
+				allowed++;
+				allowed_steps += max_steps;
+			}
+			if (max_steps > arch_worst)
+				arch_worst = max_steps;
+			if (archs[aa].arch == BASE_ARCH && archs[aa].nr_bits == 0) {
+				/* Expected cost, weighted by the syscall profile */
+				unsigned int ww;
+				for (ww = 0; ww < COUNT_OF(capmode_weights); ww++) {
+					if (capmode_weights[ww].nr != nr)
+						continue;
+					profile_steps += (unsigned long long)max_steps * capmode_weights[ww].weight;
+					profile_total += capmode_weights[ww].weight;
+				}
+			}
+			if (verbose && (varies || first == SECCOMP_RET_ALLOW)) {
+				printf("%-8s %5u  %-10s ", archs[aa].name, nr,
+				       varies ? "ARGS" : verdict_name(first));
+				if (min_steps == max_steps)
+					printf("%u\n", max_steps);
+				else
+					printf("%u-%u\n", min_steps, max_steps);
+			}
+		}
+		printf("%-8s %4u allowed, %4u argument-checked; average %.2f, worst %u instructions\n",
+		       archs[aa].name, allowed, checked,
+		       allowed ? (double)allowed_steps / allowed : 0.0, arch_worst);
+		if (profile_total > 0)
+			printf("%-8s profile-weighted average %.2f instructions\n",
+			       archs[aa].name, (double)profile_steps / profile_total);
+		if (max_average > 0 && allowed > 0 &&
+		    (double)allowed_steps / allowed > max_average) {
+			fprintf(stderr, "%s: average path length %.2f exceeds %.2f\n",
+				archs[aa].name, (double)allowed_steps / allowed, max_average);
+			failed = true;
+		}
+		if (arch_worst > worst)
+			worst = arch_worst;
+	}
+	if (max_worst > 0 && worst > max_worst) {
+		fprintf(stderr, "worst path length %u exceeds %u\n", worst, max_worst);
+		failed = true;
+	}
+	return failed ? 1 : 0;
+}
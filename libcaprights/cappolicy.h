@@ -0,0 +1,56 @@
+#ifndef _SYS_CAPPOLICY_H
+#define _SYS_CAPPOLICY_H
+
+/************************************************************
+ * Declarative Capsicum Rights Policies.
+ ************************************************************/
+#include <stddef.h>
+#include "capsicum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A policy maps descriptor roles to the rights, fcntls and ioctls that
+ * descriptors in that role keep.  It is written one role per line:
+ *
+ *   # role    settings
+ *   listen    rights=ACCEPT,EVENT,GETSOCKOPT
+ *   log       rights=WRITE,FSTAT fcntls=GETFL
+ *   tty       rights=READ,WRITE ioctls=0x5401,0x541B
+ *   datadir   rights=LOOKUP,READ,FSTAT,SEEK
+ *
+ * Rights are named as for cap_right_by_name(), fcntls as for the
+ * CAP_FCNTL_* flags, and ioctls by number; "none" gives an empty list.
+ * Listing fcntls or ioctls implies CAP_FCNTL or CAP_IOCTL; leaving them
+ * out with that right present allows them all.
+ */
+struct cap_policy;
+
+/*
+ * Compile a policy from its text.  Returns NULL with errno set on failure;
+ * for a malformed policy that is EINVAL, and *errline (if non-NULL) is set
+ * to the offending line (counting from 1).
+ */
+struct cap_policy *cap_policy_compile(const char *text, int *errline);
+void cap_policy_free(struct cap_policy *policy);
+
+/* Index of the named role, or -1 with errno ENOENT if there's no such role. */
+int cap_policy_role(const struct cap_policy *policy, const char *name);
+/* The rights of a role, or NULL with errno EINVAL for a bad index. */
+const cap_rights_t *cap_policy_rights(const struct cap_policy *policy, int role);
+
+/*
+ * Limit each fds[i] to the role roles[i] of the policy, skipping entries
+ * whose role is negative.  Each descriptor takes a single cap_rights_limit(2)
+ * call, and the outcome is recorded as for cap_rights_limit_many().
+ */
+int cap_policy_apply(const struct cap_policy *policy, const int *fds,
+                     const int *roles, size_t nfds, int *errors);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_SYS_CAPPOLICY_H*/
@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <sched.h>
 
 #include <sys/prctl.h>
 #include <sys/syscall.h>
@@ -69,107 +70,622 @@ static inline bool has_right(const cap_rights_t *rights, __u64 right) {
 
 static void cap_rights_regularize(const cap_rights_t * rights,
                                   cap_fcntl_t *fcntls,
-                                  int *nioctls,
-                                  cap_ioctl_t **ioctls) {
+                                  int *nioctls) {
   if (!has_right(rights, CAP_FCNTL))
     *fcntls = 0x00;
-  if (!has_right(rights, CAP_IOCTL)) {
+  if (!has_right(rights, CAP_IOCTL))
     *nioctls = 0;
-    free(*ioctls);
-    *ioctls = NULL;
+}
+
+/*
+ * Space for an ioctl list.  Lists of up to CAP_IOCTLS_INLINE entries (the
+ * kernel's limit, where it has one) fit in the structure itself, so the usual
+ * case needs no allocation; longer lists move to the heap.
+ */
+#ifdef CAP_IOCTLS_LIMIT_MAX
+#define CAP_IOCTLS_INLINE CAP_IOCTLS_LIMIT_MAX
+#else
+#define CAP_IOCTLS_INLINE 256
+#endif
+struct ioctl_scratch {
+  cap_ioctl_t *cmds;
+  int size;
+  cap_ioctl_t inline_cmds[CAP_IOCTLS_INLINE];
+};
+
+static void ioctl_scratch_init(struct ioctl_scratch *scratch) {
+  scratch->cmds = scratch->inline_cmds;
+  scratch->size = CAP_IOCTLS_INLINE;
+}
+
+/* Make room for n entries, discarding the current contents. */
+static int ioctl_scratch_reserve(struct ioctl_scratch *scratch, int n) {
+  cap_ioctl_t *cmds;
+  if (n <= scratch->size)
+    return 0;
+  cmds = malloc(n * sizeof(cap_ioctl_t));
+  if (cmds == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if (scratch->cmds != scratch->inline_cmds)
+    free(scratch->cmds);
+  scratch->cmds = cmds;
+  scratch->size = n;
+  return 0;
+}
+
+static void ioctl_scratch_free(struct ioctl_scratch *scratch) {
+  if (scratch->cmds != scratch->inline_cmds)
+    free(scratch->cmds);
+  ioctl_scratch_init(scratch);
+}
+
+static int ioctl_cmp(const void *a, const void *b) {
+  cap_ioctl_t x = *(const cap_ioctl_t *)a;
+  cap_ioctl_t y = *(const cap_ioctl_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Whether cmds[0..n) is strictly increasing (so sorted, without duplicates). */
+static bool ioctls_sorted(const cap_ioctl_t *cmds, size_t n) {
+  size_t ii;
+  for (ii = 1; ii < n; ii++)
+    if (cmds[ii - 1] >= cmds[ii])
+      return false;
+  return true;
+}
+
+static bool ioctl_in_sorted(const cap_ioctl_t *cmds, int n, cap_ioctl_t cmd) {
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (cmds[mid] < cmd)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && cmds[lo] == cmd;
+}
+
+/*
+ * Return cmds[0..*ncmds) sorted and without duplicates, updating *ncmds.  A
+ * list that is already in that form is returned as is; otherwise the result
+ * is built in scratch.  Returns NULL if scratch can't grow.
+ */
+static const cap_ioctl_t *ioctls_canonical(const cap_ioctl_t *cmds, size_t *ncmds,
+                                           struct ioctl_scratch *scratch) {
+  size_t ii, out;
+  if (ioctls_sorted(cmds, *ncmds) || *ncmds > INT_MAX)
+    return cmds;
+  if (ioctl_scratch_reserve(scratch, *ncmds) < 0)
+    return NULL;
+  memcpy(scratch->cmds, cmds, *ncmds * sizeof(cap_ioctl_t));
+  qsort(scratch->cmds, *ncmds, sizeof(cap_ioctl_t), ioctl_cmp);
+  for (ii = 1, out = 1; ii < *ncmds; ii++)
+    if (scratch->cmds[ii] != scratch->cmds[out - 1])
+      scratch->cmds[out++] = scratch->cmds[ii];
+  *ncmds = out;
+  return scratch->cmds;
+}
+
+/*
+ * Fetch the kernel's state for fd, with the ioctl list (if scratch is
+ * non-NULL) in scratch->cmds.  This takes a single syscall unless the list
+ * is too long for the scratch space.
+ */
+static int cap_rights_get_kernel(int fd,
+                                 cap_rights_t *rights,
+                                 cap_fcntl_t *fcntls,
+                                 int *nioctls,
+                                 struct ioctl_scratch *scratch) {
+  int rc;
+  if (scratch == NULL)
+    return syscall(__NR_cap_rights_get, fd, rights, fcntls, nioctls, NULL, 0);
+  *nioctls = scratch->size;
+  rc = syscall(__NR_cap_rights_get, fd, rights, fcntls, nioctls, scratch->cmds, 0);
+  if (rc < 0 || *nioctls <= scratch->size)
+    return rc;
+  if (ioctl_scratch_reserve(scratch, *nioctls) < 0)
+    return -1;
+  *nioctls = scratch->size;
+  return syscall(__NR_cap_rights_get, fd, NULL, NULL, nioctls, scratch->cmds, 0);
+}
+
+/************************************************************
+ * Descriptor Rights Cache.
+ ************************************************************/
+
+/*
+ * Optional cache of the rights, fcntls and ioctls on each descriptor, enabled
+ * by cap_rights_cache_enable().  Rights only ever shrink, and every change
+ * made through this library updates the cache, so an entry can only go stale
+ * when its descriptor number is closed and reused; callers that enable the
+ * cache report that with cap_rights_cache_invalidate().  Entries are only
+ * valid if they carry the current generation, so forgetting everything is a
+ * single increment.
+ *
+ * The cache lock isn't held across the kernel calls, so two threads limiting
+ * the same descriptor could record their results in the opposite order to
+ * the kernel's.  Every change to the cache counts in changes, and a result is
+ * only recorded if nothing changed since the caller took a stamp before
+ * asking the kernel; otherwise the entry is dropped, to be refetched.
+ */
+#define RIGHTS_CACHE_MAX_FD 65536
+
+struct rights_cache_entry {
+  unsigned long generation;  /* 0 if never filled */
+  cap_rights_t rights;
+  cap_fcntl_t fcntls;
+  int nioctls;
+  cap_ioctl_t *ioctls;  /* nioctls entries when nioctls > 0, sorted */
+};
+
+static struct {
+  bool enabled;
+  int lock;
+  unsigned long generation;
+  unsigned long changes;
+  int size;
+  struct rights_cache_entry *entries;
+} rights_cache = {false, 0, 1, 0, 0, NULL};
+
+static void rights_cache_lock(void) {
+  while (__atomic_exchange_n(&rights_cache.lock, 1, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+static void rights_cache_unlock(void) {
+  __atomic_store_n(&rights_cache.lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline bool rights_cache_enabled(void) {
+  return __atomic_load_n(&rights_cache.enabled, __ATOMIC_ACQUIRE);
+}
+
+/* Take a stamp for rights_cache_put(), before asking the kernel. */
+static inline unsigned long rights_cache_stamp(void) {
+  return __atomic_load_n(&rights_cache.changes, __ATOMIC_ACQUIRE);
+}
+
+/* Note a change to the cache.  Call with the lock held. */
+static inline void rights_cache_changed(void) {
+  __atomic_store_n(&rights_cache.changes, rights_cache.changes + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the valid entry for fd, or NULL.  Call with the lock held. */
+static struct rights_cache_entry *rights_cache_find(int fd) {
+  struct rights_cache_entry *entry;
+  if (!rights_cache.enabled || fd < 0 || fd >= rights_cache.size)
+    return NULL;
+  entry = &rights_cache.entries[fd];
+  return (entry->generation == rights_cache.generation) ? entry : NULL;
+}
+
+/*
+ * Copy out the cached state for fd, with the ioctl list (if scratch is
+ * non-NULL) in scratch->cmds.  Returns true on a hit.
+ */
+static bool rights_cache_get(int fd,
+                             cap_rights_t *rights,
+                             cap_fcntl_t *fcntls,
+                             int *nioctls,
+                             struct ioctl_scratch *scratch) {
+  struct rights_cache_entry *entry;
+  bool hit = false;
+  if (!rights_cache_enabled())
+    return false;
+  rights_cache_lock();
+  entry = rights_cache_find(fd);
+  if (entry && (!scratch || ioctl_scratch_reserve(scratch, entry->nioctls) == 0)) {
+    if (scratch && entry->nioctls > 0)
+      memcpy(scratch->cmds, entry->ioctls, entry->nioctls * sizeof(cap_ioctl_t));
+    *rights = entry->rights;
+    *fcntls = entry->fcntls;
+    *nioctls = entry->nioctls;
+    hit = true;
+  }
+  rights_cache_unlock();
+  return hit;
+}
+
+/*
+ * Whether the cached state for fd allows ioctl cmd: 1 if so, 0 if not, -1 if
+ * fd isn't cached.
+ */
+static int rights_cache_allowed(int fd, cap_ioctl_t cmd) {
+  struct rights_cache_entry *entry;
+  int rc = -1;
+  rights_cache_lock();
+  entry = rights_cache_find(fd);
+  if (entry) {
+    if (!has_right(&entry->rights, CAP_IOCTL))
+      rc = 0;
+    else if (entry->nioctls < 0)
+      rc = 1;
+    else
+      rc = ioctl_in_sorted(entry->ioctls, entry->nioctls, cmd);
   }
+  rights_cache_unlock();
+  return rc;
 }
 
-/* Caller owns (*ioctls) on return */
+/*
+ * Record what the kernel now holds for fd, or drop the entry if the cache has
+ * changed since stamp was taken.
+ */
+static void rights_cache_put(int fd,
+                             unsigned long stamp,
+                             const cap_rights_t *rights,
+                             cap_fcntl_t fcntls,
+                             int nioctls,
+                             const cap_ioctl_t *ioctls) {
+  struct rights_cache_entry *entry;
+  if (!rights_cache_enabled() || fd < 0 || fd >= RIGHTS_CACHE_MAX_FD)
+    return;
+  rights_cache_lock();
+  if (!rights_cache.enabled)
+    goto out;
+  if (rights_cache.changes != stamp) {
+    rights_cache_changed();
+    if (fd < rights_cache.size)
+      rights_cache.entries[fd].generation = 0;
+    goto out;
+  }
+  rights_cache_changed();
+  if (fd >= rights_cache.size) {
+    int size = rights_cache.size ? rights_cache.size : 64;
+    struct rights_cache_entry *entries;
+    while (size <= fd)
+      size *= 2;
+    entries = realloc(rights_cache.entries, size * sizeof(*entries));
+    if (entries == NULL)
+      goto out;
+    memset(&entries[rights_cache.size], 0,
+           (size - rights_cache.size) * sizeof(*entries));
+    rights_cache.entries = entries;
+    rights_cache.size = size;
+  }
+  entry = &rights_cache.entries[fd];
+  entry->generation = 0;
+  if (nioctls > 0) {
+    cap_ioctl_t *cmds = realloc(entry->ioctls, nioctls * sizeof(cap_ioctl_t));
+    if (cmds == NULL)
+      goto out;
+    memcpy(cmds, ioctls, nioctls * sizeof(cap_ioctl_t));
+    if (!ioctls_sorted(cmds, nioctls))
+      qsort(cmds, nioctls, sizeof(cap_ioctl_t), ioctl_cmp);
+    entry->ioctls = cmds;
+  }
+  entry->rights = *rights;
+  entry->fcntls = fcntls;
+  entry->nioctls = nioctls;
+  entry->generation = rights_cache.generation;
+out:
+  rights_cache_unlock();
+}
+
+void cap_rights_cache_invalidate(int fd) {
+  if (!rights_cache_enabled())
+    return;
+  rights_cache_lock();
+  rights_cache_changed();
+  if (fd < 0) {
+    rights_cache.generation++;
+  } else if (fd < rights_cache.size) {
+    rights_cache.entries[fd].generation = 0;
+  }
+  rights_cache_unlock();
+}
+
+void cap_rights_cache_enable(bool enable) {
+  int ii;
+  rights_cache_lock();
+  rights_cache_changed();
+  rights_cache.generation++;
+  if (!enable) {
+    for (ii = 0; ii < rights_cache.size; ii++)
+      free(rights_cache.entries[ii].ioctls);
+    free(rights_cache.entries);
+    rights_cache.entries = NULL;
+    rights_cache.size = 0;
+  }
+  __atomic_store_n(&rights_cache.enabled, enable, __ATOMIC_RELEASE);
+  rights_cache_unlock();
+}
+
+/* As cap_rights_get_kernel(), but answered from the cache if possible. */
 static int cap_rights_get_all(int fd,
                               cap_rights_t *rights,
                               cap_fcntl_t *fcntls,
                               int *nioctls,
-                              cap_ioctl_t **ioctls) {
-  int rc = syscall(__NR_cap_rights_get, fd, rights, fcntls, nioctls, NULL, 0);
-  if (rc < 0)
-    return rc;
-  if (ioctls) {
-    if (*nioctls > 0) {
-      *ioctls = malloc(*nioctls * sizeof(unsigned int));
-      if (*ioctls == NULL) {
-        errno = ENOMEM;
-        return -1;
-      }
-      rc = syscall(__NR_cap_rights_get, fd, NULL, NULL, nioctls, *ioctls, 0);
-      if (rc < 0)
-        return rc;
-    } else {
-      *ioctls = NULL;
-    }
+                              struct ioctl_scratch *scratch) {
+  struct ioctl_scratch local;
+  unsigned long stamp;
+  int rc;
+  if (rights_cache_get(fd, rights, fcntls, nioctls, scratch))
+    return 0;
+  if (!rights_cache_enabled())
+    return cap_rights_get_kernel(fd, rights, fcntls, nioctls, scratch);
+  stamp = rights_cache_stamp();
+  /* Fetch everything, so the cache entry is complete. */
+  if (scratch == NULL) {
+    ioctl_scratch_init(&local);
+    rc = cap_rights_get_kernel(fd, rights, fcntls, nioctls, &local);
+    if (rc == 0)
+      rights_cache_put(fd, stamp, rights, *fcntls, *nioctls, local.cmds);
+    ioctl_scratch_free(&local);
+  } else {
+    rc = cap_rights_get_kernel(fd, rights, fcntls, nioctls, scratch);
+    if (rc == 0)
+      rights_cache_put(fd, stamp, rights, *fcntls, *nioctls, scratch->cmds);
   }
-  return 0;
+  return rc;
 }
 
 int cap_rights_limit(int fd, const cap_rights_t *rights) {
+  struct ioctl_scratch scratch;
   cap_rights_t primary;
   cap_fcntl_t fcntls;
   int nioctls;
-  cap_ioctl_t *ioctls = NULL;
   int rc;
   if (!cap_rights_is_valid(rights)) {
     errno = EINVAL;
     return -1;
   }
-  rc = cap_rights_get_all(fd, &primary, &fcntls, &nioctls, &ioctls);
-  if (rc)
-    return rc;
-  cap_rights_regularize(rights, &fcntls, &nioctls, &ioctls);
-  rc = syscall(__NR_cap_rights_limit, fd, rights, fcntls, nioctls, ioctls, 0);
-  if (ioctls)
-    free(ioctls);
+  /* The existing ioctl list only needs reading if it's going to be kept. */
+  ioctl_scratch_init(&scratch);
+  rc = cap_rights_get_all(fd, &primary, &fcntls, &nioctls,
+                          has_right(rights, CAP_IOCTL) ? &scratch : NULL);
+  if (rc == 0) {
+    unsigned long stamp = rights_cache_stamp();
+    cap_rights_regularize(rights, &fcntls, &nioctls);
+    rc = syscall(__NR_cap_rights_limit, fd, rights, fcntls, nioctls,
+                 nioctls > 0 ? scratch.cmds : NULL, 0);
+    if (rc == 0)
+      rights_cache_put(fd, stamp, rights, fcntls, nioctls, scratch.cmds);
+    else
+      cap_rights_cache_invalidate(fd);
+  }
+  ioctl_scratch_free(&scratch);
   return rc;
 }
 
 int cap_rights_get(int fd, cap_rights_t *rights) {
+  cap_fcntl_t fcntls;
+  int nioctls;
+  if (rights_cache_enabled())
+    return cap_rights_get_all(fd, rights, &fcntls, &nioctls, NULL);
   return syscall(__NR_cap_rights_get, fd, rights, NULL, NULL, NULL, 0);
 }
 
 int cap_fcntls_limit(int fd, cap_fcntl_t fcntls) {
+  struct ioctl_scratch scratch;
   cap_rights_t primary;
   int nioctls;
   cap_fcntl_t prev_fcntls;
-  cap_ioctl_t *ioctls = NULL;
   int rc;
-  rc = cap_rights_get_all(fd, &primary, &prev_fcntls, &nioctls, &ioctls);
-  if (rc)
-    return rc;
-  rc = syscall(__NR_cap_rights_limit, fd, &primary, fcntls, nioctls, ioctls, 0);
-  if (ioctls)
-    free(ioctls);
+  ioctl_scratch_init(&scratch);
+  rc = cap_rights_get_all(fd, &primary, &prev_fcntls, &nioctls, &scratch);
+  if (rc == 0) {
+    unsigned long stamp = rights_cache_stamp();
+    rc = syscall(__NR_cap_rights_limit, fd, &primary, fcntls, nioctls,
+                 nioctls > 0 ? scratch.cmds : NULL, 0);
+    if (rc == 0)
+      rights_cache_put(fd, stamp, &primary, fcntls, nioctls, scratch.cmds);
+    else
+      cap_rights_cache_invalidate(fd);
+  }
+  ioctl_scratch_free(&scratch);
   return rc;
 }
 
 int cap_fcntls_get(int fd, cap_fcntl_t *fcntlsp) {
+  cap_rights_t primary;
+  int nioctls;
+  if (rights_cache_enabled())
+    return cap_rights_get_all(fd, &primary, fcntlsp, &nioctls, NULL);
   return syscall(__NR_cap_rights_get, fd, NULL, fcntlsp, NULL, NULL, 0);
 }
 
 int cap_ioctls_limit(int fd, const cap_ioctl_t *cmds, size_t ncmds) {
+  struct ioctl_scratch scratch;
   cap_rights_t primary;
   cap_fcntl_t fcntls;
   int prev_nioctls;
+  unsigned long stamp;
   int rc;
   rc = cap_rights_get_all(fd, &primary, &fcntls, &prev_nioctls, NULL);
   if (rc)
     return rc;
+  /* Keep the kernel's list sorted, so lookups can use a binary search. */
+  ioctl_scratch_init(&scratch);
+  if (cmds) {
+    cmds = ioctls_canonical(cmds, &ncmds, &scratch);
+    if (cmds == NULL)
+      return -1;
+  }
+  stamp = rights_cache_stamp();
   rc = syscall(__NR_cap_rights_limit, fd, &primary, fcntls, ncmds, cmds, 0);
+  if (rc == 0)
+    rights_cache_put(fd, stamp, &primary, fcntls, ncmds, cmds);
+  else
+    cap_rights_cache_invalidate(fd);
+  ioctl_scratch_free(&scratch);
   return rc;
 }
 
 ssize_t cap_ioctls_get(int fd, cap_ioctl_t *cmds, size_t maxcmds) {
   int n = maxcmds;
-  int rc = syscall(__NR_cap_rights_get, fd, NULL, NULL, &n, cmds, 0);
+  int rc;
+  if (rights_cache_enabled()) {
+    struct ioctl_scratch scratch;
+    cap_rights_t primary;
+    cap_fcntl_t fcntls;
+    ioctl_scratch_init(&scratch);
+    rc = cap_rights_get_all(fd, &primary, &fcntls, &n, &scratch);
+    if (rc == 0 && n > 0 && maxcmds > 0)
+      memcpy(cmds, scratch.cmds, ((size_t)n < maxcmds ? (size_t)n : maxcmds) * sizeof(cap_ioctl_t));
+    ioctl_scratch_free(&scratch);
+  } else {
+    rc = syscall(__NR_cap_rights_get, fd, NULL, NULL, &n, cmds, 0);
+  }
   if (rc >= 0)
     return (n == -1) ? CAP_IOCTLS_ALL : n;
   else
     return rc;
 }
 
+int cap_ioctls_allowed(int fd, cap_ioctl_t cmd) {
+  struct ioctl_scratch scratch;
+  cap_rights_t primary;
+  cap_fcntl_t fcntls;
+  int nioctls;
+  int rc, ii;
+  if (rights_cache_enabled()) {
+    rc = rights_cache_allowed(fd, cmd);
+    if (rc >= 0)
+      return rc;
+    if (cap_rights_get_all(fd, &primary, &fcntls, &nioctls, NULL) < 0)
+      return -1;
+    rc = rights_cache_allowed(fd, cmd);
+    if (rc >= 0)
+      return rc;
+  }
+  /* Not cached; the kernel's list may not be sorted. */
+  ioctl_scratch_init(&scratch);
+  rc = cap_rights_get_kernel(fd, &primary, &fcntls, &nioctls, &scratch);
+  if (rc == 0) {
+    if (!has_right(&primary, CAP_IOCTL))
+      rc = 0;
+    else if (nioctls < 0)
+      rc = 1;
+    for (ii = 0; ii < nioctls && rc == 0; ii++)
+      rc = (scratch.cmds[ii] == cmd);
+  }
+  ioctl_scratch_free(&scratch);
+  return rc;
+}
+
+/************************************************************
+ * Batch Capsicum Calls.
+ ************************************************************/
+
+/*
+ * Record the outcome for fds[ii] of a batch call, returning the running
+ * result: 0 while every descriptor has succeeded, -1 after any failure (with
+ * errno left as the first failure's).
+ */
+static int batch_result(int result, int *first_errno, int *errors, size_t ii, int rc) {
+  if (errors)
+    errors[ii] = (rc < 0) ? errno : 0;
+  if (rc < 0 && result == 0) {
+    *first_errno = errno;
+    return -1;
+  }
+  return result;
+}
+
+int cap_rights_limit_many(const int *fds, size_t nfds,
+                          const cap_rights_t *rights, int *errors) {
+  struct ioctl_scratch scratch;
+  bool want_fcntls, want_ioctls;
+  cap_fcntl_t fcntls = 0;
+  int nioctls = 0;
+  int result = 0, first_errno = 0;
+  size_t ii;
+  if (!cap_rights_is_valid(rights) || (nfds > 0 && fds == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+  ioctl_scratch_init(&scratch);
+  /*
+   * Existing fcntl and ioctl limits only survive if the new rights still
+   * include CAP_FCNTL or CAP_IOCTL; without either, there's nothing to read.
+   */
+  want_fcntls = has_right(rights, CAP_FCNTL);
+  want_ioctls = has_right(rights, CAP_IOCTL);
+  for (ii = 0; ii < nfds; ii++) {
+    cap_rights_t primary;
+    int rc = 0;
+    if (want_fcntls || want_ioctls) {
+      rc = cap_rights_get_kernel(fds[ii], &primary, &fcntls, &nioctls,
+                                 want_ioctls ? &scratch : NULL);
+      if (!want_fcntls)
+        fcntls = 0;
+      if (!want_ioctls)
+        nioctls = 0;
+    }
+    if (rc == 0)
+      rc = syscall(__NR_cap_rights_limit, fds[ii], rights, fcntls, nioctls,
+                   nioctls > 0 ? scratch.cmds : NULL, 0);
+    cap_rights_cache_invalidate(fds[ii]);
+    result = batch_result(result, &first_errno, errors, ii, rc);
+  }
+  ioctl_scratch_free(&scratch);
+  if (result)
+    errno = first_errno;
+  return result;
+}
+
+int cap_fcntls_limit_many(const int *fds, size_t nfds,
+                          cap_fcntl_t fcntls, int *errors) {
+  struct ioctl_scratch scratch;
+  int result = 0, first_errno = 0;
+  size_t ii;
+  if (nfds > 0 && fds == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  ioctl_scratch_init(&scratch);
+  for (ii = 0; ii < nfds; ii++) {
+    cap_rights_t primary;
+    cap_fcntl_t prev_fcntls;
+    int nioctls;
+    int rc = cap_rights_get_kernel(fds[ii], &primary, &prev_fcntls, &nioctls, &scratch);
+    if (rc == 0)
+      rc = syscall(__NR_cap_rights_limit, fds[ii], &primary, fcntls, nioctls,
+                   nioctls > 0 ? scratch.cmds : NULL, 0);
+    cap_rights_cache_invalidate(fds[ii]);
+    result = batch_result(result, &first_errno, errors, ii, rc);
+  }
+  ioctl_scratch_free(&scratch);
+  if (result)
+    errno = first_errno;
+  return result;
+}
+
+int cap_ioctls_limit_many(const int *fds, size_t nfds,
+                          const cap_ioctl_t *cmds, size_t ncmds, int *errors) {
+  struct ioctl_scratch scratch;
+  int result = 0, first_errno = 0;
+  size_t ii;
+  if ((nfds > 0 && fds == NULL) || (ncmds > 0 && cmds == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+  ioctl_scratch_init(&scratch);
+  if (cmds) {
+    cmds = ioctls_canonical(cmds, &ncmds, &scratch);
+    if (cmds == NULL)
+      return -1;
+  }
+  for (ii = 0; ii < nfds; ii++) {
+    cap_rights_t primary;
+    cap_fcntl_t fcntls;
+    int prev_nioctls;
+    int rc = cap_rights_get_kernel(fds[ii], &primary, &fcntls, &prev_nioctls, NULL);
+    if (rc == 0)
+      rc = syscall(__NR_cap_rights_limit, fds[ii], &primary, fcntls, ncmds, cmds, 0);
+    cap_rights_cache_invalidate(fds[ii]);
+    result = batch_result(result, &first_errno, errors, ii, rc);
+  }
+  ioctl_scratch_free(&scratch);
+  if (result)
+    errno = first_errno;
+  return result;
+}
+
 static void cap_rights_vset(cap_rights_t *rights, va_list ap) {
   unsigned int n = CAPARSIZE(rights);
   uint64_t right;
@@ -271,16 +787,15 @@ bool _cap_rights_is_set(const cap_rights_t *rights, ...) {
   return ret;
 }
 
-bool cap_rights_is_valid(const cap_rights_t *rights) {
-  cap_rights_t allrights;
+static bool cap_rights_is_valid_in(const cap_rights_t *allrights,
+                                   const cap_rights_t *rights) {
   unsigned int ii;
 
   if (CAPVER(rights) != CAP_RIGHTS_VERSION_00)
     return false;
   if (CAPARSIZE(rights) != (2 + CAPVER(rights)))
     return false;
-  CAP_SET_ALL(&allrights);
-  if (!cap_rights_contains(&allrights, rights))
+  if (!cap_rights_contains(allrights, rights))
     return false;
   for (ii = 0; ii < CAPARSIZE(rights); ii++) {
     if (CAPIDXBIT(rights->cr_rights[ii]) != (1 << ii))
@@ -291,6 +806,12 @@ bool cap_rights_is_valid(const cap_rights_t *rights) {
   return true;
 }
 
+bool cap_rights_is_valid(const cap_rights_t *rights) {
+  cap_rights_t allrights;
+  CAP_SET_ALL(&allrights);
+  return cap_rights_is_valid_in(&allrights, rights);
+}
+
 void cap_rights_merge(cap_rights_t *dst, const cap_rights_t *src) {
   unsigned int n = CAPARSIZE(dst);
   unsigned int ii;
@@ -332,3 +853,75 @@ bool cap_rights_contains(const cap_rights_t *big, const cap_rights_t *little) {
       return false;
   return true;
 }
+
+/************************************************************
+ * Bulk Rights Manipulation.
+ ************************************************************/
+
+/*
+ * These operate on arrays of rights, pairing element ii of one array with
+ * element ii of the other.  The loops do no per-element checking at all, so
+ * the compiler can turn each one into straight-line word-wise AND/OR; the
+ * caller is responsible for passing structures that cap_rights_init() or
+ * cap_rights_get() produced.  Building with CAP_RIGHTS_DEBUG (configure
+ * --enable-rights-debug) validates every input up front instead.
+ */
+#ifdef CAP_RIGHTS_DEBUG
+#define assert_rights_valid_many(rights, n) assert(cap_rights_is_valid_many((rights), (n)))
+#else
+#define assert_rights_valid_many(rights, n) do { } while (0)
+#endif
+
+bool cap_rights_is_valid_many(const cap_rights_t *rights, size_t n) {
+  cap_rights_t allrights;
+  size_t ii;
+
+  CAP_SET_ALL(&allrights);
+  for (ii = 0; ii < n; ii++)
+    if (!cap_rights_is_valid_in(&allrights, &rights[ii]))
+      return false;
+  return true;
+}
+
+size_t cap_rights_contains_many(const cap_rights_t *restrict big,
+                                const cap_rights_t *restrict little,
+                                size_t n, bool *restrict results) {
+  size_t count = 0;
+  size_t ii;
+  assert_rights_valid_many(big, n);
+  assert_rights_valid_many(little, n);
+
+  for (ii = 0; ii < n; ii++) {
+    uint64_t missing = (little[ii].cr_rights[0] & ~big[ii].cr_rights[0]) |
+                       (little[ii].cr_rights[1] & ~big[ii].cr_rights[1]);
+    bool contained = (missing == 0);
+    if (results)
+      results[ii] = contained;
+    count += contained;
+  }
+  return count;
+}
+
+void cap_rights_merge_many(cap_rights_t *restrict dst,
+                           const cap_rights_t *restrict src, size_t n) {
+  size_t ii;
+  assert_rights_valid_many(dst, n);
+  assert_rights_valid_many(src, n);
+
+  for (ii = 0; ii < n; ii++) {
+    dst[ii].cr_rights[0] |= src[ii].cr_rights[0];
+    dst[ii].cr_rights[1] |= src[ii].cr_rights[1];
+  }
+}
+
+void cap_rights_remove_many(cap_rights_t *restrict dst,
+                            const cap_rights_t *restrict src, size_t n) {
+  size_t ii;
+  assert_rights_valid_many(dst, n);
+  assert_rights_valid_many(src, n);
+
+  for (ii = 0; ii < n; ii++) {
+    dst[ii].cr_rights[0] &= ~(src[ii].cr_rights[0] & 0x01FFFFFFFFFFFFFFULL);
+    dst[ii].cr_rights[1] &= ~(src[ii].cr_rights[1] & 0x01FFFFFFFFFFFFFFULL);
+  }
+}
@@ -16,6 +16,14 @@ typedef unsigned int cap_fcntl_t;
 /* ioctl(2) and cap_rights_limit(2) take unsigned int for ioctl cmds. */
 typedef unsigned int cap_ioctl_t;
 
+/* Flags for cap_enter_ex(). */
+#define CAP_ENTER_ALLOW		0x01  /* Only allow the listed syscalls */
+#define CAP_ENTER_DENY		0x02  /* Refuse the listed syscalls */
+#define CAP_ENTER_PREPARE	0x04  /* Build the filter but don't enter capability mode */
+#define CAP_ENTER_IO_URING	0x08  /* Allow io_uring_enter(2) on cap_io_uring_setup() rings */
+
+struct io_uring_params;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,6 +32,10 @@ extern "C" {
  * Capsicum System Calls.
  ************************************************************/
 int cap_enter(void);
+int cap_enter_ex(int flags, const unsigned int *syscalls, size_t nsyscalls);
+int cap_io_uring_setup(unsigned int entries, struct io_uring_params *params,
+		       const unsigned char *opcodes, size_t nopcodes,
+		       const int *fds, unsigned int nfds);
 int cap_getmode(unsigned int *mode);
 bool cap_sandboxed(void);
 int cap_rights_limit(int fd, const cap_rights_t *rights);
@@ -32,6 +44,30 @@ int cap_fcntls_limit(int fd, cap_fcntl_t fcntls);
 int cap_fcntls_get(int fd, cap_fcntl_t *fcntlsp);
 int cap_ioctls_limit(int fd, const cap_ioctl_t *cmds, size_t ncmds);
 ssize_t cap_ioctls_get(int fd, cap_ioctl_t *cmds, size_t maxcmds);
+/* 1 if ioctl cmd is allowed on fd, 0 if not, -1 (with errno) on error. */
+int cap_ioctls_allowed(int fd, cap_ioctl_t cmd);
+
+/*
+ * Batch versions, which apply the same limits to each of fds[0..nfds).  All
+ * descriptors are tried; the result is -1 (with errno from the first failure)
+ * if any failed, and errors[] (if non-NULL) gets each one's errno, or 0.
+ */
+int cap_rights_limit_many(const int *fds, size_t nfds,
+                          const cap_rights_t *rights, int *errors);
+int cap_fcntls_limit_many(const int *fds, size_t nfds,
+                          cap_fcntl_t fcntls, int *errors);
+int cap_ioctls_limit_many(const int *fds, size_t nfds,
+                          const cap_ioctl_t *cmds, size_t ncmds, int *errors);
+
+/*
+ * Opt-in, per-process cache of descriptor rights, so that the get calls
+ * above avoid the kernel once a descriptor has been seen.  Limits applied
+ * through this library keep it up to date; when a descriptor number is
+ * closed or reused (close, dup2, receiving over a socket), report it with
+ * cap_rights_cache_invalidate(fd), or pass -1 to forget every descriptor.
+ */
+void cap_rights_cache_enable(bool enable);
+void cap_rights_cache_invalidate(int fd);
 
 /************************************************************
  * Capsicum Rights Manipulation Functions.
@@ -60,6 +96,19 @@ void cap_rights_merge(cap_rights_t *dst, const cap_rights_t *src);
 void cap_rights_remove(cap_rights_t *dst, const cap_rights_t *src);
 bool cap_rights_contains(const cap_rights_t *big, const cap_rights_t *little);
 
+/*
+ * Element-wise versions of the above over arrays of n structures, for
+ * evaluating large tables of rights.  These skip per-element validation;
+ * cap_rights_is_valid_many() checks a whole array at once.
+ * cap_rights_contains_many() stores each result in results[] (if non-NULL)
+ * and returns the number of elements where big[ii] contains little[ii].
+ */
+bool cap_rights_is_valid_many(const cap_rights_t *rights, size_t n);
+size_t cap_rights_contains_many(const cap_rights_t *big, const cap_rights_t *little,
+                                size_t n, bool *results);
+void cap_rights_merge_many(cap_rights_t *dst, const cap_rights_t *src, size_t n);
+void cap_rights_remove_many(cap_rights_t *dst, const cap_rights_t *src, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
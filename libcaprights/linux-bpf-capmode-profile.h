@@ -0,0 +1,81 @@
+/*
+ * Syscall profile for the capability mode filter: relative frequencies of the
+ * most common syscalls, used to put them nearer the root of the search tree.
+ *
+ * This default is a hand-written estimate, not a recording: it guesses at
+ * the mix of an event-driven network service, where the event loop
+ * (epoll_wait, recvmsg, sendmsg and friends) dominates.  To replace it with
+ * a profile recorded from a real workload:
+ *   strace -f -o workload.trace <command>     (or strace -c -o ...)
+ *   ./capmode-profile -p workload.trace > linux-bpf-capmode-profile.h
+ *
+ * Entries for syscalls that this architecture lacks are skipped.
+ */
+static const struct capmode_weight capmode_weights[] = {
+#ifdef __NR_epoll_wait
+	SYSCALL_WEIGHT(epoll_wait, 2400),
+#endif
+#ifdef __NR_recvmsg
+	SYSCALL_WEIGHT(recvmsg, 2100),
+#endif
+#ifdef __NR_sendmsg
+	SYSCALL_WEIGHT(sendmsg, 1900),
+#endif
+#ifdef __NR_futex
+	SYSCALL_WEIGHT(futex, 900),
+#endif
+#ifdef __NR_read
+	SYSCALL_WEIGHT(read, 700),
+#endif
+#ifdef __NR_write
+	SYSCALL_WEIGHT(write, 650),
+#endif
+#ifdef __NR_epoll_ctl
+	SYSCALL_WEIGHT(epoll_ctl, 450),
+#endif
+#ifdef __NR_epoll_pwait
+	SYSCALL_WEIGHT(epoll_pwait, 400),
+#endif
+#ifdef __NR_recvfrom
+	SYSCALL_WEIGHT(recvfrom, 300),
+#endif
+#ifdef __NR_sendto
+	SYSCALL_WEIGHT(sendto, 300),
+#endif
+#ifdef __NR_writev
+	SYSCALL_WEIGHT(writev, 250),
+#endif
+#ifdef __NR_poll
+	SYSCALL_WEIGHT(poll, 200),
+#endif
+#ifdef __NR_close
+	SYSCALL_WEIGHT(close, 120),
+#endif
+#ifdef __NR_accept4
+	SYSCALL_WEIGHT(accept4, 100),
+#endif
+#ifdef __NR_readv
+	SYSCALL_WEIGHT(readv, 80),
+#endif
+#ifdef __NR_madvise
+	SYSCALL_WEIGHT(madvise, 60),
+#endif
+#ifdef __NR_mmap
+	SYSCALL_WEIGHT(mmap, 50),
+#endif
+#ifdef __NR_munmap
+	SYSCALL_WEIGHT(munmap, 50),
+#endif
+#ifdef __NR_rt_sigprocmask
+	SYSCALL_WEIGHT(rt_sigprocmask, 40),
+#endif
+#ifdef __NR_fstat
+	SYSCALL_WEIGHT(fstat, 30),
+#endif
+#ifdef __NR_getpid
+	SYSCALL_WEIGHT(getpid, 20),
+#endif
+#ifdef __NR_sched_yield
+	SYSCALL_WEIGHT(sched_yield, 20),
+#endif
+};
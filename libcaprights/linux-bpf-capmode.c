@@ -5,6 +5,8 @@
 #include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -17,6 +19,9 @@
 #include <linux/audit.h>
 #include <linux/fcntl.h>
 #include <linux/filter.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
 #include <linux/net.h>
 #include <linux/seccomp.h>
 #include <linux/unistd.h>
@@ -31,6 +36,7 @@
 #ifdef HAVE_ASM_UNISTD_32_IA32_H
 #include <asm/unistd_32_ia32.h>  /* defines __NR_ia32_<name> values */
 #endif
+#include "capsicum.h"
 
 /* Macros for BPF generation */
 
@@ -59,16 +65,34 @@
 	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args) + n * sizeof(__u64)))
 #endif
 
+/*
+ * Capability mode is described by a table of rules, one per allowed syscall.
+ * A rule either allows the syscall outright, or gives a BPF fragment that
+ * examines the syscall arguments and returns a verdict.  The table is compiled
+ * into a BPF program at startup (see gen_capmode() below).
+ */
+struct capmode_rule {
+	unsigned int nr;  /* syscall number, with SYSCALL_NUM_MASK applied */
+	const struct sock_filter *check;  /* NULL => always allow */
+	unsigned int check_len;
+};
+
 #define ALLOW	\
 	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
 #define ALLOW_SYSCALL_NUM(num)	\
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, (num & SYSCALL_NUM_MASK), 0, 1),	\
-	ALLOW
+	{ ((num) & SYSCALL_NUM_MASK), NULL, 0 }
 #define ALLOW_SYSCALL(name)		ALLOW_SYSCALL_NUM(SYSCALL_NUM(name))
 #define SYSCALL_X32_NUM(name)		(__NR_x32_##name & SYSCALL_NUM_MASK)
 #define ALLOW_X32_SYSCALL(name)	ALLOW_SYSCALL_NUM(SYSCALL_X32_NUM(name))
+#define CHECK_SYSCALL_NUM(num, ...)					\
+	{ ((num) & SYSCALL_NUM_MASK),					\
+	  (const struct sock_filter[]){ __VA_ARGS__ },			\
+	  sizeof((const struct sock_filter[]){ __VA_ARGS__ }) / sizeof(struct sock_filter) }
+#define CHECK_SYSCALL(name, ...)	CHECK_SYSCALL_NUM(SYSCALL_NUM(name), __VA_ARGS__)
 #define FAIL_ECAPMODE	\
 	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO | (ECAPMODE & 0xFFFF))
+#define KILL	\
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_KILL)
 
 #ifdef SECCOMP_DATA_TID_PRESENT
 /* Build environment includes .tgid and .tid fields in seccomp_data */
@@ -86,29 +110,28 @@
 	EXAMINE_ARG(n),  /* dfd */				\
 	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, AT_FDCWD, 0, 1),	\
 	FAIL_ECAPMODE
-#define FAIL_AT_FDCWD_COUNT 3
 
 #define ALLOW_AT_SYSCALL_NUM(num, arg)					\
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, (num & SYSCALL_NUM_MASK), 0, 1+FAIL_AT_FDCWD_COUNT),	\
-	FAIL_AT_FDCWD(arg),					\
-	ALLOW
+	CHECK_SYSCALL_NUM(num,						\
+		FAIL_AT_FDCWD(arg),					\
+		ALLOW)
 #define ALLOW_AT_SYSCALL_ARG(name, arg)	ALLOW_AT_SYSCALL_NUM(SYSCALL_NUM(name), arg)
 #define ALLOW_AT_SYSCALL(name)			ALLOW_AT_SYSCALL_NUM(SYSCALL_NUM(name), 0)
 #define ALLOW_X32_AT_SYSCALL(name)		ALLOW_AT_SYSCALL_NUM(SYSCALL_X32_NUM(name), 0)
 #define ALLOW_2AT_SYSCALL_NUM(num, arg1, arg2)				\
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, (num & SYSCALL_NUM_MASK), 0, 1+FAIL_AT_FDCWD_COUNT+FAIL_AT_FDCWD_COUNT),	\
-	FAIL_AT_FDCWD(arg1),					\
-	FAIL_AT_FDCWD(arg2),					\
-	ALLOW
+	CHECK_SYSCALL_NUM(num,						\
+		FAIL_AT_FDCWD(arg1),					\
+		FAIL_AT_FDCWD(arg2),					\
+		ALLOW)
 #define ALLOW_AT_SYSCALL_2ARG(name, a1, a2)	ALLOW_2AT_SYSCALL_NUM(SYSCALL_NUM(name), a1, a2)
 
 /*
- * Create a filter for our base architecture by including the filter header
+ * Create rules for our base architecture by including the filter header
  * with the following macros set:
  *   - SYSCALL_NUM(name) : use constants of form __NR_<name>
  *   - SYSCALL_PREFIX : use 0 to indicate no prefix
  *   - SYSCALL_ARCH : current build architecture
- *   - SYSCALL_FILTER : capmode_filter
+ *   - SYSCALL_RULES : capmode_rules
  */
 #if defined(__i386__)
 #define BASE_ARCH	AUDIT_ARCH_I386
@@ -121,19 +144,19 @@
 
 /*
  * Provide definition of:
- *   static struct sock_filter capmode_filter[];
+ *   static const struct capmode_rule capmode_rules[];
  */
 #define SYSCALL_ARCH		BASE_ARCH
 #define SYSCALL_NUM(name)	(__NR_##name & SYSCALL_NUM_MASK)
 #define SYSCALL_PREFIX		0
-#define SYSCALL_FILTER		capmode_filter
+#define SYSCALL_RULES		capmode_rules
 #include "linux-bpf-capmode.h"
 #undef SYSCALL_ARCH
 #undef SYSCALL_NUM
 #undef SYSCALL_PREFIX
-#undef SYSCALL_FILTER
+#undef SYSCALL_RULES
 
-/* Now see if we can build a filter for the alternate architecture. */
+/* Now see if we can build rules for the alternate architecture. */
 
 #if defined(__i386__)
 /* Building on 32-bit, see if we have definitions for amd64 syscall numbers */
@@ -155,77 +178,693 @@
 
 #ifdef HAVE_ALTFILTER
 /*
- * Create a filter for our alternate architecture by including the filter header
+ * Create rules for our alternate architecture by including the filter header
  * with the following macros set:
  *      build arch:             amd64                       i386
  *  SYSCALL_NUM(name)      __NR_ia32_<name>            __NR_amd64_<name>
  *  SYSCALL_PREFIX             2 (=>ia32)                  1 (=>amd64)
  *  SYSCALL_ARCH            AUDIT_ARCH_I386            AUDIT_ARCH_X86_64
- *  SYSCALL_FILTER          capmode_altfilter          capmode_altfilter
+ *  SYSCALL_RULES           capmode_altrules           capmode_altrules
  */
 
 /*
  * Provide definition of:
- *   static struct sock_filter capmode_altfilter[];
+ *   static const struct capmode_rule capmode_altrules[];
  */
 #define SYSCALL_ARCH		ALT_ARCH
-#define SYSCALL_FILTER		capmode_altfilter
+#define SYSCALL_RULES		capmode_altrules
 #include "linux-bpf-capmode.h"
 #undef SYSCALL_ARCH
 #undef SYSCALL_NUM
 #undef SYSCALL_PREFIX
-#undef SYSCALL_FILTER
+#undef SYSCALL_RULES
 #endif
 
-#ifdef HAVE_ALTFILTER
-/* With two possible architectures in play, need to select appropriately. */
-static struct sock_filter capmode_combifilter[3+COUNT_OF(capmode_filter)+COUNT_OF(capmode_altfilter)] = {
-	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, arch)), /* load arch */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, BASE_ARCH, 1, 0),
-	BPF_JUMP(BPF_JMP+BPF_JA, COUNT_OF(capmode_filter), 0, 0),
-	/* capmode_filter contents */
-	/* capmode_altfilter contents */
+/*
+ * Relative frequencies of syscalls on the base architecture, estimated or
+ * recorded from a workload (see capmode-profile -p).  These only shape the
+ * search tree (frequent syscalls are found with fewer instructions); they
+ * never change a verdict.
+ */
+struct capmode_weight {
+	unsigned int nr;  /* syscall number, with SYSCALL_NUM_MASK applied */
+	unsigned int weight;  /* relative frequency */
+};
+
+#define SYSCALL_WEIGHT(name, count)	{ (__NR_##name & SYSCALL_NUM_MASK), (count) }
+
+/*
+ * Provide definition of:
+ *   static const struct capmode_weight capmode_weights[];
+ */
+#include "linux-bpf-capmode-profile.h"
+
+/*
+ * BPF program generation.
+ *
+ * Rather than testing each rule in turn, the generated program does a binary
+ * search on the syscall number, so the cost per syscall grows with log(rules).
+ * The syscall number space is split into ranges that share a verdict (allow,
+ * fail, or a particular argument check), and each node of the search tree
+ * compares against a range boundary with BPF_JGE.  Identical argument checks
+ * are emitted once.
+ *
+ * The tree is weight-balanced rather than height-balanced: each range is
+ * weighted by how often its syscalls are made (from capmode_weights[]), so
+ * hot syscalls sit near the root.  Every range also gets an equal share of
+ * the weight, which bounds how much deeper the rarely used ones can end up.
+ *
+ * The path from the start of the program to any verdict for a syscall number
+ * only loads seccomp_data.arch and .nr, masks with BPF_AND and compares with
+ * BPF_K jumps; only argument-check leaves look at .args.  The kernel's seccomp
+ * action cache (seccomp_is_const_allow()) can emulate exactly these
+ * instructions, so every syscall that a rule allows outright goes into its
+ * always-allow bitmap and never runs the filter.  Keep it that way: anything
+ * else in the prologue or the search tree (loading .args or
+ * .instruction_pointer, BPF_X operands, scratch memory) would disable the
+ * cache for every syscall.
+ *
+ * Code is emitted back to front, so every jump target is already in place
+ * when the jump is generated.  Conditional jumps only have 8-bit offsets;
+ * more distant targets are reached through a copy of the target (if it is a
+ * return) or a BPF_JA trampoline.
+ */
+struct bpf_gen {
+	struct sock_filter *insns;
+	unsigned int size;  /* capacity of insns[] */
+	unsigned int head;  /* code emitted so far is insns[head..size) */
+	int error;  /* errno value for first failure, or 0 */
 };
+
+struct bpf_gen_range {
+	unsigned int lo;  /* first syscall number in range */
+	unsigned int target;  /* index of instruction handling the range */
+	unsigned long long weight;  /* how often the range is expected to be hit */
+};
+
+/* Emit one instruction before all others, and return its index. */
+static unsigned int gen_insn(struct bpf_gen *gen, struct sock_filter insn) {
+	if (gen->head == 0) {
+		if (!gen->error)
+			gen->error = E2BIG;
+		return 0;
+	}
+	gen->insns[--gen->head] = insn;
+	return gen->head;
+}
+
+/*
+ * Return an instruction equivalent to target that is within range
+ * instructions of the next instruction to be emitted.
+ */
+static unsigned int gen_near(struct bpf_gen *gen, unsigned int target,
+			     unsigned int range) {
+	struct sock_filter insn = gen->insns[target];
+	if (target - gen->head <= range)
+		return target;
+	if (BPF_CLASS(insn.code) == BPF_RET)
+		return gen_insn(gen, insn);
+	return gen_insn(gen, (struct sock_filter)
+			BPF_JUMP(BPF_JMP+BPF_JA, target - gen->head, 0, 0));
+}
+
+/* Emit a conditional jump on A, unless both branches go the same way. */
+static unsigned int gen_jump(struct bpf_gen *gen, unsigned int op, unsigned int k,
+			     unsigned int jt, unsigned int jf) {
+	struct sock_filter insn = BPF_JUMP(BPF_JMP+op+BPF_K, k, 0, 0);
+	if (jt == jf)
+		return jt;
+	/* Leave room for a trampoline to jt after any trampoline to jf */
+	jf = gen_near(gen, jf, 254);
+	jt = gen_near(gen, jt, 255);
+	insn.jt = jt - gen->head;
+	insn.jf = jf - gen->head;
+	return gen_insn(gen, insn);
+}
+
+/* Emit a self-contained fragment of code, which must end in a return. */
+static unsigned int gen_block(struct bpf_gen *gen, const struct sock_filter *insns,
+			      unsigned int len) {
+	unsigned int ii;
+	for (ii = 0; ii < len; ii++) {
+		const struct sock_filter *insn = &insns[ii];
+		unsigned int remaining = len - ii - 1;
+		if (BPF_CLASS(insn->code) != BPF_JMP)
+			continue;
+		if ((BPF_OP(insn->code) == BPF_JA) ? insn->k >= remaining :
+		    (insn->jt >= remaining || insn->jf >= remaining))
+			gen->error = EINVAL;
+	}
+	if (len == 0 || BPF_CLASS(insns[len - 1].code) != BPF_RET)
+		gen->error = EINVAL;
+	for (ii = len; ii > 0; ii--)
+		gen_insn(gen, insns[ii - 1]);
+	return gen->head;
+}
+
+/* Emit a search tree that dispatches A to the targets of ranges[0..n). */
+static unsigned int gen_search(struct bpf_gen *gen,
+			       const struct bpf_gen_range *ranges, unsigned int n) {
+	unsigned long long total = 0, below = 0;
+	unsigned int mid, left, right;
+	if (n == 1)
+		return ranges[0].target;
+
+	/* Split where the weights on either side are closest to equal. */
+	for (mid = 0; mid < n; mid++)
+		total += ranges[mid].weight;
+	below = ranges[0].weight;
+	for (mid = 1; mid < n - 1; mid++) {
+		unsigned long long next = below + ranges[mid].weight;
+		if ((2 * next > total ? 2 * next - total : total - 2 * next) >=
+		    (2 * below > total ? 2 * below - total : total - 2 * below))
+			break;
+		below = next;
+	}
+	right = gen_search(gen, ranges + mid, n - mid);
+	left = gen_search(gen, ranges, mid);
+	return gen_jump(gen, BPF_JGE, ranges[mid].lo, right, left);
+}
+
+static void gen_add_range(struct bpf_gen_range *ranges, unsigned int *n,
+			  unsigned int lo, unsigned int target) {
+	if (*n > 0 && ranges[*n - 1].target == target)
+		return;
+	ranges[*n].lo = lo;
+	ranges[*n].target = target;
+	ranges[*n].weight = 0;
+	(*n)++;
+}
+
+/*
+ * Weight each of ranges[0..n) by the profile: every range gets an equal share
+ * of the total, and then its own syscalls' share on top.
+ */
+static void gen_weigh_ranges(struct bpf_gen_range *ranges, unsigned int n,
+			     const struct capmode_weight *weights, unsigned int nweights) {
+	unsigned long long total = 0;
+	unsigned int ii, lo, hi;
+
+	for (ii = 0; ii < nweights; ii++)
+		total += weights[ii].weight;
+	for (ii = 0; ii < n; ii++)
+		ranges[ii].weight = (total > 0) ? total : 1;
+	for (ii = 0; ii < nweights; ii++) {
+		/* Find the last range starting at or below the syscall number */
+		lo = 0;
+		hi = n;
+		while (hi - lo > 1) {
+			unsigned int mid = (lo + hi) / 2;
+			if (ranges[mid].lo <= weights[ii].nr)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		ranges[lo].weight += (unsigned long long)weights[ii].weight * n;
+	}
+}
+
+/*
+ * Emit code that checks the (masked) syscall number in A against the given
+ * rules, and return its entry point.
+ */
+static unsigned int gen_rules(struct bpf_gen *gen, const struct capmode_rule *rules,
+			      unsigned int nrules,
+			      const struct capmode_weight *weights, unsigned int nweights) {
+	/* nrules may be zero, for an architecture where every syscall fails */
+	unsigned int *order = malloc((nrules + 1) * sizeof(*order));
+	unsigned int *target = malloc((nrules + 1) * sizeof(*target));
+	struct bpf_gen_range *ranges = malloc((2 * nrules + 1) * sizeof(*ranges));
+	unsigned int nranges = 0;
+	unsigned int next = 0;
+	unsigned int allow, deny, root;
+	unsigned int ii, jj;
+
+	if (order == NULL || target == NULL || ranges == NULL) {
+		gen->error = ENOMEM;
+		root = gen->head;
+		goto done;
+	}
+
+	/* Argument checks go last, after the search tree and its verdicts. */
+	for (ii = nrules; ii > 0; ii--) {
+		const struct capmode_rule *rule = &rules[ii - 1];
+		if (rule->check == NULL)
+			continue;
+		for (jj = ii; jj < nrules; jj++) {
+			if (rules[jj].check != NULL &&
+			    rules[jj].check_len == rule->check_len &&
+			    memcmp(rules[jj].check, rule->check,
+				   rule->check_len * sizeof(struct sock_filter)) == 0)
+				break;
+		}
+		if (jj < nrules)
+			target[ii - 1] = target[jj];
+		else
+			target[ii - 1] = gen_block(gen, rule->check, rule->check_len);
+	}
+	deny = gen_insn(gen, (struct sock_filter)FAIL_ECAPMODE);
+	allow = gen_insn(gen, (struct sock_filter)ALLOW);
+
+	/* Stable sort by syscall number; the first rule for a syscall wins. */
+	for (ii = 0; ii < nrules; ii++) {
+		for (jj = ii; jj > 0 && rules[order[jj - 1]].nr > rules[ii].nr; jj--)
+			order[jj] = order[jj - 1];
+		order[jj] = ii;
+	}
+	for (ii = 0; ii < nrules; ii++) {
+		const struct capmode_rule *rule = &rules[order[ii]];
+		if (ii > 0 && rule->nr == rules[order[ii - 1]].nr)
+			continue;
+		if (rule->nr > next)
+			gen_add_range(ranges, &nranges, next, deny);
+		gen_add_range(ranges, &nranges, rule->nr,
+			      rule->check ? target[order[ii]] : allow);
+		next = rule->nr + 1;
+	}
+	if (nranges == 0 || next != 0)
+		gen_add_range(ranges, &nranges, next, deny);
+	gen_weigh_ranges(ranges, nranges, weights, nweights);
+
+	root = gen_search(gen, ranges, nranges);
+done:
+	free(order);
+	free(target);
+	free(ranges);
+	return root;
+}
+
+/* Emit code for one architecture: load the syscall number and check it. */
+static unsigned int gen_arch(struct bpf_gen *gen, const struct capmode_rule *rules,
+			     unsigned int nrules,
+			     const struct capmode_weight *weights, unsigned int nweights) {
+	gen_near(gen, gen_rules(gen, rules, nrules, weights, nweights), 0);
+	gen_insn(gen, (struct sock_filter)
+		 BPF_STMT(BPF_ALU+BPF_AND+BPF_K, SYSCALL_NUM_MASK)); /* mask off x32 bit if present */
+	return gen_insn(gen, (struct sock_filter)
+			BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr)));
+}
+
+/*
+ * Generate a capability mode program into gen, returning 0 or an errno value.
+ * Syscalls for the alternate architecture (if any) are checked against
+ * altrules[0..naltrules), or kill the process if altrules is NULL, as do
+ * those for any other architecture.  The syscall profile only covers the
+ * base architecture.
+ */
+static int gen_capmode(struct bpf_gen *gen,
+		       const struct capmode_rule *rules, unsigned int nrules,
+		       const struct capmode_rule *altrules, unsigned int naltrules) {
+	unsigned int kill = gen_insn(gen, (struct sock_filter)KILL);
+	unsigned int dispatch = kill;
+	unsigned int alt = kill;
+	unsigned int base;
+#ifdef ALT_ARCH
+	/* With two possible architectures in play, need to select appropriately. */
+	if (altrules != NULL)
+		alt = gen_arch(gen, altrules, naltrules, NULL, 0);
+#endif
+	base = gen_arch(gen, rules, nrules,
+			capmode_weights, COUNT_OF(capmode_weights));
+#ifdef ALT_ARCH
+	dispatch = gen_jump(gen, BPF_JEQ, ALT_ARCH, alt, kill);  /* kill if no rules */
+#endif
+	dispatch = gen_jump(gen, BPF_JEQ, BASE_ARCH, base, dispatch);
+	gen_near(gen, dispatch, 0);
+	gen_insn(gen, (struct sock_filter)
+		 BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, arch))); /* load arch */
+	return gen->error;
+}
+
+static struct sock_filter capmode_insns[BPF_MAXINSNS];
+static struct sock_fprog capmode_fprog;
+static int capmode_error;
+
 static void __attribute__((constructor)) _filter_init(void) {
-	int ii;
-	int offset = 3;
-	for (ii = 0; ii < COUNT_OF(capmode_filter); ii++)
-		capmode_combifilter[offset + ii] = capmode_filter[ii];
-	offset += COUNT_OF(capmode_filter);
-	for (ii = 0; ii < COUNT_OF(capmode_altfilter); ii++)
-		capmode_combifilter[offset + ii] = capmode_altfilter[ii];
+	struct bpf_gen gen = {capmode_insns, COUNT_OF(capmode_insns),
+			      COUNT_OF(capmode_insns), 0};
+#ifdef HAVE_ALTFILTER
+	capmode_error = gen_capmode(&gen, capmode_rules, COUNT_OF(capmode_rules),
+				    capmode_altrules, COUNT_OF(capmode_altrules));
+#else
+	/* No rules for the alternate architecture, so its syscalls are fatal */
+	capmode_error = gen_capmode(&gen, capmode_rules, COUNT_OF(capmode_rules),
+				    NULL, 0);
+#endif
+	if (capmode_error)
+		return;
+	capmode_fprog.len = gen.size - gen.head;
+	capmode_fprog.filter = capmode_insns + gen.head;
+}
+
+/*
+ * io_uring rings set up by cap_io_uring_setup().  Seccomp cannot see the
+ * operations submitted through a ring, so io_uring_enter(2) is only safe on
+ * a ring whose opcodes and files have been restricted; capability mode with
+ * CAP_ENTER_IO_URING allows it for the rings recorded here and no others.
+ * Slots hold fd + 1 (0 for empty), and are only ever filled.
+ */
+#define CAPMODE_RINGS_MAX	8
+static int capmode_rings[CAPMODE_RINGS_MAX];
+static unsigned int capmode_nrings;
+
+#if defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_REGISTER_RESTRICTIONS
+static int io_uring_register_(int ring, unsigned int opcode, const void *arg,
+			      unsigned int nargs) {
+	return syscall(__NR_io_uring_register, ring, opcode, arg, nargs);
+}
+
+/*
+ * Check that a recorded ring number still holds a restricted ring, rather
+ * than something that reused the number after the ring was closed.  A ring
+ * from cap_io_uring_setup() allows no register opcodes, so the kernel refuses
+ * the probe with EACCES before looking at its (missing) buffer; an
+ * unrestricted ring or any other file fails differently.  Once in capability
+ * mode io_uring_register(2) itself is refused, but by then the enclosing
+ * filter already keeps the ring numbers from being reused.
+ */
+static bool capmode_ring_restricted(int ring) {
+	int saved_errno = errno;
+	bool restricted = false;
+
+	if (io_uring_register_(ring, IORING_REGISTER_PROBE, NULL, 0) < 0)
+		restricted = (errno == EACCES || errno == ECAPMODE);
+	errno = saved_errno;
+	return restricted;
 }
-static struct sock_fprog capmode_fprog = {
-	.len = (3 + COUNT_OF(capmode_filter) + COUNT_OF(capmode_altfilter)),
-	.filter = capmode_combifilter
-};
 #else
-/* If only a single arch is available, just run the base filter */
-static struct sock_fprog capmode_fprog = {
-	.len = COUNT_OF(capmode_filter),
-	.filter = capmode_filter
+static bool capmode_ring_restricted(int ring) {
+	return false;
+}
+#endif
+
+/*
+ * Programs built by cap_enter_ex(), kept so that later calls with the same
+ * syscall set (typically in forked children) skip the compilation.  Entries
+ * are never modified or freed once published, so lookups need no locking.
+ */
+struct capmode_prog {
+	struct capmode_prog *next;
+	int flags;  /* CAP_ENTER_ALLOW, CAP_ENTER_DENY or 0, plus CAP_ENTER_IO_URING */
+	unsigned int *syscalls;  /* masked, sorted and deduplicated */
+	size_t nsyscalls;
+	int rings[CAPMODE_RINGS_MAX];  /* sorted, if CAP_ENTER_IO_URING */
+	unsigned int nrings;
+	struct sock_fprog fprog;
 };
+#define CAPMODE_PROGS_MAX	8
+static struct capmode_prog *capmode_progs;
+
+static int compare_nr(const void *a, const void *b) {
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+static void capmode_prog_free(struct capmode_prog *prog) {
+	free(prog->syscalls);
+	free(prog->fprog.filter);
+	free(prog);
+}
+
+/*
+ * Start a program for the given syscall set, with the set normalized so that
+ * equivalent sets give identical programs.
+ */
+static struct capmode_prog *capmode_prog_new(int flags,
+					     const unsigned int *syscalls,
+					     size_t nsyscalls) {
+	struct capmode_prog *prog = calloc(1, sizeof(*prog));
+	size_t ii, nn = 0;
+
+	if (prog == NULL)
+		return NULL;
+	prog->flags = flags;
+	prog->syscalls = malloc((nsyscalls + 1) * sizeof(*prog->syscalls));
+	if (prog->syscalls == NULL) {
+		free(prog);
+		return NULL;
+	}
+	for (ii = 0; ii < nsyscalls; ii++)
+		prog->syscalls[ii] = syscalls[ii] & SYSCALL_NUM_MASK;
+	qsort(prog->syscalls, nsyscalls, sizeof(*prog->syscalls), compare_nr);
+	for (ii = 0; ii < nsyscalls; ii++) {
+		if (nn == 0 || prog->syscalls[ii] != prog->syscalls[nn - 1])
+			prog->syscalls[nn++] = prog->syscalls[ii];
+	}
+	prog->nsyscalls = nn;
+	if (flags & CAP_ENTER_IO_URING) {
+		unsigned int count = __atomic_load_n(&capmode_nrings, __ATOMIC_ACQUIRE);
+		for (ii = 0; ii < count && ii < CAPMODE_RINGS_MAX; ii++) {
+			int ring = __atomic_load_n(&capmode_rings[ii], __ATOMIC_ACQUIRE);
+			if (ring > 0 && capmode_ring_restricted(ring - 1))
+				prog->rings[prog->nrings++] = ring - 1;
+		}
+		qsort(prog->rings, prog->nrings, sizeof(*prog->rings), compare_nr);
+	}
+	return prog;
+}
+
+/*
+ * Syscalls that cap_enter_ex() keeps whatever the caller's set says, as
+ * without them a process could neither exit nor return from a signal handler.
+ */
+static const unsigned int capmode_essential[] = {
+	__NR_exit & SYSCALL_NUM_MASK,
+	__NR_exit_group & SYSCALL_NUM_MASK,
+	__NR_rt_sigreturn & SYSCALL_NUM_MASK,
+#ifdef __NR_sigreturn
+	__NR_sigreturn & SYSCALL_NUM_MASK,
+#endif
+#ifdef __NR_x32_rt_sigreturn
+	__NR_x32_rt_sigreturn & SYSCALL_NUM_MASK,
 #endif
+};
 
-#ifdef UNUSED
-static void print_filter(struct sock_fprog *bpf) {
-	int pc;
-	printf(" line  OP   JT   JF   K\n");
-	printf("=================================\n");
-	for (pc = 0; pc < bpf->len; pc++) {
-		struct sock_filter *filter = &(bpf->filter[pc]);
-		printf(" %04d: 0x%02x 0x%02x 0x%02x 0x%08x\n",
-			pc, filter->code, filter->jt, filter->jf, filter->k);
+static bool capmode_is_essential(unsigned int nr) {
+	unsigned int ii;
+	for (ii = 0; ii < COUNT_OF(capmode_essential); ii++) {
+		if (capmode_essential[ii] == nr)
+			return true;
 	}
+	return false;
 }
+
+#ifdef __NR_io_uring_enter
+/*
+ * Fill in a check on an fd argument, giving ALLOW if it is one of the
+ * program's rings and FAIL_ECAPMODE if not (or the other way round if
+ * !is_ring), and return its length.
+ */
+static unsigned int ring_check(struct sock_filter *check,
+			       const struct capmode_prog *prog,
+			       unsigned int arg, bool is_ring) {
+	unsigned int ii;
+
+	check[0] = (struct sock_filter)EXAMINE_ARG(arg);
+	for (ii = 0; ii < prog->nrings; ii++)
+		check[ii + 1] = (struct sock_filter)
+			BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, prog->rings[ii],
+				 prog->nrings - ii, 0);
+	if (is_ring) {
+		check[ii + 1] = (struct sock_filter)FAIL_ECAPMODE;
+		check[ii + 2] = (struct sock_filter)ALLOW;
+	} else {
+		check[ii + 1] = (struct sock_filter)ALLOW;
+		check[ii + 2] = (struct sock_filter)FAIL_ECAPMODE;
+	}
+	return prog->nrings + 3;
+}
+#endif
+
+/*
+ * Compile the base capability mode rules, restricted by the program's syscall
+ * set, returning 0 or an errno value.  The caller's syscall numbers only
+ * describe the base architecture, so syscalls for the alternate architecture
+ * kill the process, as they do under cap_enter() when there are no rules for
+ * it.
+ */
+static int capmode_prog_build(struct capmode_prog *prog) {
+	int mode = prog->flags & (CAP_ENTER_ALLOW|CAP_ENTER_DENY);
+	struct capmode_rule *rules = malloc(sizeof(capmode_rules) + sizeof(*rules));
+	struct sock_filter *insns = malloc(BPF_MAXINSNS * sizeof(*insns));
+	struct bpf_gen gen = {insns, BPF_MAXINSNS, BPF_MAXINSNS, 0};
+#ifdef __NR_io_uring_enter
+	/* io_uring_enter(2) check: the ring fd must be one of prog->rings */
+	struct sock_filter enter_check[CAPMODE_RINGS_MAX + 3];
+	/* close(2), dup2(2) and dup3(2) checks: the (new) fd must not be */
+	struct sock_filter close_check[CAPMODE_RINGS_MAX + 3];
+	struct sock_filter dup_check[CAPMODE_RINGS_MAX + 3];
+	unsigned int check_len = 0;
+#endif
+	unsigned int nrules = 0;
+	unsigned int ii;
+	int rc = ENOMEM;
+
+	if (rules == NULL || insns == NULL)
+		goto done;
+#ifdef __NR_io_uring_enter
+	if (prog->flags & CAP_ENTER_IO_URING) {
+		check_len = ring_check(enter_check, prog, 0, true);
+		ring_check(close_check, prog, 0, false);
+		ring_check(dup_check, prog, 1, false);
+	}
 #endif
+	for (ii = 0; ii < COUNT_OF(capmode_rules); ii++) {
+		struct capmode_rule rule = capmode_rules[ii];
+		bool listed = bsearch(&rule.nr, prog->syscalls,
+				      prog->nsyscalls, sizeof(*prog->syscalls),
+				      compare_nr) != NULL;
+		if (mode != 0 && listed != (mode == CAP_ENTER_ALLOW) &&
+		    !capmode_is_essential(rule.nr))
+			continue;
+#ifdef __NR_io_uring_enter
+		/*
+		 * Rings are allowed by number, so no other file may take a
+		 * ring's number: closing a ring or duplicating onto it fails,
+		 * and so does execveat(2), which would close the (close-on-exec)
+		 * rings.  The base rules for these have no checks of their own.
+		 */
+		if (prog->flags & CAP_ENTER_IO_URING) {
+			if (rule.nr == (__NR_close & SYSCALL_NUM_MASK)) {
+				rule.check = close_check;
+				rule.check_len = check_len;
+			} else if (rule.nr == (__NR_dup2 & SYSCALL_NUM_MASK) ||
+				   rule.nr == (__NR_dup3 & SYSCALL_NUM_MASK)) {
+				rule.check = dup_check;
+				rule.check_len = check_len;
+#ifdef __NR_execveat
+			} else if (rule.nr == (__NR_execveat & SYSCALL_NUM_MASK)) {
+				continue;
+#endif
+#ifdef __NR_x32_execveat
+			} else if (rule.nr == (__NR_x32_execveat & SYSCALL_NUM_MASK)) {
+				continue;
+#endif
+			}
+		}
+#endif
+		rules[nrules++] = rule;
+	}
+#ifdef __NR_io_uring_enter
+	if (prog->flags & CAP_ENTER_IO_URING) {
+		rules[nrules].nr = __NR_io_uring_enter & SYSCALL_NUM_MASK;
+		rules[nrules].check = enter_check;
+		rules[nrules].check_len = check_len;
+		nrules++;
+	}
+#endif
+	rc = gen_capmode(&gen, rules, nrules, NULL, 0);
+	if (rc)
+		goto done;
+
+	/* Keep just the generated code, which is at the end of the buffer */
+	prog->fprog.len = gen.size - gen.head;
+	prog->fprog.filter = malloc(prog->fprog.len * sizeof(*insns));
+	if (prog->fprog.filter == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
+	memcpy(prog->fprog.filter, insns + gen.head, prog->fprog.len * sizeof(*insns));
+done:
+	free(insns);
+	free(rules);
+	return rc;
+}
+
+/*
+ * Find or build the program for the given syscall set.  *cached is set if the
+ * result is owned by the cache; otherwise the caller must free it.
+ */
+static struct capmode_prog *capmode_prog_get(int flags,
+					     const unsigned int *syscalls,
+					     size_t nsyscalls, bool *cached) {
+	struct capmode_prog *head = __atomic_load_n(&capmode_progs, __ATOMIC_ACQUIRE);
+	struct capmode_prog *prog, *entry;
+	unsigned int count = 0;
+	int rc;
+
+	prog = capmode_prog_new(flags, syscalls, nsyscalls);
+	if (prog == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (entry = head; entry != NULL; entry = entry->next, count++) {
+		if (entry->flags == prog->flags &&
+		    entry->nsyscalls == prog->nsyscalls &&
+		    memcmp(entry->syscalls, prog->syscalls,
+			   prog->nsyscalls * sizeof(*prog->syscalls)) == 0 &&
+		    entry->nrings == prog->nrings &&
+		    memcmp(entry->rings, prog->rings,
+			   prog->nrings * sizeof(*prog->rings)) == 0) {
+			capmode_prog_free(prog);
+			*cached = true;
+			return entry;
+		}
+	}
+
+	rc = capmode_prog_build(prog);
+	if (rc) {
+		capmode_prog_free(prog);
+		errno = rc;
+		return NULL;
+	}
+	/* Racing builders may both add the same set; that is harmless. */
+	*cached = false;
+	if (count >= CAPMODE_PROGS_MAX)
+		return prog;
+	prog->next = head;
+	if (__atomic_compare_exchange_n(&capmode_progs, &prog->next, prog, false,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		*cached = true;
+	return prog;
+}
 
 int seccomp_(unsigned int op, unsigned int flags, struct sock_fprog *filter) {
 	errno = 0;
 	return syscall(__NR_seccomp, op, flags, filter, 0, 0, 0);
 }
 
-int cap_enter() {
+/*
+ * Set once capmode_enter() has installed a capability mode filter, so that
+ * cap_getmode() can answer without any syscalls.  Capability mode can't be
+ * left, and fork() copies both the filter and this flag, so a child's copy is
+ * right as it stands; execve() starts afresh and rechecks.  Nothing else sets
+ * it: what the kernel reports is only a heuristic (see capmode_query()), and
+ * caching a wrong guess would make it permanent.  A vfork() child shares this
+ * memory, and so must not enter capability mode before its execve() other
+ * than through cap_enter_shared().
+ */
+static bool capmode_entered;
+
+/*
+ * Ask the kernel whether this process looks to be in capability mode: any
+ * seccomp filter along with OPENAT_BENEATH.  The filter needn't be ours, so
+ * the answer is never cached.
+ */
+static int capmode_query(unsigned int *mode) {
+	int beneath;
+	int seccomp;
+
+#ifdef PR_GET_OPENAT_BENEATH
+	beneath = prctl(PR_GET_OPENAT_BENEATH, 0, 0, 0, 0);
+	if (beneath < 0) return beneath;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+
+	seccomp = prctl(PR_GET_SECCOMP, 0, 0, 0, 0);
+	if (seccomp < 0) return seccomp;
+	*mode = (seccomp == SECCOMP_MODE_FILTER && beneath == 1);
+	return 0;
+}
+
+/*
+ * Enter capability mode, with the given filter program, recording the fact
+ * in capmode_entered if record is set.
+ */
+static int capmode_enter(struct sock_fprog *fprog, bool record) {
 	int rc;
 
 	rc = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
@@ -239,27 +878,209 @@ int cap_enter() {
 	errno = ENOSYS;
 	return -1;
 #endif
-	return seccomp_(SECCOMP_SET_MODE_FILTER,
-			SECCOMP_FILTER_FLAG_TSYNC,
-			&capmode_fprog);
+	rc = seccomp_(SECCOMP_SET_MODE_FILTER,
+		      SECCOMP_FILTER_FLAG_TSYNC,
+		      fprog);
+	if (rc == 0 && record)
+		__atomic_store_n(&capmode_entered, true, __ATOMIC_RELEASE);
+	return rc;
 }
 
-int cap_getmode(unsigned int *mode) {
-	int beneath;
-	int seccomp;
+int cap_enter() {
+	if (capmode_error) {
+		/* Failed to generate the filter program */
+		errno = capmode_error;
+		return -1;
+	}
+	/*
+	 * Already in capability mode (perhaps inherited from a parent), so
+	 * this is a no-op.  Stacking another copy of the filter would run the
+	 * whole program again on every syscall, for no change in behaviour.
+	 * Only our own record counts: someone else's seccomp filter along with
+	 * OPENAT_BENEATH looks the same to capmode_query(), but isn't ours.
+	 */
+	if (__atomic_load_n(&capmode_entered, __ATOMIC_ACQUIRE))
+		return 0;
+	return capmode_enter(&capmode_fprog, true);
+}
 
-#ifdef PR_GET_OPENAT_BENEATH
-	beneath = prctl(PR_GET_OPENAT_BENEATH, 0, 0, 0, 0);
-	if (beneath < 0) return beneath;
+/*
+ * As cap_enter(), for a pdspawn() child that is still running in its
+ * parent's memory, and so mustn't mark the parent as in capability mode.
+ * It always installs the filter: capmode_entered is the parent's record
+ * (which another of the parent's threads may set after the clone), and
+ * capmode_query() can't tell our filter from anyone else's.  The caller
+ * keeps track of whether it has already entered.
+ */
+int cap_enter_shared(void) {
+	if (capmode_error) {
+		errno = capmode_error;
+		return -1;
+	}
+	return capmode_enter(&capmode_fprog, false);
+}
+
+int cap_enter_ex(int flags, const unsigned int *syscalls, size_t nsyscalls) {
+	int mode = flags & (CAP_ENTER_ALLOW|CAP_ENTER_DENY);
+	struct capmode_prog *prog;
+	bool cached;
+	int rc;
+
+	if ((flags & ~(CAP_ENTER_ALLOW|CAP_ENTER_DENY|CAP_ENTER_PREPARE|CAP_ENTER_IO_URING)) ||
+	    mode == (CAP_ENTER_ALLOW|CAP_ENTER_DENY) ||
+	    (nsyscalls > 0 && syscalls == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (mode == 0 && nsyscalls > 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (mode == 0 && !(flags & CAP_ENTER_IO_URING)) {
+		if (!(flags & CAP_ENTER_PREPARE))
+			return cap_enter();
+		if (capmode_error) {
+			errno = capmode_error;
+			return -1;
+		}
+		return 0;
+	}
+
+	prog = capmode_prog_get(flags & ~CAP_ENTER_PREPARE, syscalls, nsyscalls, &cached);
+	if (prog == NULL)
+		return -1;
+	rc = (flags & CAP_ENTER_PREPARE) ? 0 : capmode_enter(&prog->fprog, true);
+	if (!cached) {
+		int saved_errno = errno;
+		capmode_prog_free(prog);
+		errno = saved_errno;
+	}
+	return rc;
+}
+
+#if defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_REGISTER_RESTRICTIONS
+/*
+ * Operations that a restricted ring may be allowed, with the rights that each
+ * needs on the file it names.  Anything that can reach a file other than the
+ * registered ones (openat, splice's second fd, ...) or the wider system
+ * (connect, ...) is left out.  Sends can name a destination address, so like
+ * sendto(2) they need CAP_CONNECT too.
+ */
+static const struct {
+	unsigned char opcode;
+	unsigned long long rights[3];  /* 0-terminated */
+} io_uring_ops[] = {
+	{ IORING_OP_NOP, { 0 } },
+	{ IORING_OP_READV, { CAP_PREAD, 0 } },
+	{ IORING_OP_WRITEV, { CAP_PWRITE, 0 } },
+	{ IORING_OP_READ, { CAP_PREAD, 0 } },
+	{ IORING_OP_WRITE, { CAP_PWRITE, 0 } },
+	{ IORING_OP_FSYNC, { CAP_FSYNC, 0 } },
+	{ IORING_OP_POLL_ADD, { CAP_EVENT, 0 } },
+	{ IORING_OP_POLL_REMOVE, { 0 } },
+	{ IORING_OP_SENDMSG, { CAP_SEND, CAP_CONNECT, 0 } },
+	{ IORING_OP_RECVMSG, { CAP_RECV, 0 } },
+	{ IORING_OP_SEND, { CAP_SEND, CAP_CONNECT, 0 } },
+	{ IORING_OP_RECV, { CAP_RECV, 0 } },
+	{ IORING_OP_TIMEOUT, { 0 } },
+	{ IORING_OP_TIMEOUT_REMOVE, { 0 } },
+	{ IORING_OP_LINK_TIMEOUT, { 0 } },
+	{ IORING_OP_ASYNC_CANCEL, { 0 } },
+};
+
+int cap_io_uring_setup(unsigned int entries, struct io_uring_params *params,
+		       const unsigned char *opcodes, size_t nopcodes,
+		       const int *fds, unsigned int nfds) {
+	struct io_uring_restriction res[COUNT_OF(io_uring_ops) + 1];
+	cap_rights_t needed, rights;
+	unsigned int nres = 0;
+	unsigned int slot;
+	size_t ii, jj;
+	int ring, saved_errno;
+
+	if (params == NULL || opcodes == NULL || nopcodes == 0 ||
+	    nopcodes > COUNT_OF(io_uring_ops) || (nfds > 0 && fds == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	cap_rights_init(&needed, 0);
+	for (ii = 0; ii < nopcodes; ii++) {
+		for (jj = 0; jj < COUNT_OF(io_uring_ops); jj++) {
+			if (io_uring_ops[jj].opcode == opcodes[ii])
+				break;
+		}
+		if (jj == COUNT_OF(io_uring_ops)) {
+			errno = EINVAL;
+			return -1;
+		}
+		cap_rights_set(&needed, io_uring_ops[jj].rights[0], io_uring_ops[jj].rights[1],
+			       io_uring_ops[jj].rights[2]);
+		memset(&res[nres], 0, sizeof(res[nres]));
+		res[nres].opcode = IORING_RESTRICTION_SQE_OP;
+		res[nres].sqe_op = opcodes[ii];
+		nres++;
+	}
+	/* Every submission must name a registered file, never a plain fd. */
+	memset(&res[nres], 0, sizeof(res[nres]));
+	res[nres].opcode = IORING_RESTRICTION_SQE_FLAGS_REQUIRED;
+	res[nres].sqe_flags = IOSQE_FIXED_FILE;
+	nres++;
+
+	/*
+	 * Any allowed operation can be aimed at any registered file, and the
+	 * kernel doesn't recheck rights for ring operations, so each file must
+	 * already carry every right that the opcodes need.
+	 */
+	for (ii = 0; ii < nfds; ii++) {
+		if (cap_rights_get(fds[ii], &rights) < 0)
+			return -1;
+		if (!cap_rights_contains(&rights, &needed)) {
+			errno = ENOTCAPABLE;
+			return -1;
+		}
+	}
+
+	/* The ring starts disabled, so nothing runs until it is locked down. */
+	params->flags |= IORING_SETUP_R_DISABLED;
+	ring = syscall(__NR_io_uring_setup, entries, params);
+	if (ring < 0)
+		return -1;
+	if ((nfds > 0 && io_uring_register_(ring, IORING_REGISTER_FILES, fds, nfds) < 0) ||
+	    io_uring_register_(ring, IORING_REGISTER_RESTRICTIONS, res, nres) < 0 ||
+	    io_uring_register_(ring, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0)
+		goto fail;
+
+	slot = __atomic_load_n(&capmode_nrings, __ATOMIC_RELAXED);
+	do {
+		if (slot >= CAPMODE_RINGS_MAX) {
+			errno = EMFILE;
+			goto fail;
+		}
+	} while (!__atomic_compare_exchange_n(&capmode_nrings, &slot, slot + 1, false,
+					      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	__atomic_store_n(&capmode_rings[slot], ring + 1, __ATOMIC_RELEASE);
+	return ring;
+fail:
+	saved_errno = errno;
+	close(ring);
+	errno = saved_errno;
+	return -1;
+}
 #else
+int cap_io_uring_setup(unsigned int entries, struct io_uring_params *params,
+		       const unsigned char *opcodes, size_t nopcodes,
+		       const int *fds, unsigned int nfds) {
 	errno = ENOSYS;
 	return -1;
+}
 #endif
 
-	seccomp = prctl(PR_GET_SECCOMP, 0, 0, 0, 0);
-	if (seccomp < 0) return seccomp;
-	*mode = (seccomp == SECCOMP_MODE_FILTER && beneath == 1);
-	return 0;
+int cap_getmode(unsigned int *mode) {
+	if (__atomic_load_n(&capmode_entered, __ATOMIC_ACQUIRE)) {
+		*mode = 1;
+		return 0;
+	}
+	return capmode_query(mode);
 }
 
 bool cap_sandboxed(void) {
@@ -3,13 +3,18 @@
  * different definitions of:
  *   - SYSCALL_NUM(name) : map syscall name to constant
  *   - SYSCALL_PREFIX : 0=none, 1=amd64, 2=ia32
- *   - SYSCALL_ARCH : architecture value this filter is approprate for
- *   - SYSCALL_FILTER : name of the filter variable.
+ *   - SYSCALL_ARCH : architecture value this rule table is approprate for
+ *   - SYSCALL_RULES : name of the rule table variable.
  *
  * For any system call where there's a chance that it might not be present
  * (either because it's specific to one sub-arch, or because it's a recent
- * addition), we therefore need to surround the BPF fragment with an #ifdef
+ * addition), we therefore need to surround the rule with an #ifdef
  * that identifies whether the relevant constant is available.
+ *
+ * The rules are compiled into a decision tree over syscall numbers, so their
+ * order only matters if the same syscall number appears twice (in which case
+ * the first rule wins).  Argument checks are self-contained BPF fragments
+ * that must end with a return, and only jump within themselves.
  */
 
 #ifndef VALID_MAP_FLAGS
@@ -24,15 +29,40 @@
 #endif
 #endif
 
-static struct sock_filter SYSCALL_FILTER[] = {
-	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, arch)), /* load arch */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_ARCH, 1, 0),
-	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_KILL),
+#ifndef ALLOW_PR_GET_OPENAT_BENEATH
+#ifdef PR_GET_OPENAT_BENEATH
+#define ALLOW_PR_GET_OPENAT_BENEATH	\
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_OPENAT_BENEATH, 0, 1),	\
+	ALLOW,
+#else
+#define ALLOW_PR_GET_OPENAT_BENEATH
+#endif
+#endif
 
-	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr)), /* load syscall# */
-	BPF_STMT(BPF_ALU+BPF_AND+BPF_K, SYSCALL_NUM_MASK), /* mask off x32 bit if present */
+#if defined(SECCOMP_DATA_TID_PRESENT) && !defined(CHECK_CURRENT_TGID)
+/* Check arg[0] vs current tgid, after checking the info is available */
+#define CHECK_CURRENT_TGID	\
+	BPF_STMT(BPF_LD+BPF_W+BPF_LEN, 0),  /* A <- data len */	\
+	BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,				\
+		offsetof(struct seccomp_data, tgid) + sizeof(pid_t),	\
+		0, 1),							\
+	BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,				\
+		offsetof(struct seccomp_data, tid) + sizeof(pid_t),	\
+		1, 0),							\
+	FAIL_ECAPMODE,							\
+	EXAMINE_ARGHI(0),						\
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),			\
+	FAIL_ECAPMODE,							\
+	EXAMINE_ARG(0),  /* A <- specified pid */			\
+	BPF_STMT(BPF_MISC+BPF_TAX, 0),  /* X <- A */			\
+	EXAMINE_TGID,  /* A <- actual tgid */				\
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_X, 0, 0, 1),			\
+	ALLOW,								\
+	FAIL_ECAPMODE
+#endif
 
-	/* Allowed syscalls: start with most common calls */
+static const struct capmode_rule SYSCALL_RULES[] = {
+	/* Allowed syscalls: common calls (see linux-bpf-capmode-profile.h for how often) */
 	ALLOW_SYSCALL(futex),
 	ALLOW_SYSCALL(poll),
 	ALLOW_SYSCALL(read),
@@ -75,43 +105,43 @@ static struct sock_filter SYSCALL_FILTER[] = {
 	ALLOW_SYSCALL(sendto),
 #endif
 	/* mmap(2) */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(mmap), 0, 9),
-	EXAMINE_ARGHI(3),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(3),  /* flags */
-	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, MAP_ANONYMOUS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(VALID_MAP_FLAGS), 0, 1),
-	FAIL_ECAPMODE,
-	ALLOW,
+	CHECK_SYSCALL(mmap,
+		EXAMINE_ARGHI(3),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(3),  /* flags */
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, MAP_ANONYMOUS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(VALID_MAP_FLAGS), 0, 1),
+		FAIL_ECAPMODE,
+		ALLOW),
 
 #if ((SYSCALL_PREFIX == 0 && defined(__NR_mmap2)) || \
      (SYSCALL_PREFIX == 1 && defined(__NR_amd64_mmap2)) || \
      (SYSCALL_PREFIX == 2 && defined(__NR_ia32_mmap2)))
 	/* mmap2(2) */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(mmap2), 0, 9),
-	EXAMINE_ARGHI(3),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(3),  /* flags */
-	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, MAP_ANONYMOUS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(VALID_MAP_FLAGS), 0, 1),
-	FAIL_ECAPMODE,
-	ALLOW,
+	CHECK_SYSCALL(mmap2,
+		EXAMINE_ARGHI(3),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(3),  /* flags */
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, MAP_ANONYMOUS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(VALID_MAP_FLAGS), 0, 1),
+		FAIL_ECAPMODE,
+		ALLOW),
 #endif
 
 	/* openat(2) */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(openat), 0, 7 + FAIL_AT_FDCWD_COUNT),
-	FAIL_AT_FDCWD(0),
-	EXAMINE_ARGHI(2),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(2),  /* flags */
-	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(VALID_OPENAT_FLAGS), 0, 1),
-	FAIL_ECAPMODE,
-	ALLOW,
+	CHECK_SYSCALL(openat,
+		FAIL_AT_FDCWD(0),
+		EXAMINE_ARGHI(2),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(2),  /* flags */
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(VALID_OPENAT_FLAGS), 0, 1),
+		FAIL_ECAPMODE,
+		ALLOW),
 
 	ALLOW_SYSCALL(lseek),
 
@@ -140,11 +170,17 @@ static struct sock_filter SYSCALL_FILTER[] = {
 #endif
 	ALLOW_SYSCALL(clock_getres),
 	ALLOW_SYSCALL(clock_gettime),
+	ALLOW_SYSCALL(clock_nanosleep),
 	ALLOW_SYSCALL(clone),
 #if ((SYSCALL_PREFIX == 0 && defined(__NR_clone4)) || \
      (SYSCALL_PREFIX == 1 && defined(__NR_amd64_clone4)) || \
      (SYSCALL_PREFIX == 2 && defined(__NR_ia32_clone4)))
 	ALLOW_SYSCALL(clone4),
+#endif
+#if ((SYSCALL_PREFIX == 0 && defined(__NR_copy_file_range)) || \
+     (SYSCALL_PREFIX == 1 && defined(__NR_amd64_copy_file_range)) || \
+     (SYSCALL_PREFIX == 2 && defined(__NR_ia32_copy_file_range)))
+	ALLOW_SYSCALL(copy_file_range),
 #endif
 	ALLOW_SYSCALL(dup),
 	ALLOW_SYSCALL(dup2),
@@ -164,6 +200,17 @@ static struct sock_filter SYSCALL_FILTER[] = {
 #endif
 	ALLOW_SYSCALL(exit),
 	ALLOW_SYSCALL(exit_group),
+#if ((SYSCALL_PREFIX == 0 && defined(__NR_fadvise64)) || \
+     (SYSCALL_PREFIX == 1 && defined(__NR_amd64_fadvise64)) || \
+     (SYSCALL_PREFIX == 2 && defined(__NR_ia32_fadvise64)))
+	ALLOW_SYSCALL(fadvise64),
+#endif
+#if ((SYSCALL_PREFIX == 0 && defined(__NR_fadvise64_64)) || \
+     (SYSCALL_PREFIX == 1 && defined(__NR_amd64_fadvise64_64)) || \
+     (SYSCALL_PREFIX == 2 && defined(__NR_ia32_fadvise64_64)))
+	ALLOW_SYSCALL(fadvise64_64),
+#endif
+	ALLOW_SYSCALL(fallocate),
 	ALLOW_AT_SYSCALL(faccessat),
 	ALLOW_SYSCALL(fchmod),
 	ALLOW_AT_SYSCALL(fchmodat),
@@ -277,6 +324,7 @@ static struct sock_filter SYSCALL_FILTER[] = {
 	ALLOW_SYSCALL(mq_notify),
 	ALLOW_SYSCALL(mq_timedreceive),
 	ALLOW_SYSCALL(mq_timedsend),
+	ALLOW_SYSCALL(mremap),
 	ALLOW_SYSCALL(msync),
 	ALLOW_SYSCALL(munlock),
 	ALLOW_SYSCALL(munlockall),
@@ -302,9 +350,19 @@ static struct sock_filter SYSCALL_FILTER[] = {
 	ALLOW_SYSCALL(ppoll),
 	ALLOW_SYSCALL(pread64),
 	ALLOW_SYSCALL(preadv),
+#if ((SYSCALL_PREFIX == 0 && defined(__NR_preadv2)) || \
+     (SYSCALL_PREFIX == 1 && defined(__NR_amd64_preadv2)) || \
+     (SYSCALL_PREFIX == 2 && defined(__NR_ia32_preadv2)))
+	ALLOW_SYSCALL(preadv2),
+#endif
 	ALLOW_SYSCALL(pselect6),
 	ALLOW_SYSCALL(pwrite64),
 	ALLOW_SYSCALL(pwritev),
+#if ((SYSCALL_PREFIX == 0 && defined(__NR_pwritev2)) || \
+     (SYSCALL_PREFIX == 1 && defined(__NR_amd64_pwritev2)) || \
+     (SYSCALL_PREFIX == 2 && defined(__NR_ia32_pwritev2)))
+	ALLOW_SYSCALL(pwritev2),
+#endif
 	ALLOW_SYSCALL(readahead),
 	ALLOW_AT_SYSCALL(readlinkat),
 	ALLOW_SYSCALL(recvmmsg),
@@ -313,6 +371,11 @@ static struct sock_filter SYSCALL_FILTER[] = {
      (SYSCALL_PREFIX == 1 && defined(__NR_amd64_restart_syscall)) || \
      (SYSCALL_PREFIX == 2 && defined(__NR_ia32_restart_syscall)))
 	ALLOW_SYSCALL(restart_syscall),
+#endif
+#if ((SYSCALL_PREFIX == 0 && defined(__NR_rseq)) || \
+     (SYSCALL_PREFIX == 1 && defined(__NR_amd64_rseq)) || \
+     (SYSCALL_PREFIX == 2 && defined(__NR_ia32_rseq)))
+	ALLOW_SYSCALL(rseq),
 #endif
 	ALLOW_SYSCALL(rt_sigaction),
 	ALLOW_SYSCALL(rt_sigpending),
@@ -469,59 +532,63 @@ static struct sock_filter SYSCALL_FILTER[] = {
      (SYSCALL_PREFIX == 1 && defined(__NR_amd64_socketcall)) || \
      (SYSCALL_PREFIX == 2 && defined(__NR_ia32_socketcall)))
 	/* socketcall is a multiplexor equivalent to various other syscalls */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(socketcall), 0, 41),
-	EXAMINE_ARGHI(0),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(0),  /* call */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SOCKET, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_LISTEN, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_ACCEPT, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_GETSOCKNAME, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_GETPEERNAME, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SOCKETPAIR, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SEND, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SENDTO, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECV, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECVFROM, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SHUTDOWN, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SETSOCKOPT, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_GETSOCKOPT, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SENDMSG, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SENDMMSG, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECVMSG, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECVMMSG, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_ACCEPT4, 0, 1),
-	ALLOW,
-	FAIL_ECAPMODE,  /* Deny SYS_BIND, SYS_CONNECT */
+	CHECK_SYSCALL(socketcall,
+		EXAMINE_ARGHI(0),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(0),  /* call */
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SOCKET, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_LISTEN, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_ACCEPT, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_GETSOCKNAME, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_GETPEERNAME, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SOCKETPAIR, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SEND, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SENDTO, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECV, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECVFROM, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SHUTDOWN, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SETSOCKOPT, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_GETSOCKOPT, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SENDMSG, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_SENDMMSG, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECVMSG, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_RECVMMSG, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYS_ACCEPT4, 0, 1),
+		ALLOW,
+		FAIL_ECAPMODE),  /* Deny SYS_BIND, SYS_CONNECT */
 #endif
 #if ((SYSCALL_PREFIX == 0 && defined(__NR_socketpair)) || \
      (SYSCALL_PREFIX == 1 && defined(__NR_amd64_socketpair)) || \
      (SYSCALL_PREFIX == 2 && defined(__NR_ia32_socketpair)))
 	ALLOW_SYSCALL(socketpair),
 #endif
+	ALLOW_SYSCALL(splice),
 	ALLOW_AT_SYSCALL_ARG(symlinkat, 1),
 	ALLOW_SYSCALL(sync),
 	ALLOW_SYSCALL(syncfs),
 	ALLOW_SYSCALL(sync_file_range),
+	ALLOW_SYSCALL(tee),
 	ALLOW_SYSCALL(timerfd_create),
+	ALLOW_SYSCALL(timerfd_gettime),
+	ALLOW_SYSCALL(timerfd_settime),
 	ALLOW_SYSCALL(umask),
 	ALLOW_SYSCALL(uname),
 	ALLOW_AT_SYSCALL(unlinkat),
@@ -536,106 +603,88 @@ static struct sock_filter SYSCALL_FILTER[] = {
 #if ((SYSCALL_PREFIX == 0 && defined(__NR_arch_prctl)) || \
      (SYSCALL_PREFIX == 1 && defined(__NR_amd64_arch_prctl)) || \
      (SYSCALL_PREFIX == 2 && defined(__NR_ia32_arch_prctl)))
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(arch_prctl), 0, 13),
-	EXAMINE_ARGHI(0),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(0),  /* code */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_GET_FS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_GET_GS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_SET_FS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_SET_GS, 0, 1),
-	ALLOW,
-	FAIL_ECAPMODE,
+	CHECK_SYSCALL(arch_prctl,
+		EXAMINE_ARGHI(0),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(0),  /* code */
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_GET_FS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_GET_GS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_SET_FS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, ARCH_SET_GS, 0, 1),
+		ALLOW,
+		FAIL_ECAPMODE),
 #endif
 
 #ifdef SECCOMP_DATA_TID_PRESENT
 	/* tgkill(2)/kill(2): check arg[0] vs current tgid. */
-	/* First check info is available */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(tgkill), 1, 0),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(kill), 0, 13),
-	BPF_STMT(BPF_LD+BPF_W+BPF_LEN, 0),  /* A <- data len */
-	BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,
-		offsetof(struct seccomp_data, tgid) + sizeof(pid_t),
-		0, 1),
-	BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,
-		offsetof(struct seccomp_data, tid) + sizeof(pid_t),
-		1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARGHI(0),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(0),  /* A <- specified pid */
-	BPF_STMT(BPF_MISC+BPF_TAX, 0),  /* X <- A */
-	EXAMINE_TGID,  /* A <- actual tgid */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_X, 0, 0, 1),
-	ALLOW,
-	FAIL_ECAPMODE,
+	CHECK_SYSCALL(tgkill, CHECK_CURRENT_TGID),
+	CHECK_SYSCALL(kill, CHECK_CURRENT_TGID),
 #else
 	/* kill(2): want to check for current tid, but can't. */
 #endif
 
+	/* sched_getaffinity(2): only for the current thread (pid 0) */
+	CHECK_SYSCALL(sched_getaffinity,
+		EXAMINE_ARG(0),  /* pid */
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 0, 1),
+		ALLOW,
+		FAIL_ECAPMODE),
+
 	/* prctl(2) */
-#ifdef PR_GET_OPENAT_BENEATH
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(prctl), 0, 39),
-#else
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(prctl), 0, 37),
-#endif
-	EXAMINE_ARGHI(0),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(0),  /* option */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_CAPBSET_READ, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_CAPBSET_DROP, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_DUMPABLE, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_ENDIAN, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_FPEMU, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_KEEPCAPS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_NAME, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_NO_NEW_PRIVS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_PDEATHSIG, 0, 1),
-	ALLOW,
-#ifdef PR_GET_OPENAT_BENEATH
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_OPENAT_BENEATH, 0, 1),
-	ALLOW,
-#endif
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_SECCOMP, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_SECUREBITS, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_TIMERSLACK, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_TIMING, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_TSC, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_UNALIGN, 0, 1),
-	ALLOW,
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_MCE_KILL_GET, 0, 1),
-	ALLOW,
-	FAIL_ECAPMODE,
+	CHECK_SYSCALL(prctl,
+		EXAMINE_ARGHI(0),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(0),  /* option */
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_CAPBSET_READ, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_CAPBSET_DROP, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_DUMPABLE, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_ENDIAN, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_FPEMU, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_KEEPCAPS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_NAME, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_NO_NEW_PRIVS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_PDEATHSIG, 0, 1),
+		ALLOW,
+		ALLOW_PR_GET_OPENAT_BENEATH
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_SECCOMP, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_SECUREBITS, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_TIMERSLACK, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_TIMING, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_TSC, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_GET_UNALIGN, 0, 1),
+		ALLOW,
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, PR_MCE_KILL_GET, 0, 1),
+		ALLOW,
+		FAIL_ECAPMODE),
 
 #ifdef WCLONEFD
 	/* wait4(2) */
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NUM(wait4), 0, 7),
-	EXAMINE_ARGHI(2),
-	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
-	FAIL_ECAPMODE,
-	EXAMINE_ARG(2),  /* options */
-	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, WCLONEFD, 1, 0),
-	FAIL_ECAPMODE,
-	ALLOW,
+	CHECK_SYSCALL(wait4,
+		EXAMINE_ARGHI(2),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 1, 0),
+		FAIL_ECAPMODE,
+		EXAMINE_ARG(2),  /* options */
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, WCLONEFD, 1, 0),
+		FAIL_ECAPMODE,
+		ALLOW),
 #endif
 
 #if (SYSCALL_ARCH == ARCH_X86_64 && defined(__NR_x32_rt_sigaction))
@@ -686,6 +735,12 @@ static struct sock_filter SYSCALL_FILTER[] = {
 #if (SYSCALL_ARCH == ARCH_X86_64 && defined(__NR_x32_pwritev))
 	ALLOW_X32_SYSCALL(pwritev),
 #endif
+#if (SYSCALL_ARCH == ARCH_X86_64 && defined(__NR_x32_preadv2))
+	ALLOW_X32_SYSCALL(preadv2),
+#endif
+#if (SYSCALL_ARCH == ARCH_X86_64 && defined(__NR_x32_pwritev2))
+	ALLOW_X32_SYSCALL(pwritev2),
+#endif
 #if (SYSCALL_ARCH == ARCH_X86_64 && defined(__NR_x32_rt_tgsigqueueinfo))
 	ALLOW_X32_SYSCALL(rt_tgsigqueueinfo),
 #endif
@@ -705,6 +760,5 @@ static struct sock_filter SYSCALL_FILTER[] = {
 	ALLOW_X32_AT_SYSCALL(execveat),
 #endif
 
-	/* Fail everything else */
-	FAIL_ECAPMODE,
+	/* Everything else fails with ECAPMODE */
 };
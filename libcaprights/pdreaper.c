@@ -0,0 +1,77 @@
+/*
+ * Reaping many process descriptors at once.  A reaper is an epoll set with
+ * each process descriptor registered one-shot, so an exited child is handed
+ * to exactly one pd_reaper_wait() call even when several threads are waiting
+ * on the same reaper.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "procdesc.h"
+
+#define PD_REAPER_EVENTS (EPOLLIN|EPOLLHUP|EPOLLONESHOT)
+#define PD_REAPER_BATCH 64  /* Events fetched per epoll_wait(2) */
+
+int pd_reaper_create(int flags) {
+  if (flags & ~PD_CLOEXEC) {
+    errno = EINVAL;
+    return -1;
+  }
+  return epoll_create1((flags & PD_CLOEXEC) ? EPOLL_CLOEXEC : 0);
+}
+
+int pd_reaper_add(int reaper, int pd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = PD_REAPER_EVENTS;
+  event.data.fd = pd;
+  return epoll_ctl(reaper, EPOLL_CTL_ADD, pd, &event);
+}
+
+int pd_reaper_remove(int reaper, int pd) {
+  return epoll_ctl(reaper, EPOLL_CTL_DEL, pd, NULL);
+}
+
+int pd_reaper_wait(int reaper, struct pd_reaped *reaped, int nreaped, int timeout) {
+  struct epoll_event events[PD_REAPER_BATCH];
+  int count = 0;
+  int nevents, ii;
+
+  if (nreaped <= 0 || reaped == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nreaped > PD_REAPER_BATCH)
+    nreaped = PD_REAPER_BATCH;
+  do {
+    nevents = epoll_wait(reaper, events, nreaped, timeout);
+    if (nevents < 0)
+      return -1;
+    for (ii = 0; ii < nevents; ii++) {
+      struct pd_reaped *out = &reaped[count];
+      int pd = events[ii].data.fd;
+      memset(out, 0, sizeof(*out));
+      out->pd = pd;
+      out->pid = pdwait4(pd, &out->status, WNOHANG, &out->rusage);
+      if (out->pid == 0) {
+        /* Not exited after all; wait for it again. */
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = PD_REAPER_EVENTS;
+        event.data.fd = pd;
+        epoll_ctl(reaper, EPOLL_CTL_MOD, pd, &event);
+        continue;
+      }
+      /* Reaped, or unwaitable (with out->pid = -1, out->error set). */
+      if (out->pid < 0)
+        out->error = errno;
+      epoll_ctl(reaper, EPOLL_CTL_DEL, pd, NULL);
+      count++;
+    }
+    /* Only keep going if nothing was ready and the caller will block anyway. */
+  } while (count == 0 && nevents > 0 && timeout < 0);
+  return count;
+}
@@ -0,0 +1,319 @@
+/*
+ * Spawning a program with a process descriptor, without the page table copy
+ * of pdfork().  The child is created with CLONE_VM|CLONE_VFORK on a stack of
+ * its own, as posix_spawn(3) does, so until its execve(2) it shares all of
+ * the parent's memory.  It must therefore avoid anything that changes state
+ * the parent relies on: no allocation, no library locks and no rights cache
+ * or capability mode bookkeeping, so it uses raw system calls throughout and
+ * reports any failure through the shared spawn_args.
+ *
+ * Kernels with clone4(2) can't yet give a process descriptor to a child on
+ * a separate stack, so there this falls back to pdfork(), with a pipe to
+ * carry the error back.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "capsicum.h"
+#include "procdesc.h"
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#define PD_SPAWN_STACK (64 * 1024)
+/* Longest existing ioctl list that a limit action can preserve */
+#ifdef CAP_IOCTLS_LIMIT_MAX
+#define PD_SPAWN_IOCTLS CAP_IOCTLS_LIMIT_MAX
+#else
+#define PD_SPAWN_IOCTLS 256
+#endif
+
+/* cap_enter() without touching the parent's state; linux-bpf-capmode.c */
+extern int cap_enter_shared(void);
+
+enum pd_spawn_op {
+  PD_SPAWN_CLOSE,
+  PD_SPAWN_DUP2,
+  PD_SPAWN_LIMIT,
+  PD_SPAWN_CAP_ENTER,
+};
+
+struct pd_spawn_action {
+  enum pd_spawn_op op;
+  int fd;
+  int newfd;
+  cap_rights_t rights;
+};
+
+struct pd_spawn_actions {
+  struct pd_spawn_action *actions;
+  int nactions;
+};
+
+/************************************************************
+ * Action lists.
+ ************************************************************/
+
+struct pd_spawn_actions *pd_spawn_actions_create(void) {
+  return calloc(1, sizeof(struct pd_spawn_actions));
+}
+
+void pd_spawn_actions_free(struct pd_spawn_actions *actions) {
+  if (actions == NULL)
+    return;
+  free(actions->actions);
+  free(actions);
+}
+
+static struct pd_spawn_action *add_action(struct pd_spawn_actions *actions,
+                                          enum pd_spawn_op op, int fd) {
+  struct pd_spawn_action *list, *action;
+  if (actions == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (fd < 0 && op != PD_SPAWN_CAP_ENTER) {
+    errno = EBADF;
+    return NULL;
+  }
+  list = realloc(actions->actions, (actions->nactions + 1) * sizeof(*list));
+  if (list == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  actions->actions = list;
+  action = &list[actions->nactions++];
+  memset(action, 0, sizeof(*action));
+  action->op = op;
+  action->fd = fd;
+  return action;
+}
+
+int pd_spawn_actions_addclose(struct pd_spawn_actions *actions, int fd) {
+  return add_action(actions, PD_SPAWN_CLOSE, fd) ? 0 : -1;
+}
+
+int pd_spawn_actions_adddup2(struct pd_spawn_actions *actions, int fd, int newfd) {
+  struct pd_spawn_action *action;
+  if (newfd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  action = add_action(actions, PD_SPAWN_DUP2, fd);
+  if (action == NULL)
+    return -1;
+  action->newfd = newfd;
+  return 0;
+}
+
+int pd_spawn_actions_addlimit(struct pd_spawn_actions *actions, int fd,
+                              const cap_rights_t *rights) {
+  struct pd_spawn_action *action;
+  if (rights == NULL || !cap_rights_is_valid(rights)) {
+    errno = EINVAL;
+    return -1;
+  }
+  action = add_action(actions, PD_SPAWN_LIMIT, fd);
+  if (action == NULL)
+    return -1;
+  action->rights = *rights;
+  return 0;
+}
+
+int pd_spawn_actions_addcapenter(struct pd_spawn_actions *actions) {
+  return add_action(actions, PD_SPAWN_CAP_ENTER, -1) ? 0 : -1;
+}
+
+/************************************************************
+ * The child.
+ ************************************************************/
+
+struct spawn_args {
+  int execfd;
+  const struct pd_spawn_actions *actions;
+  char *const *argv;
+  char *const *envp;
+  int flags;
+  pid_t parent;
+  sigset_t oldmask;
+  int errfd;  /* If >= 0, where to write error (for a forked child) */
+  int error;  /* Set by a child that shares our memory, if it fails */
+};
+
+/* As cap_rights_limit(), but without the rights cache or any allocation. */
+static int spawn_limit(int fd, const cap_rights_t *rights) {
+  cap_ioctl_t ioctls[PD_SPAWN_IOCTLS];
+  cap_fcntl_t fcntls;
+  int nioctls = PD_SPAWN_IOCTLS;
+  if (syscall(__NR_cap_rights_get, fd, NULL, &fcntls, &nioctls, ioctls, 0) < 0)
+    return -1;
+  if (!cap_rights_is_set(rights, CAP_FCNTL))
+    fcntls = 0;
+  if (!cap_rights_is_set(rights, CAP_IOCTL))
+    nioctls = 0;
+  else if (nioctls > PD_SPAWN_IOCTLS) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return syscall(__NR_cap_rights_limit, fd, rights, fcntls, nioctls,
+                 nioctls > 0 ? ioctls : NULL, 0);
+}
+
+static int spawn_child(void *arg) {
+  struct spawn_args *args = arg;
+  const struct pd_spawn_actions *actions = args->actions;
+  struct sigaction sa;
+  bool entered = false;  /* on our own stack, so not the parent's */
+  int ii, rc = 0;
+
+  /* The parent's signal handlers would run on the parent's data. */
+  for (ii = 1; ii < NSIG; ii++) {
+    if (sigaction(ii, NULL, &sa) < 0 || sa.sa_handler == SIG_IGN ||
+        sa.sa_handler == SIG_DFL)
+      continue;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(ii, &sa, NULL);
+  }
+#ifndef __NR_clone4
+  /* As for pdfork(), the nearest we have to kill-on-close. */
+  if (!(args->flags & PD_DAEMON)) {
+    rc = prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (rc == 0 && getppid() != args->parent) {
+      errno = ESRCH;
+      rc = -1;
+    }
+  }
+#endif
+  for (ii = 0; rc == 0 && actions && ii < actions->nactions; ii++) {
+    const struct pd_spawn_action *action = &actions->actions[ii];
+    switch (action->op) {
+    case PD_SPAWN_CLOSE:
+      rc = close(action->fd);
+      break;
+    case PD_SPAWN_DUP2:
+      /* As for posix_spawn(3), dup2() onto itself just clears FD_CLOEXEC. */
+      if (action->fd == action->newfd)
+        rc = fcntl(action->fd, F_SETFD, 0);
+      else
+        rc = dup2(action->fd, action->newfd) < 0 ? -1 : 0;
+      break;
+    case PD_SPAWN_LIMIT:
+      rc = spawn_limit(action->fd, &action->rights);
+      break;
+    case PD_SPAWN_CAP_ENTER:
+      /* Once is enough; another copy of the filter would only cost. */
+      if (!entered)
+        rc = cap_enter_shared();
+      entered = (rc == 0);
+      break;
+    }
+  }
+  if (rc == 0) {
+    sigprocmask(SIG_SETMASK, &args->oldmask, NULL);
+    syscall(__NR_execveat, args->execfd, "", args->argv, args->envp, AT_EMPTY_PATH);
+  }
+  args->error = errno;
+  if (args->errfd >= 0)
+    write(args->errfd, &args->error, sizeof(args->error));
+  _exit(127);
+}
+
+/************************************************************
+ * Spawning.
+ ************************************************************/
+
+int pdspawn(int *fd, int execfd, const struct pd_spawn_actions *actions,
+            char *const argv[], char *const envp[], int flags) {
+  struct spawn_args args;
+  sigset_t all;
+  int pd = -1;
+  pid_t pid;
+
+  if (fd == NULL || argv == NULL ||
+      (flags & ~(PD_DAEMON|PD_CLOEXEC|PD_GENERATE_SIGCHLD))) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&args, 0, sizeof(args));
+  args.execfd = execfd;
+  args.actions = actions;
+  args.argv = argv;
+  args.envp = envp;
+  args.flags = flags;
+  args.parent = getpid();
+  args.errfd = -1;
+
+  /* No signals until the child has reset its handlers. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &args.oldmask);
+#ifdef __NR_clone4
+  {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+      args.error = errno;
+      pid = -1;
+    } else {
+      args.errfd = pipefd[1];
+      pid = pdfork(&pd, flags);
+      if (pid == 0)
+        spawn_child(&args);
+      if (pid < 0)
+        args.error = errno;
+      close(pipefd[1]);
+      /* A successful exec closes the pipe; otherwise the child sends errno. */
+      if (pid > 0 && read(pipefd[0], &args.error, sizeof(args.error)) != sizeof(args.error))
+        args.error = 0;
+      close(pipefd[0]);
+    }
+  }
+#else
+  {
+    void *stack = mmap(NULL, PD_SPAWN_STACK, PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+      args.error = errno;
+      pid = -1;
+    } else {
+      /* Stacks grow down on everything that has pidfds but not clone4(2). */
+      pid = clone(spawn_child, (char *)stack + PD_SPAWN_STACK,
+                  CLONE_VM|CLONE_VFORK|CLONE_PIDFD|
+                  ((flags & PD_GENERATE_SIGCHLD) ? SIGCHLD : 0),
+                  &args, &pd);
+      if (pid < 0)
+        args.error = errno;
+      munmap(stack, PD_SPAWN_STACK);
+    }
+    if (pid > 0 && !(flags & PD_CLOEXEC))
+      fcntl(pd, F_SETFD, 0);
+  }
+#endif
+  pthread_sigmask(SIG_SETMASK, &args.oldmask, NULL);
+
+  if (pid > 0 && args.error) {
+    /* The child failed before its exec, and has exited. */
+    pdwait4(pd, NULL, 0, NULL);
+    close(pd);
+    pid = -1;
+  }
+  if (pid < 0) {
+    errno = args.error;
+    return -1;
+  }
+  *fd = pd;
+  return pid;
+}
@@ -0,0 +1,311 @@
+/*
+ * Declarative rights policies: a table of descriptor roles, compiled once
+ * into the exact arguments for cap_rights_limit(2), so that applying it to
+ * a set of descriptors needs one system call each and no cap_rights_get(2).
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+#include "capsicum.h"
+#include "capaudit.h"
+#include "cappolicy.h"
+
+struct cap_policy_role {
+  char *name;
+  cap_rights_t rights;
+  cap_fcntl_t fcntls;
+  int nioctls;  /* -1 for all */
+  cap_ioctl_t *ioctls;
+};
+
+struct cap_policy {
+  struct cap_policy_role *roles;
+  int nroles;
+};
+
+/************************************************************
+ * Compilation.
+ ************************************************************/
+
+static const struct {
+  const char *name;
+  cap_fcntl_t fcntl;
+} fcntl_names[] = {
+  {"GETFL", CAP_FCNTL_GETFL},
+  {"SETFL", CAP_FCNTL_SETFL},
+  {"GETOWN", CAP_FCNTL_GETOWN},
+  {"SETOWN", CAP_FCNTL_SETOWN},
+};
+
+static int parse_rights(char *list, cap_rights_t *rights) {
+  char *save, *item;
+  for (item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    uint64_t right;
+    if (strcmp(item, "none") == 0)
+      continue;
+    right = cap_right_by_name(item);
+    if (right == 0)
+      return -1;
+    cap_rights_set(rights, right);
+  }
+  return 0;
+}
+
+static int parse_fcntls(char *list, cap_fcntl_t *fcntls) {
+  char *save, *item;
+  *fcntls = 0;
+  for (item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    size_t ii;
+    if (strcmp(item, "none") == 0)
+      continue;
+    if (strncmp(item, "CAP_FCNTL_", 10) == 0)
+      item += 10;
+    for (ii = 0; ii < sizeof(fcntl_names) / sizeof(fcntl_names[0]); ii++) {
+      if (strcmp(item, fcntl_names[ii].name) == 0)
+        break;
+    }
+    if (ii == sizeof(fcntl_names) / sizeof(fcntl_names[0]))
+      return -1;
+    *fcntls |= fcntl_names[ii].fcntl;
+  }
+  return 0;
+}
+
+static int ioctl_cmp(const void *a, const void *b) {
+  cap_ioctl_t x = *(const cap_ioctl_t *)a, y = *(const cap_ioctl_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Parse a list of ioctl numbers, stored sorted and without duplicates. */
+static int parse_ioctls(char *list, struct cap_policy_role *role) {
+  char *save, *item;
+  int n = 0, ii, jj;
+  for (item = list; *item; item++)
+    n += (*item == ',');
+  role->ioctls = calloc(n + 1, sizeof(cap_ioctl_t));
+  if (role->ioctls == NULL)
+    return -1;
+  role->nioctls = 0;
+  for (item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    char *end;
+    unsigned long cmd;
+    if (strcmp(item, "none") == 0)
+      continue;
+    errno = 0;
+    cmd = strtoul(item, &end, 0);
+    if (*end != '\0' || errno != 0 || cmd != (cap_ioctl_t)cmd) {
+      errno = EINVAL;
+      return -1;
+    }
+    role->ioctls[role->nioctls++] = cmd;
+  }
+  if (role->nioctls > 1) {
+    qsort(role->ioctls, role->nioctls, sizeof(cap_ioctl_t), ioctl_cmp);
+    for (ii = 1, jj = 1; ii < role->nioctls; ii++) {
+      if (role->ioctls[ii] != role->ioctls[jj - 1])
+        role->ioctls[jj++] = role->ioctls[ii];
+    }
+    role->nioctls = jj;
+  }
+  return 0;
+}
+
+/* Parse one non-blank line into role; -1 with errno on failure. */
+static int parse_role(struct cap_policy *policy, char *line,
+                      struct cap_policy_role *role) {
+  bool have_rights = false, have_fcntls = false, have_ioctls = false;
+  char *save, *token;
+  int ii;
+
+  memset(role, 0, sizeof(*role));
+  CAP_SET_NONE(&role->rights);
+  role->nioctls = -1;
+  token = strtok_r(line, " \t\r", &save);
+  if (strchr(token, '=') != NULL) {
+    errno = EINVAL;  /* Settings with no role name */
+    return -1;
+  }
+  for (ii = 0; ii < policy->nroles; ii++) {
+    if (strcmp(policy->roles[ii].name, token) == 0) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  role->name = strdup(token);
+  if (role->name == NULL)
+    return -1;
+
+  errno = EINVAL;
+  while ((token = strtok_r(NULL, " \t\r", &save)) != NULL) {
+    char *value = strchr(token, '=');
+    if (value == NULL)
+      return -1;
+    *value++ = '\0';
+    if (strcmp(token, "rights") == 0 && !have_rights) {
+      have_rights = true;
+      if (parse_rights(value, &role->rights) < 0)
+        return -1;
+    } else if (strcmp(token, "fcntls") == 0 && !have_fcntls) {
+      have_fcntls = true;
+      if (parse_fcntls(value, &role->fcntls) < 0)
+        return -1;
+    } else if (strcmp(token, "ioctls") == 0 && !have_ioctls) {
+      have_ioctls = true;
+      if (parse_ioctls(value, role) < 0)
+        return -1;
+    } else {
+      return -1;
+    }
+  }
+  errno = 0;
+
+  /* Limits on fcntls or ioctls only mean anything with the matching right. */
+  if (have_fcntls)
+    cap_rights_set(&role->rights, CAP_FCNTL);
+  else if (cap_rights_is_set(&role->rights, CAP_FCNTL))
+    role->fcntls = CAP_FCNTL_ALL;
+  if (have_ioctls)
+    cap_rights_set(&role->rights, CAP_IOCTL);
+  else if (!cap_rights_is_set(&role->rights, CAP_IOCTL))
+    role->nioctls = 0;
+  return 0;
+}
+
+static void free_role(struct cap_policy_role *role) {
+  free(role->name);
+  free(role->ioctls);
+}
+
+struct cap_policy *cap_policy_compile(const char *text, int *errline) {
+  struct cap_policy *policy;
+  char *copy, *line, *next;
+  int lineno = 0;
+
+  if (errline)
+    *errline = 0;
+  if (text == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  policy = calloc(1, sizeof(*policy));
+  copy = strdup(text);
+  if (policy == NULL || copy == NULL) {
+    free(policy);
+    free(copy);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for (line = copy; line; line = next) {
+    struct cap_policy_role role, *roles;
+    char *comment;
+    next = strchr(line, '\n');
+    if (next)
+      *next++ = '\0';
+    lineno++;
+    comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    if (line[strspn(line, " \t\r")] == '\0')
+      continue;
+
+    if (parse_role(policy, line, &role) < 0) {
+      int error = errno;
+      free_role(&role);
+      if (errline && error == EINVAL)
+        *errline = lineno;
+      goto fail;
+    }
+    roles = realloc(policy->roles, (policy->nroles + 1) * sizeof(*roles));
+    if (roles == NULL) {
+      free_role(&role);
+      errno = ENOMEM;
+      goto fail;
+    }
+    policy->roles = roles;
+    policy->roles[policy->nroles++] = role;
+  }
+  free(copy);
+  return policy;
+
+fail:
+  free(copy);
+  cap_policy_free(policy);
+  return NULL;
+}
+
+void cap_policy_free(struct cap_policy *policy) {
+  int ii;
+  int error = errno;
+  if (policy == NULL)
+    return;
+  for (ii = 0; ii < policy->nroles; ii++)
+    free_role(&policy->roles[ii]);
+  free(policy->roles);
+  free(policy);
+  errno = error;
+}
+
+int cap_policy_role(const struct cap_policy *policy, const char *name) {
+  int ii;
+  for (ii = 0; ii < policy->nroles; ii++) {
+    if (strcmp(policy->roles[ii].name, name) == 0)
+      return ii;
+  }
+  errno = ENOENT;
+  return -1;
+}
+
+const cap_rights_t *cap_policy_rights(const struct cap_policy *policy, int role) {
+  if (role < 0 || role >= policy->nroles) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return &policy->roles[role].rights;
+}
+
+/************************************************************
+ * Application.
+ ************************************************************/
+
+int cap_policy_apply(const struct cap_policy *policy, const int *fds,
+                     const int *roles, size_t nfds, int *errors) {
+  int result = 0, first_errno = 0;
+  size_t ii;
+  if (nfds > 0 && (fds == NULL || roles == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (ii = 0; ii < nfds; ii++) {
+    const struct cap_policy_role *role;
+    int rc;
+    if (roles[ii] < 0) {
+      if (errors)
+        errors[ii] = 0;
+      continue;
+    }
+    if (roles[ii] >= policy->nroles) {
+      errno = EINVAL;
+      rc = -1;
+    } else {
+      role = &policy->roles[roles[ii]];
+      rc = syscall(__NR_cap_rights_limit, fds[ii], &role->rights, role->fcntls,
+                   role->nioctls, role->nioctls > 0 ? role->ioctls : NULL, 0);
+      cap_rights_cache_invalidate(fds[ii]);
+    }
+    if (errors)
+      errors[ii] = (rc < 0) ? errno : 0;
+    if (rc < 0 && result == 0) {
+      first_errno = errno;
+      result = -1;
+    }
+  }
+  if (result)
+    errno = first_errno;
+  return result;
+}
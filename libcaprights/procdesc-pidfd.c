@@ -0,0 +1,196 @@
+/*
+ * Process descriptors on kernels without clone4(2), built from the pidfd
+ * calls of stock Linux (5.3 and later):
+ *   pdfork()   => clone3(CLONE_PIDFD), with no exit signal unless asked for
+ *   pdgetpid() => the Pid: line of the pidfd's /proc fdinfo
+ *   pdkill()   => pidfd_send_signal(2)
+ *   pdwait4()  => waitid(P_PIDFD)
+ *
+ * A pidfd doesn't kill its process when closed, so without PD_DAEMON the
+ * nearest equivalent is used: the child gets PR_SET_PDEATHSIG(SIGKILL), and
+ * so dies with the thread that called pdfork(), rather than with its last
+ * process descriptor.
+ *
+ * This is a separate translation unit from procdesc.c because it needs
+ * <signal.h>, which clashes with <linux/sched.h> (see signal.c).
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "procdesc.h"
+
+#ifndef __NR_clone4
+
+#if defined(__NR_clone3) && defined(__NR_pidfd_open) && defined(__NR_pidfd_send_signal)
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+/* Layout of the original (CLONE_ARGS_SIZE_VER0) clone3(2) arguments. */
+struct pd_clone_args {
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+};
+
+int pdfork(int *fd, int flags) {
+  struct pd_clone_args args;
+  int pidfd = -1;
+  pid_t parent = getpid();
+  pid_t pid;
+
+  if (flags & ~(PD_DAEMON|PD_CLOEXEC|PD_GENERATE_SIGCHLD)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_PIDFD;
+  args.pidfd = (uintptr_t)&pidfd;
+  args.exit_signal = (flags & PD_GENERATE_SIGCHLD) ? SIGCHLD : 0;
+  pid = syscall(__NR_clone3, &args, sizeof(args));
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    /* Child: as for the clone4(2) version, no process descriptor here. */
+    if (!(flags & PD_DAEMON)) {
+      if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0 || getppid() != parent)
+        _exit(1);
+    }
+    *fd = -1;
+    return 0;
+  }
+  /* The kernel always makes a pidfd close-on-exec. */
+  if (!(flags & PD_CLOEXEC))
+    fcntl(pidfd, F_SETFD, 0);
+  *fd = pidfd;
+  return pid;
+}
+
+int pdgetpid(int fd, pid_t *pid) {
+  char path[64];
+  char buf[1024];
+  char *line;
+  ssize_t len;
+  int infofd;
+  long value;
+
+  if (pid == NULL) {
+    errno = EFAULT;
+    return -1;
+  }
+  if (fd < 0 || fcntl(fd, F_GETFD) < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+  infofd = open(path, O_RDONLY|O_CLOEXEC);
+  if (infofd < 0)
+    return -1;
+  len = read(infofd, buf, sizeof(buf) - 1);
+  close(infofd);
+  if (len < 0)
+    return -1;
+  buf[len] = '\0';
+  line = strstr(buf, "\nPid:");
+  if (line == NULL) {
+    errno = EBADF;  /* Not a process descriptor */
+    return -1;
+  }
+  value = strtol(line + 5, NULL, 10);
+  if (value <= 0) {
+    errno = ECHILD;  /* Already reaped */
+    return -1;
+  }
+  *pid = value;
+  return 0;
+}
+
+int pdkill(int fd, int signum) {
+  return syscall(__NR_pidfd_send_signal, fd, signum, NULL, 0);
+}
+
+pid_t pdwait4(int pd, int *status, int options, struct rusage *ru) {
+  siginfo_t info;
+  int idoptions = WEXITED|__WALL;
+  int wstatus = 0;
+
+  if (options & ~(WNOHANG|WUNTRACED|WCONTINUED)) {
+    errno = EINVAL;
+    return -1;
+  }
+  idoptions |= options & (WNOHANG|WCONTINUED);
+  if (options & WUNTRACED)
+    idoptions |= WSTOPPED;
+  memset(&info, 0, sizeof(info));
+  /* The waitid(2) system call, unlike the libc wrapper, fills in rusage. */
+  if (syscall(__NR_waitid, P_PIDFD, pd, &info, idoptions, ru) < 0)
+    return -1;
+  if (info.si_pid == 0)
+    return 0;  /* WNOHANG, and nothing to report */
+  /* Rebuild the wait4(2) status from the siginfo. */
+  switch (info.si_code) {
+  case CLD_EXITED:
+    wstatus = (info.si_status & 0xff) << 8;
+    break;
+  case CLD_KILLED:
+    wstatus = info.si_status & 0x7f;
+    break;
+  case CLD_DUMPED:
+    wstatus = (info.si_status & 0x7f) | 0x80;
+    break;
+  case CLD_STOPPED:
+  case CLD_TRAPPED:
+    wstatus = ((info.si_status & 0xff) << 8) | 0x7f;
+    break;
+  case CLD_CONTINUED:
+    wstatus = 0xffff;
+    break;
+  }
+  if (status)
+    *status = wstatus;
+  return info.si_pid;
+}
+
+#else
+
+/* Without clone4(2) or the pidfd calls, process descriptors are unavailable */
+int pdfork(int *fd, int flags) {
+  errno = ENOSYS;
+  return -1;
+}
+int pdgetpid(int fd, pid_t *pid) {
+  errno = ENOSYS;
+  return -1;
+}
+int pdkill(int fd, int signum) {
+  errno = ENOSYS;
+  return -1;
+}
+pid_t pdwait4(int pd, int *status, int options, struct rusage *ru) {
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
+#endif
@@ -66,24 +66,4 @@ pid_t pdwait4(int pd, int *status, int options, struct rusage *ru) {
   return wait4(pd, status, options|__WALL|WCLONEFD, ru);
 }
 
-#else
-
-/* If clone4(2) is unavailable, process descriptor functionality is unavailable */
-int pdfork(int *fd, int flags) {
-  errno = ENOSYS;
-  return -1;
-}
-int pdgetpid(int fd, pid_t *pid) {
-  errno = ENOSYS;
-  return -1;
-}
-int pdkill(int fd, int signum) {
-  errno = ENOSYS;
-  return -1;
-}
-pid_t pdwait4(int pd, int *status, int options, struct rusage *ru) {
-  errno = ENOSYS;
-  return -1;
-}
-
-#endif
+#endif  /* __NR_clone4; procdesc-pidfd.c has the fallback */
@@ -2,13 +2,12 @@
 #define _SYS_PROCDESC_H
 
 #include <unistd.h>
+#include <sys/resource.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-struct rusage;
-
 /* Fork a new process and generate a process descriptor for it */
 int pdfork(int *fd, int flags);
 #define PD_DAEMON		0x01  /* Don't SIGKILL on last close(2) */
@@ -28,6 +27,49 @@ int pdkill(int fd, int signum);
 /* Requires CAP_PDWAIT right. */
 pid_t pdwait4(int pd, int *status, int options, struct rusage *ru);
 
+/*
+ * Wait for any of many process descriptors.  A reaper is a descriptor
+ * (close it with close(2)) holding a set of process descriptors; each call
+ * to pd_reaper_wait() reaps up to nreaped of the children that have exited,
+ * removing them from the set, and returns how many.  Several threads may
+ * wait on one reaper, and each exited child is returned to only one of them.
+ * The process descriptors need CAP_EVENT and CAP_PDWAIT rights.
+ */
+struct pd_reaped {
+  int pd;               /* Process descriptor, still open */
+  pid_t pid;            /* As returned by pdwait4(), or -1 ... */
+  int error;            /* ... with the errno from pdwait4() */
+  int status;
+  struct rusage rusage;
+};
+int pd_reaper_create(int flags);  /* PD_CLOEXEC */
+int pd_reaper_add(int reaper, int pd);
+int pd_reaper_remove(int reaper, int pd);
+int pd_reaper_wait(int reaper, struct pd_reaped *reaped, int nreaped, int timeout);
+
+/*
+ * Run the program open at execfd in a new process with a process descriptor,
+ * much as pdfork() then fexecve(3) would, but without copying the caller's
+ * address space: the child runs in it (with the calling thread suspended)
+ * until the exec.  Beforehand, the child carries out the actions (which may
+ * be NULL) in the order they were added.  Returns the child's pid, with its
+ * process descriptor in *fd; if anything fails before the exec, the child is
+ * reaped and the result is -1 with errno from the failing step.  The flags
+ * are as for pdfork().
+ */
+struct pd_spawn_actions;
+struct cap_rights;
+struct pd_spawn_actions *pd_spawn_actions_create(void);
+void pd_spawn_actions_free(struct pd_spawn_actions *actions);
+int pd_spawn_actions_addclose(struct pd_spawn_actions *actions, int fd);
+int pd_spawn_actions_adddup2(struct pd_spawn_actions *actions, int fd, int newfd);
+/* As cap_rights_limit(); fcntl and ioctl limits are kept where still relevant. */
+int pd_spawn_actions_addlimit(struct pd_spawn_actions *actions, int fd,
+                              const struct cap_rights *rights);
+int pd_spawn_actions_addcapenter(struct pd_spawn_actions *actions);
+int pdspawn(int *fd, int execfd, const struct pd_spawn_actions *actions,
+            char *const argv[], char *const envp[], int flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,17 +11,21 @@
 #include <sys/inotify.h>
 #include <sys/fanotify.h>
 #include <sys/mman.h>
+#include <sys/capaudit.h>
 #include <sys/capability.h>  // Requires e.g. libcap-dev package for POSIX.1e capabilities headers
 #include <linux/aio_abi.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
 #include <linux/version.h>
+#include <netinet/in.h>
 #include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <set>
 #include <string>
 
 #include "capsicum.h"
@@ -104,6 +108,21 @@ TEST(Linux, TimerFD) {
   close(fd);
 }
 
+FORK_TEST(Linux, TimerFDInCapMode) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  EXPECT_OK(fd);
+  EXPECT_OK(cap_enter());  // Enter capability mode.
+
+  // Arming and reading the timer only needs rights on the timerfd.
+  struct itimerspec ispec;
+  memset(&ispec, 0, sizeof(ispec));
+  ispec.it_value.tv_sec = 10;
+  EXPECT_OK(timerfd_settime(fd, 0, &ispec, NULL));
+  EXPECT_OK(timerfd_gettime(fd, &ispec));
+  EXPECT_NE(0, ispec.it_value.tv_sec + ispec.it_value.tv_nsec);
+  close(fd);
+}
+
 FORK_TEST(Linux, SignalFD) {
   if (force_mt) {
     TEST_SKIPPED("multi-threaded run clashes with signals");
@@ -1112,6 +1131,377 @@ TEST(Linux, CapModeWithBPF) {
   unlink(TmpFile("cap_bpf_capmode"));
 }
 
+#ifdef CAP_ENTER_ALLOW
+TEST(Linux, CapEnterExInvalid) {
+  const unsigned int syscalls[] = {__NR_read};
+  EXPECT_SYSCALL_FAIL(EINVAL, cap_enter_ex(CAP_ENTER_ALLOW|CAP_ENTER_DENY, syscalls, 1));
+  EXPECT_SYSCALL_FAIL(EINVAL, cap_enter_ex(0x80, syscalls, 1));
+  EXPECT_SYSCALL_FAIL(EINVAL, cap_enter_ex(0, syscalls, 1));
+  EXPECT_SYSCALL_FAIL(EINVAL, cap_enter_ex(CAP_ENTER_ALLOW, NULL, 1));
+
+  // Preparing a filter compiles it without entering capability mode.
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_ALLOW|CAP_ENTER_PREPARE, syscalls, 1));
+  EXPECT_FALSE(cap_sandboxed());
+}
+
+FORK_TEST(Linux, CapEnterExDeny) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  const unsigned int syscalls[] = {__NR_fchmod, __NR_getppid};
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_DENY, syscalls, 2));
+  EXPECT_TRUE(cap_sandboxed());
+
+  // Listed syscalls now fail...
+  EXPECT_CAPMODE(syscall(__NR_getppid));
+  EXPECT_CAPMODE(fchmod(fd, 0644));
+  // ...as do those that capability mode always blocks...
+  EXPECT_CAPMODE(open("/etc/passwd", O_RDONLY));
+  // ...but the rest of capability mode is available.
+  char buffer[16];
+  EXPECT_OK(read(fd, buffer, sizeof(buffer)));
+  EXPECT_OK(syscall(__NR_getpid));
+  close(fd);
+}
+
+FORK_TEST(Linux, CapEnterExAllow) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  // No need to list exit_group(2): the child can always exit.
+  const unsigned int syscalls[] = {__NR_read, __NR_close, __NR_getpid, __NR_openat,
+                                   __NR_write};
+  // Prepare first, as a pre-forking server would, so the entry below uses
+  // the cached filter.
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_ALLOW|CAP_ENTER_PREPARE, syscalls, 5));
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_ALLOW, syscalls, 5));
+
+  char buffer[16];
+  EXPECT_OK(read(fd, buffer, sizeof(buffer)));
+  EXPECT_OK(syscall(__NR_getpid));
+  // Capability mode still polices argument-checked syscalls...
+  EXPECT_CAPMODE(openat(AT_FDCWD, "/etc/passwd", O_RDONLY));
+  // ...and syscalls that aren't listed fail.
+  EXPECT_CAPMODE(syscall(__NR_getppid));
+  EXPECT_CAPMODE(syscall(__NR_lseek, fd, 0, SEEK_SET));
+  EXPECT_OK(close(fd));
+}
+
+#ifdef __x86_64__
+TEST(Linux, CapEnterExArchChange) {
+  int fd = open("./mini-me.32", O_RDONLY);
+  if (fd < 0) {
+    TEST_SKIPPED("no different-architecture programs available");
+    return;
+  }
+  char* argv_pass[] = {(char*)"./mini-me.32", (char*)"--pass", NULL};
+  char* null_envp[] = {NULL};
+  pid_t child = fork();
+  if (child == 0) {
+    const unsigned int syscalls[] = {__NR_getppid};
+    EXPECT_OK(cap_enter_ex(CAP_ENTER_DENY, syscalls, 1));
+    fexecve_(fd, argv_pass, null_envp);
+    exit(99);  // Should not reach here.
+  }
+  // The syscall numbers only describe this ABI, so any i386 syscall is fatal.
+  int status;
+  EXPECT_EQ(child, waitpid(child, &status, 0));
+  EXPECT_TRUE(WIFSIGNALED(status)) << " status " << status;
+  if (WIFSIGNALED(status)) {
+    EXPECT_EQ(SIGSYS, WTERMSIG(status));
+  }
+  close(fd);
+}
+#endif
+#endif
+
+#if defined(CAP_ENTER_IO_URING) && defined(HAVE_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+#include <linux/io_uring.h>  // Requires 5.10 kernel for ring restrictions
+
+// Set up a restricted ring for NOP/READ on fd, or skip the test.
+static int RestrictedReadRing(int fd, TestRing *ring) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const unsigned char opcodes[] = {IORING_OP_NOP, IORING_OP_READ};
+  int rc = cap_io_uring_setup(4, &params, opcodes, 2, &fd, 1);
+  if (rc < 0 && errno == ENOSYS) {
+    TEST_SKIPPED("io_uring restrictions unavailable");
+    return rc;
+  }
+  EXPECT_OK(rc);
+  if (rc >= 0) {
+    EXPECT_TRUE(TestRingMap(ring, rc, &params));
+  }
+  return rc;
+}
+
+FORK_TEST_ON(Linux, IoUringCapMode, TmpFile("cap_io_uring")) {
+  int fd = open(TmpFile("cap_io_uring"), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  EXPECT_OK(fd);
+  const char *message = "Hello io_uring";
+  EXPECT_OK(write(fd, message, strlen(message)));
+  cap_rights_t r_pread;
+  cap_rights_init(&r_pread, CAP_PREAD);
+  EXPECT_OK(cap_rights_limit(fd, &r_pread));
+
+  // An unrestricted ring, created outside the library, stays out of reach.
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int plain = io_uring_setup_(4, &params);
+  EXPECT_OK(plain);
+  TestRing ring;
+  int ring_fd = RestrictedReadRing(fd, &ring);
+  if (ring_fd < 0) return;
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_IO_URING, NULL, 0));
+
+  char buffer[32];
+  struct io_uring_sqe *sqe = TestRingGetSqe(&ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = 0;  // index into the registered files
+  sqe->addr = (unsigned long)buffer;
+  sqe->len = sizeof(buffer);
+  EXPECT_EQ(1, TestRingSubmit(&ring));
+  struct io_uring_cqe cqe;
+  EXPECT_TRUE(TestRingReap(&ring, &cqe));
+  EXPECT_EQ((int)strlen(message), cqe.res);
+  EXPECT_EQ(0, memcmp(message, buffer, strlen(message)));
+
+  // The ring refuses plain fds and opcodes that weren't allowed.
+  sqe = TestRingGetSqe(&ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)buffer;
+  sqe->len = sizeof(buffer);
+  EXPECT_EQ(1, TestRingSubmit(&ring));
+  EXPECT_TRUE(TestRingReap(&ring, &cqe));
+  EXPECT_EQ(-EACCES, cqe.res);
+  sqe = TestRingGetSqe(&ring);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->addr = (unsigned long)message;
+  sqe->len = strlen(message);
+  EXPECT_EQ(1, TestRingSubmit(&ring));
+  EXPECT_TRUE(TestRingReap(&ring, &cqe));
+  EXPECT_EQ(-EACCES, cqe.res);
+
+  // No new rings, no changes to this one, and no other rings.
+  memset(&params, 0, sizeof(params));
+  EXPECT_CAPMODE(io_uring_setup_(4, &params));
+  EXPECT_CAPMODE(io_uring_register_(ring_fd, IORING_REGISTER_FILES, &fd, 1));
+  EXPECT_CAPMODE(io_uring_enter_(plain, 0, 0, 0));
+
+  // Nothing else can take over the ring's number.
+  EXPECT_CAPMODE(dup2(plain, ring_fd));
+  EXPECT_CAPMODE(dup3(plain, ring_fd, O_CLOEXEC));
+  EXPECT_CAPMODE(close(ring_fd));
+  EXPECT_OK(io_uring_enter_(ring_fd, 0, 0, 0));
+  close(plain);
+  close(fd);
+}
+
+FORK_TEST(Linux, IoUringReusedRing) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  TestRing ring;
+  int ring_fd = RestrictedReadRing(fd, &ring);
+  if (ring_fd < 0) return;
+  // An unrestricted ring that reuses the number before capability mode is
+  // entered isn't allowed.
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int plain = io_uring_setup_(4, &params);
+  EXPECT_OK(plain);
+  EXPECT_OK(dup2(plain, ring_fd));
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_IO_URING, NULL, 0));
+  EXPECT_CAPMODE(io_uring_enter_(ring_fd, 0, 0, 0));
+  close(plain);
+  close(fd);
+}
+
+FORK_TEST(Linux, IoUringPlainCapMode) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  TestRing ring;
+  int ring_fd = RestrictedReadRing(fd, &ring);
+  if (ring_fd < 0) return;
+  // Without CAP_ENTER_IO_URING, even a restricted ring is off limits.
+  EXPECT_OK(cap_enter());
+  EXPECT_CAPMODE(io_uring_enter_(ring_fd, 0, 0, 0));
+  close(ring_fd);
+  close(fd);
+}
+
+TEST(Linux, IoUringRights) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  cap_rights_t r_fstat;
+  cap_rights_init(&r_fstat, CAP_FSTAT);
+  EXPECT_OK(cap_rights_limit(fd, &r_fstat));
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // Registered files must carry the rights for every allowed opcode.
+  const unsigned char opcodes[] = {IORING_OP_READ};
+  EXPECT_NOTCAPABLE(cap_io_uring_setup(4, &params, opcodes, 1, &fd, 1));
+  // Opcodes that can reach beyond the registered files can't be allowed.
+  const unsigned char openat_op[] = {IORING_OP_OPENAT};
+  EXPECT_SYSCALL_FAIL(EINVAL, cap_io_uring_setup(4, &params, openat_op, 1, NULL, 0));
+  close(fd);
+
+  // Sends can name an address, so they need CAP_CONNECT as sendto(2) does.
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  EXPECT_OK(sock);
+  cap_rights_t r_send;
+  cap_rights_init(&r_send, CAP_SEND);
+  EXPECT_OK(cap_rights_limit(sock, &r_send));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(9);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  EXPECT_NOTCAPABLE(sendto(sock, "x", 1, 0, (struct sockaddr *)&addr, sizeof(addr)));
+  const unsigned char send_ops[][1] = {{IORING_OP_SENDMSG}, {IORING_OP_SEND}};
+  for (const unsigned char *op : send_ops) {
+    memset(&params, 0, sizeof(params));
+    EXPECT_NOTCAPABLE(cap_io_uring_setup(4, &params, op, 1, &sock, 1));
+  }
+  close(sock);
+}
+#endif
+
+// Name used for the native architecture in /proc/<pid>/seccomp_cache.
+#if defined(__x86_64__)
+#define SECCOMP_CACHE_ARCH "x86_64"
+#elif defined(__i386__)
+#define SECCOMP_CACHE_ARCH "i386"
+#endif
+
+#ifdef SECCOMP_CACHE_ARCH
+static bool InSeccompCache(const std::string& cache, int nr) {
+  std::string line = std::string("\n" SECCOMP_CACHE_ARCH " ") + std::to_string(nr) + " ALLOW\n";
+  return ("\n" + cache).find(line) != std::string::npos;
+}
+
+FORK_TEST(Linux, SeccompActionCache) {
+  // The kernel skips running the capability mode filter for syscalls that it
+  // allows without examining any arguments.  Listing them requires
+  // CONFIG_SECCOMP_CACHE_DEBUG and CAP_SYS_ADMIN.
+  char buffer[4096];
+  int fd = open("/proc/self/seccomp_cache", O_RDONLY);
+  if (fd < 0 || read(fd, buffer, sizeof(buffer)) < 0) {
+    TEST_SKIPPED("/proc/self/seccomp_cache not available");
+    if (fd >= 0) close(fd);
+    return;
+  }
+
+  EXPECT_OK(cap_enter());  // Enter capability mode.
+
+  std::string cache;
+  ssize_t len;
+  EXPECT_OK(lseek(fd, 0, SEEK_SET));
+  while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+    cache.append(buffer, len);
+  }
+  EXPECT_OK(len);
+  close(fd);
+
+  // Syscalls allowed outright in capability mode are in the cache...
+  EXPECT_TRUE(InSeccompCache(cache, __NR_read));
+  EXPECT_TRUE(InSeccompCache(cache, __NR_write));
+  EXPECT_TRUE(InSeccompCache(cache, __NR_futex));
+  EXPECT_TRUE(InSeccompCache(cache, __NR_getppid));
+  EXPECT_TRUE(InSeccompCache(cache, __NR_fstat));
+  // ...but those whose arguments are checked are not...
+  EXPECT_FALSE(InSeccompCache(cache, __NR_openat));
+  EXPECT_FALSE(InSeccompCache(cache, __NR_prctl));
+  // ...and nor are those that capability mode refuses.
+  EXPECT_FALSE(InSeccompCache(cache, __NR_mkdir));
+  EXPECT_FALSE(InSeccompCache(cache, __NR_socket));
+}
+#endif
+
+// Number of seccomp filters attached to the process whose status file is
+// open on fd, or -1 if unknown (the count needs a 5.9 kernel).
+static int SeccompFilterCount(int fd) {
+  char buffer[4096];
+  if (lseek(fd, 0, SEEK_SET) < 0) return -1;
+  ssize_t len = read(fd, buffer, sizeof(buffer) - 1);
+  if (len < 0) return -1;
+  buffer[len] = '\0';
+  const char *field = strstr(buffer, "\nSeccomp_filters:");
+  if (field == NULL) return -1;
+  return atoi(field + strlen("\nSeccomp_filters:"));
+}
+
+FORK_TEST(Linux, SandboxedAcrossFork) {
+  EXPECT_FALSE(cap_sandboxed());
+  pid_t child = fork();
+  if (child == 0) {
+    exit((cap_enter() == 0 && cap_sandboxed()) ? 0 : 1);
+  }
+  int status;
+  EXPECT_EQ(child, waitpid(child, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  // The child entering capability mode doesn't affect the parent...
+  EXPECT_FALSE(cap_sandboxed());
+
+  EXPECT_OK(cap_enter());
+  EXPECT_TRUE(cap_sandboxed());
+  // ...but children of a sandboxed parent start out sandboxed.
+  child = fork();
+  if (child == 0) {
+    unsigned int mode = 0;
+    exit((cap_getmode(&mode) == 0 && mode == 1 && cap_sandboxed()) ? 0 : 1);
+  }
+  EXPECT_EQ(child, waitpid(child, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+FORK_TEST(Linux, CapEnterRepeated) {
+  int fd = open("/proc/self/status", O_RDONLY);
+  EXPECT_OK(fd);
+  int before = SeccompFilterCount(fd);
+  if (before < 0) {
+    TEST_SKIPPED("Seccomp_filters not in /proc/self/status");
+    close(fd);
+    return;
+  }
+  EXPECT_OK(cap_enter());  // Enter capability mode.
+  EXPECT_EQ(before + 1, SeccompFilterCount(fd));
+  // Entering again is a no-op, and doesn't stack another filter.
+  EXPECT_OK(cap_enter());
+  EXPECT_OK(cap_enter_ex(0, NULL, 0));
+  EXPECT_EQ(before + 1, SeccompFilterCount(fd));
+  unsigned int mode = 0;
+  EXPECT_OK(cap_getmode(&mode));
+  EXPECT_EQ(1, (int)mode);
+  close(fd);
+}
+
+#ifdef PR_SET_OPENAT_BENEATH
+FORK_TEST(Linux, CapEnterForeignFilter) {
+  int fd = open("/proc/self/status", O_RDONLY);
+  EXPECT_OK(fd);
+  // Someone else's filter (as from a container runtime) along with
+  // openat-beneath mode looks like capability mode from outside...
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
+  };
+  struct sock_fprog bpf;
+  bpf.len = (sizeof(filter) / sizeof(filter[0]));
+  bpf.filter = filter;
+  EXPECT_OK(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+  EXPECT_OK(prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &bpf, 0, 0));
+  EXPECT_OK(prctl(PR_SET_OPENAT_BENEATH, 1, 0, 0, 0));
+  int before = SeccompFilterCount(fd);
+  // ...but cap_enter() still has to install the capability mode filter.
+  EXPECT_OK(cap_enter());
+  if (before >= 0) {
+    EXPECT_EQ(before + 1, SeccompFilterCount(fd));
+  }
+  EXPECT_CAPMODE(open("/etc/passwd", O_RDONLY));
+  close(fd);
+}
+#endif
+
 TEST(Linux, AIO) {
   int fd = open(TmpFile("cap_aio"), O_CREAT|O_RDWR, 0644);
   EXPECT_OK(fd);
@@ -1255,6 +1645,98 @@ TEST(Linux, ProcFS) {
   close(fd);
 }
 
+TEST(Linux, ProcFSAudit) {
+  cap_rights_t rights;
+  cap_rights_init(&rights, CAP_READ, CAP_SEEK);
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  int cap = dup(fd);
+  EXPECT_OK(cap);
+  EXPECT_OK(cap_rights_limit(cap, &rights));
+  pid_t me = getpid_();
+
+  struct cap_audit_report report;
+  EXPECT_OK(cap_audit_scan(NULL, &me, 1, 2, 0, &report));
+  EXPECT_EQ(1U, report.nprocs);
+  const struct cap_audit_fd *found_fd = NULL, *found_cap = NULL;
+  for (size_t ii = 0; ii < report.nfds; ii++) {
+    EXPECT_EQ(me, report.fds[ii].pid);
+    if (ii > 0) {
+      EXPECT_LT(report.fds[ii - 1].fd, report.fds[ii].fd);
+    }
+    if (report.fds[ii].fd == fd) found_fd = &report.fds[ii];
+    if (report.fds[ii].fd == cap) found_cap = &report.fds[ii];
+  }
+  EXPECT_NE((const struct cap_audit_fd *)NULL, found_fd);
+  EXPECT_NE((const struct cap_audit_fd *)NULL, found_cap);
+  if (found_fd && found_cap) {
+    EXPECT_EQ(0, found_fd->flags & CAP_AUDIT_LIMITED);
+    EXPECT_EQ(CAP_AUDIT_RIGHTS|CAP_AUDIT_LIMITED, found_cap->flags);
+    EXPECT_RIGHTS_EQ(&rights, &found_cap->rights);
+
+    const char *names[64];
+    size_t nnames = cap_rights_names(&found_cap->rights, names, 64);
+    EXPECT_LE(2U, nnames);
+    std::set<std::string> named(names, names + std::min<size_t>(nnames, 64));
+    EXPECT_EQ(1U, named.count("READ"));
+    EXPECT_EQ(1U, named.count("SEEK"));
+    EXPECT_EQ(0U, named.count("WRITE"));
+  }
+  cap_audit_free(&report);
+
+  // Only the limited descriptor is left when asked for.
+  EXPECT_OK(cap_audit_scan(NULL, &me, 1, 1, CAP_AUDIT_ONLY_LIMITED, &report));
+  bool seen_cap = false;
+  for (size_t ii = 0; ii < report.nfds; ii++) {
+    EXPECT_NE(fd, report.fds[ii].fd);
+    if (report.fds[ii].fd == cap) seen_cap = true;
+  }
+  EXPECT_TRUE(seen_cap);
+  cap_audit_free(&report);
+
+  close(cap);
+  close(fd);
+}
+
+TEST(Linux, ProcFSAuditLongFdinfo) {
+  // An epoll descriptor's fdinfo has a line for every watched descriptor,
+  // so runs to several kilobytes.
+  const int kWatches = 100;
+  int epoll_fd = epoll_create1(0);
+  EXPECT_OK(epoll_fd);
+  int events[kWatches];
+  for (int ii = 0; ii < kWatches; ii++) {
+    events[ii] = eventfd(0, 0);
+    EXPECT_OK(events[ii]);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    EXPECT_OK(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, events[ii], &ev));
+  }
+  cap_rights_t rights;
+  cap_rights_init(&rights, CAP_EVENT, CAP_EPOLL_CTL);
+  EXPECT_OK(cap_rights_limit(epoll_fd, &rights));
+  pid_t me = getpid_();
+
+  struct cap_audit_report report;
+  EXPECT_OK(cap_audit_scan(NULL, &me, 1, 1, 0, &report));
+  const struct cap_audit_fd *found = NULL;
+  for (size_t ii = 0; ii < report.nfds; ii++) {
+    if (report.fds[ii].fd == epoll_fd) found = &report.fds[ii];
+  }
+  EXPECT_NE((const struct cap_audit_fd *)NULL, found);
+  if (found) {
+    EXPECT_EQ(CAP_AUDIT_RIGHTS|CAP_AUDIT_LIMITED, found->flags);
+    EXPECT_RIGHTS_EQ(&rights, &found->rights);
+  }
+  cap_audit_free(&report);
+
+  for (int ii = 0; ii < kWatches; ii++) {
+    close(events[ii]);
+  }
+  close(epoll_fd);
+}
+
 FORK_TEST(Linux, ProcessClocks) {
   pid_t self = getpid_();
   pid_t child = fork();
@@ -1391,6 +1873,15 @@ FORK_TEST_ON(Linux, OpenByHandleAt, TmpFile("cap_openbyhandle_testfile")) {
   close(dir);
 }
 
+#ifdef __NR_rseq
+FORK_TEST(Linux, Rseq) {
+  EXPECT_OK(cap_enter());  // Enter capability mode.
+  // rseq(2) is allowed; a bogus registration fails with EINVAL (or EBUSY if
+  // libc has registered already).
+  EXPECT_FAIL_NOT_CAPMODE(syscall(__NR_rseq, NULL, 0, 0, 0));
+}
+#endif
+
 int getrandom_(void *buf, size_t buflen, unsigned int flags) {
 #ifdef __NR_getrandom
   return syscall(__NR_getrandom, buf, buflen, flags);
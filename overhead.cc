@@ -1,45 +1,622 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/cappolicy.h>
+#include <sys/timerfd.h>
+#endif
 
 #include "capsicum.h"
 #include "syscalls.h"
 #include "capsicum-test.h"
 
 #ifdef HAVE_SYSCALL
-double RepeatSyscall(int count, int nr, long arg1, long arg2, long arg3) {
+double RepeatSyscall(int count, int nr, long arg1, long arg2, long arg3,
+                     long arg4 = 0, long arg5 = 0, long arg6 = 0) {
   const clock_t t0 = clock(); // or gettimeofday or whatever
   for (int ii = 0; ii < count; ii++) {
-    syscall(nr, arg1, arg2, arg3);
+    syscall(nr, arg1, arg2, arg3, arg4, arg5, arg6);
   }
   const clock_t t1 = clock();
   return (t1 - t0) / (double)CLOCKS_PER_SEC;
 }
 
+// Ratio of two CPU times, allowing for either being too short to measure.
+double TimeRatio(double time, double base) {
+  if (base==0.0) {
+    if (time==0.0) return 1.0;
+    return 999.0;
+  }
+  return time/base;
+}
+
 typedef int (*EntryFn)(void);
 
 double CompareSyscall(EntryFn entry_fn, int count, int nr,
-                      long arg1, long arg2, long arg3) {
-  double bare = RepeatSyscall(count, nr, arg1, arg2, arg3);
+                      long arg1, long arg2, long arg3,
+                      long arg4 = 0, long arg5 = 0, long arg6 = 0) {
+  double bare = RepeatSyscall(count, nr, arg1, arg2, arg3, arg4, arg5, arg6);
   EXPECT_OK(entry_fn());
-  double capmode = RepeatSyscall(count, nr, arg1, arg2, arg3);
+  double capmode = RepeatSyscall(count, nr, arg1, arg2, arg3, arg4, arg5, arg6);
   if (verbose) fprintf(stderr, "%d iterations bare=%fs capmode=%fs ratio=%.2f%%\n",
                        count, bare, capmode, 100.0*capmode/bare);
-  if (bare==0.0) {
-    if (capmode==0.0) return 1.0;
-    return 999.0;
-  }
-  return capmode/bare;
+  return TimeRatio(capmode, bare);
 }
 
 FORK_TEST(Overhead, GetTid) {
   EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_gettid, 0, 0, 0));
 }
+FORK_TEST(Overhead, GetPpid) {
+  // getppid(2) is far down the capability mode rule list.
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_getppid, 0, 0, 0));
+}
+#ifdef CAP_ENTER_ALLOW
+static int EnterGetPpidOnly(void) {
+  // Just the syscalls that the benchmark itself needs.
+  static const unsigned int syscalls[] = {__NR_getppid, __NR_clock_gettime, __NR_times,
+                                          __NR_write, __NR_exit, __NR_exit_group};
+  return cap_enter_ex(CAP_ENTER_ALLOW, syscalls, sizeof(syscalls)/sizeof(syscalls[0]));
+}
+FORK_TEST(Overhead, GetPpidAllowList) {
+  // A filter restricted to a few syscalls needs only a few checks.
+  EXPECT_GT(10, CompareSyscall(&EnterGetPpidOnly, 10000, __NR_getppid, 0, 0, 0));
+}
+#endif
+
+// Time a syscall that runs the filter (unlike getppid(2), which the kernel's
+// action cache allows without running any), entering capability mode again
+// and again up to 8 deep.
+static void NestedPrctl(EntryFn entry_fn, double cost[4]) {
+  const int depths[] = {1, 2, 4, 8};
+  int depth = 0;
+  for (int ii = 0; ii < 4; ii++) {
+    for (; depth < depths[ii]; depth++) {
+      EXPECT_OK(entry_fn());
+    }
+    cost[ii] = RepeatSyscall(10000, __NR_prctl, PR_GET_SECCOMP, 0, 0);
+    if (verbose) fprintf(stderr, "depth %d: %fs\n", depth, cost[ii]);
+  }
+}
+FORK_TEST(Overhead, NestedCapEnter) {
+  // Repeated cap_enter() calls, as in sandboxed helpers forked from a
+  // sandboxed parent, don't stack filters and so don't add to syscall cost.
+  double cost[4];
+  NestedPrctl(&cap_enter, cost);
+  EXPECT_GT(2, TimeRatio(cost[3], cost[0]));
+}
+#ifdef CAP_ENTER_DENY
+static int EnterStacked(void) {
+  // An empty deny list gives the full capability mode filter, but always
+  // installs another copy of it.
+  return cap_enter_ex(CAP_ENTER_DENY, NULL, 0);
+}
+FORK_TEST(Overhead, NestedFilters) {
+  // For comparison: each stacked filter runs on every checked syscall.
+  double cost[4];
+  NestedPrctl(&EnterStacked, cost);
+}
+#endif
+
+static double RepeatSandboxed(int count) {
+  volatile bool sandboxed;
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < count; ii++) {
+    sandboxed = cap_sandboxed();
+  }
+  const clock_t t1 = clock();
+  (void)sandboxed;
+  return (t1 - t0) / (double)CLOCKS_PER_SEC;
+}
+FORK_TEST(Overhead, CapSandboxed) {
+  // Outside capability mode every check asks the kernel; inside, the answer
+  // can't change, so it comes straight from the library.
+  double bare = RepeatSandboxed(100000);
+  EXPECT_OK(cap_enter());
+  double capmode = RepeatSandboxed(100000);
+  if (verbose) fprintf(stderr, "100000 cap_sandboxed() bare=%fs capmode=%fs\n",
+                       bare, capmode);
+  EXPECT_GT(1, TimeRatio(capmode, bare));
+#ifdef CAP_ENTER_DENY
+  // Once entered, the answer needs no prctl(2) calls at all.
+  static const unsigned int no_prctl[] = {__NR_prctl};
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_DENY, no_prctl, 1));
+  EXPECT_TRUE(cap_sandboxed());
+#endif
+}
+#ifdef __linux__
+// Restricting many preopened descriptors, as a server does at startup.
+FORK_TEST(Overhead, RightsLimitMany) {
+  const int kCount = 512;
+  int fds[kCount], fds2[kCount];
+  int base = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(base);
+  for (int ii = 0; ii < kCount; ii++) {
+    fds[ii] = dup(base);
+    fds2[ii] = dup(base);
+  }
+  cap_rights_t r_rs;
+  cap_rights_init(&r_rs, CAP_READ, CAP_SEEK);
+
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_OK(cap_rights_limit(fds[ii], &r_rs));
+  }
+  const clock_t t1 = clock();
+  EXPECT_OK(cap_rights_limit_many(fds2, kCount, &r_rs, NULL));
+  const clock_t t2 = clock();
+  double single = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double batch = (t2 - t1) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "%d fds: cap_rights_limit=%fs cap_rights_limit_many=%fs\n",
+                       kCount, single, batch);
+  // The batch skips the cap_rights_get(2) that each single call makes.
+  EXPECT_GT(2, TimeRatio(batch, single));
+  for (int ii = 0; ii < kCount; ii++) {
+    cap_rights_t rights;
+    EXPECT_OK(cap_rights_get(fds2[ii], &rights));
+    EXPECT_RIGHTS_EQ(&r_rs, &rights);
+  }
+  for (int ii = 0; ii < kCount; ii++) {
+    close(fds[ii]);
+    close(fds2[ii]);
+  }
+  close(base);
+}
+
+// Sandbox setup from a policy, against the equivalent hand-written calls.
+FORK_TEST(Overhead, PolicyApply) {
+  const int kCount = 1024;
+  static int fds[kCount], fds2[kCount], roles[kCount];
+  struct cap_policy *policy = cap_policy_compile(
+      "data rights=READ,SEEK,FSTAT\n"
+      "log  rights=WRITE,FSTAT fcntls=GETFL\n"
+      "tty  rights=READ,WRITE ioctls=0x541B\n", NULL);
+  EXPECT_NE((struct cap_policy *)NULL, policy);
+  if (!policy) return;
+  int base = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(base);
+  for (int ii = 0; ii < kCount; ii++) {
+    fds[ii] = dup(base);
+    fds2[ii] = dup(base);
+    roles[ii] = ii % 3;
+  }
+  cap_rights_t r_rsf, r_wff, r_rwi;
+  cap_rights_init(&r_rsf, CAP_READ, CAP_SEEK, CAP_FSTAT);
+  cap_rights_init(&r_wff, CAP_WRITE, CAP_FSTAT, CAP_FCNTL);
+  cap_rights_init(&r_rwi, CAP_READ, CAP_WRITE, CAP_IOCTL);
+  cap_ioctl_t ioctl_nread = 0x541B;
+
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < kCount; ii++) {
+    switch (roles[ii]) {
+    case 0:
+      EXPECT_OK(cap_rights_limit(fds[ii], &r_rsf));
+      break;
+    case 1:
+      EXPECT_OK(cap_rights_limit(fds[ii], &r_wff));
+      EXPECT_OK(cap_fcntls_limit(fds[ii], CAP_FCNTL_GETFL));
+      break;
+    case 2:
+      EXPECT_OK(cap_rights_limit(fds[ii], &r_rwi));
+      EXPECT_OK(cap_ioctls_limit(fds[ii], &ioctl_nread, 1));
+      break;
+    }
+  }
+  const clock_t t1 = clock();
+  EXPECT_OK(cap_policy_apply(policy, fds2, roles, kCount, NULL));
+  const clock_t t2 = clock();
+  double single = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double policy_time = (t2 - t1) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "%d fds: hand-coded=%fs cap_policy_apply=%fs\n",
+                       kCount, single, policy_time);
+  // One system call per descriptor, rather than two to four.
+  EXPECT_GT(2, TimeRatio(policy_time, single));
+  for (int ii = 0; ii < kCount; ii++) {
+    cap_rights_t r1, r2;
+    EXPECT_OK(cap_rights_get(fds[ii], &r1));
+    EXPECT_OK(cap_rights_get(fds2[ii], &r2));
+    EXPECT_RIGHTS_EQ(&r1, &r2);
+    close(fds[ii]);
+    close(fds2[ii]);
+  }
+  close(base);
+  cap_policy_free(policy);
+}
+
+// A supervisor collecting exits from many children: a loop polling each
+// child with waitpid(WNOHANG), against one reaper for all of their
+// process descriptors.
+FORK_TEST(Overhead, PdReaper) {
+  const int kCount = 500;
+  static pid_t pids[kCount];
+  static int pds[kCount];
+
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < kCount; ii++) {
+    pids[ii] = fork();
+    if (pids[ii] == 0) {
+      usleep((ii % 20) * 1000);
+      _exit(0);
+    }
+    EXPECT_OK(pids[ii]);
+  }
+  int left = kCount;
+  while (left > 0) {
+    for (int ii = 0; ii < kCount; ii++) {
+      if (pids[ii] > 0 && waitpid(pids[ii], NULL, WNOHANG) == pids[ii]) {
+        pids[ii] = 0;
+        left--;
+      }
+    }
+  }
+  const clock_t t1 = clock();
+  int reaper = pd_reaper_create(0);
+  EXPECT_OK(reaper);
+  for (int ii = 0; ii < kCount; ii++) {
+    pid_t pid = pdfork(&pds[ii], 0);
+    if (pid == 0) {
+      usleep((ii % 20) * 1000);
+      _exit(0);
+    }
+    EXPECT_OK(pid);
+    EXPECT_OK(pd_reaper_add(reaper, pds[ii]));
+  }
+  left = kCount;
+  while (left > 0) {
+    struct pd_reaped reaped[64];
+    int n = pd_reaper_wait(reaper, reaped, 64, -1);
+    EXPECT_OK(n);
+    if (n < 0) break;
+    for (int ii = 0; ii < n; ii++) {
+      close(reaped[ii].pd);
+    }
+    left -= n;
+  }
+  const clock_t t2 = clock();
+  close(reaper);
+  double polling = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double reaping = (t2 - t1) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "%d children: waitpid loop=%fs CPU, pd_reaper=%fs CPU\n",
+                       kCount, polling, reaping);
+  // The reaper sleeps until there's something to collect.
+  EXPECT_EQ(0, left);
+  EXPECT_GT(2, TimeRatio(reaping, polling));
+}
+
+// Spawning a helper from a parent with a large resident set: pdfork() copies
+// the page tables (and the parent then takes copy-on-write faults), pdspawn()
+// doesn't.  The full 1GB is only used when the timings are reported.
+FORK_TEST(Overhead, PdSpawn) {
+  const size_t kResident = verbose ? (1UL << 30) : (64UL << 20);
+  const int kCount = 50;
+  static char* argv[] = {(char*)"./mini-me", (char*)"--pass", NULL};
+  static char* envp[] = {NULL};
+  int exec_fd = open("./mini-me", O_RDONLY);
+  EXPECT_OK(exec_fd);
+  char *mem = (char*)mmap(NULL, kResident, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    TEST_SKIPPED("can't map resident memory");
+    return;
+  }
+  memset(mem, 'x', kResident);
+
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < kCount; ii++) {
+    int pd;
+    pid_t pid = pdfork(&pd, 0);
+    if (pid == 0) {
+      fexecve_(exec_fd, argv, envp);
+      _exit(1);
+    }
+    EXPECT_OK(pid);
+    mem[(ii * 4096) % kResident]++;  // as the parent would carry on working
+    int status = -1;
+    EXPECT_EQ(pid, pdwait4(pd, &status, 0, NULL));
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << " status " << status;
+    close(pd);
+  }
+  const clock_t t1 = clock();
+  for (int ii = 0; ii < kCount; ii++) {
+    int pd;
+    pid_t pid = pdspawn(&pd, exec_fd, NULL, argv, envp, 0);
+    EXPECT_OK(pid);
+    mem[(ii * 4096) % kResident]++;
+    int status = -1;
+    EXPECT_EQ(pid, pdwait4(pd, &status, 0, NULL));
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << " status " << status;
+    close(pd);
+  }
+  const clock_t t2 = clock();
+  munmap(mem, kResident);
+  close(exec_fd);
+
+  double forking = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double spawning = (t2 - t1) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "%d spawns with %zuMB resident: pdfork=%fms each, pdspawn=%fms each\n",
+                       kCount, kResident >> 20, 1000 * forking / kCount, 1000 * spawning / kCount);
+  EXPECT_GT(2, TimeRatio(spawning, forking));
+}
+
+// Policy evaluation over a large table of rights, one pair at a time versus
+// the array entry points.
+TEST(Overhead, RightsAlgebraMany) {
+  const int kCount = 4096;
+  const int kRounds = 200;
+  static cap_rights_t have[kCount], want[kCount], merged[kCount], merged_single[kCount];
+  static bool results[kCount];
+  for (int ii = 0; ii < kCount; ii++) {
+    cap_rights_init(&have[ii], CAP_READ, CAP_FSTAT, CAP_EVENT);
+    if (ii % 3) cap_rights_set(&have[ii], CAP_SEEK, CAP_WRITE);
+    cap_rights_init(&want[ii], CAP_READ, CAP_SEEK);
+  }
+
+  size_t single_count = 0, many_count = 0;
+  const clock_t t0 = clock();
+  for (int round = 0; round < kRounds; round++) {
+    for (int ii = 0; ii < kCount; ii++) {
+      results[ii] = cap_rights_contains(&have[ii], &want[ii]);
+      single_count += results[ii];
+      merged_single[ii] = have[ii];
+      cap_rights_merge(&merged_single[ii], &want[ii]);
+    }
+  }
+  const clock_t t1 = clock();
+  for (int round = 0; round < kRounds; round++) {
+    many_count += cap_rights_contains_many(have, want, kCount, results);
+    memcpy(merged, have, sizeof(merged));
+    cap_rights_merge_many(merged, want, kCount);
+  }
+  const clock_t t2 = clock();
+  EXPECT_EQ(single_count, many_count);
+
+  double single = (t1 - t0) / (double)CLOCKS_PER_SEC;
+  double many = (t2 - t1) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "%d rights x %d: single=%fs (%.0f/s) many=%fs (%.0f/s)\n",
+                       kCount, kRounds, single, kCount * kRounds / (single + 1e-9),
+                       many, kCount * kRounds / (many + 1e-9));
+  // cap_rights_merge() revalidates both arguments for every pair.
+  EXPECT_GT(2, TimeRatio(many, single));
+  EXPECT_EQ(0, memcmp(merged_single, merged, sizeof(merged)));
+}
+
+// Large ioctl allowlists, as in Ioctl.ManySubRights: each limit call reads
+// the list back, and cap_ioctls_allowed() searches it.
+FORK_TEST(Overhead, IoctlsLarge) {
+#ifdef CAP_IOCTLS_LIMIT_MAX
+  const int kIoctls = CAP_IOCTLS_LIMIT_MAX;
+#else
+  const int kIoctls = 150000;
+#endif
+  const int kLimits = 100;
+  const int kLookups = 100000;
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  cap_ioctl_t* ioctls = (cap_ioctl_t*)calloc(kIoctls, sizeof(cap_ioctl_t));
+  for (int ii = 0; ii < kIoctls; ii++) {
+    ioctls[ii] = kIoctls - ii;  // reversed, so the library has to sort it
+  }
+  cap_rights_t r_fi;
+  cap_rights_init(&r_fi, CAP_FCNTL, CAP_IOCTL);
+  EXPECT_OK(cap_rights_limit(fd, &r_fi));
+  const clock_t t0 = clock();
+  EXPECT_OK(cap_ioctls_limit(fd, ioctls, kIoctls));
+  const clock_t t1 = clock();
+  for (int ii = 0; ii < kLimits; ii++) {
+    EXPECT_OK(cap_fcntls_limit(fd, CAP_FCNTL_GETFL));
+  }
+  const clock_t t2 = clock();
+  int found = 0;
+  for (int ii = 0; ii < kLookups; ii++) {
+    found += cap_ioctls_allowed(fd, (ii * 7919) % (2 * kIoctls));
+  }
+  const clock_t t3 = clock();
+  cap_rights_cache_enable(true);
+  for (int ii = 0; ii < kLookups; ii++) {
+    found -= cap_ioctls_allowed(fd, (ii * 7919) % (2 * kIoctls));
+  }
+  const clock_t t4 = clock();
+  EXPECT_EQ(0, found);
+#ifdef CAP_ENTER_DENY
+  // Cached lookups don't ask the kernel at all.
+  static const unsigned int no_rights_get[] = {__NR_cap_rights_get};
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_DENY, no_rights_get, 1));
+  EXPECT_EQ(1, cap_ioctls_allowed(fd, 1));
+  EXPECT_EQ(0, cap_ioctls_allowed(fd, kIoctls + 1));
+#endif
+  cap_rights_cache_enable(false);
+
+  double lookup_kernel = (t3 - t2) / (double)CLOCKS_PER_SEC;
+  double lookup_cached = (t4 - t3) / (double)CLOCKS_PER_SEC;
+  if (verbose) fprintf(stderr, "%d ioctls: limit=%fs %d fcntl limits=%fs "
+                       "%d lookups kernel=%fs cached=%fs\n",
+                       kIoctls, (t1 - t0) / (double)CLOCKS_PER_SEC,
+                       kLimits, (t2 - t1) / (double)CLOCKS_PER_SEC,
+                       kLookups, lookup_kernel, lookup_cached);
+  EXPECT_GT(2, TimeRatio(lookup_cached, lookup_kernel));
+  free(ioctls);
+  close(fd);
+}
+#endif
 FORK_TEST(Overhead, Seek) {
   int fd = open("/etc/passwd", O_RDONLY);
   EXPECT_GT(50, CompareSyscall(&cap_enter, 10000, __NR_lseek, fd, 0, SEEK_SET));
   close(fd);
 }
+
+#if defined(CAP_ENTER_IO_URING) && defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#define RING_BATCH 32
+#define RING_BLOCK 512
+#define RING_FILE_BLOCKS 64
+
+// Time count block reads or writes at successive offsets, one syscall each.
+static double RepeatPio(int fd, int count, bool write) {
+  char buffer[RING_BLOCK];
+  memset(buffer, 'x', sizeof(buffer));
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < count; ii++) {
+    off_t offset = (ii % RING_FILE_BLOCKS) * RING_BLOCK;
+    if (write) {
+      pwrite(fd, buffer, sizeof(buffer), offset);
+    } else {
+      pread(fd, buffer, sizeof(buffer), offset);
+    }
+  }
+  const clock_t t1 = clock();
+  return (t1 - t0) / (double)CLOCKS_PER_SEC;
+}
+
+// The same, through registered file 0 of the ring, RING_BATCH at a time.
+static double RepeatRing(TestRing *ring, int count, bool write) {
+  static char buffer[RING_BATCH][RING_BLOCK];
+  struct io_uring_cqe cqe;
+  const clock_t t0 = clock();
+  for (int ii = 0; ii < count; ii += RING_BATCH) {
+    for (int jj = 0; jj < RING_BATCH; jj++) {
+      struct io_uring_sqe *sqe = TestRingGetSqe(ring);
+      sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe->flags = IOSQE_FIXED_FILE;
+      sqe->fd = 0;
+      sqe->addr = (unsigned long)buffer[jj];
+      sqe->len = RING_BLOCK;
+      sqe->off = ((ii + jj) % RING_FILE_BLOCKS) * RING_BLOCK;
+    }
+    EXPECT_EQ(RING_BATCH, TestRingSubmit(ring));
+    while (TestRingReap(ring, &cqe)) {
+      EXPECT_EQ(RING_BLOCK, cqe.res);
+    }
+  }
+  const clock_t t1 = clock();
+  return (t1 - t0) / (double)CLOCKS_PER_SEC;
+}
+
+FORK_TEST_ON(Overhead, IoUringReadWrite, TmpFile("cap_overhead_io_uring")) {
+  int fd = open(TmpFile("cap_overhead_io_uring"), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  EXPECT_OK(fd);
+  EXPECT_OK(ftruncate(fd, RING_FILE_BLOCKS * RING_BLOCK));
+  cap_rights_t r_rw;
+  cap_rights_init(&r_rw, CAP_PREAD, CAP_PWRITE);
+  EXPECT_OK(cap_rights_limit(fd, &r_rw));
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const unsigned char opcodes[] = {IORING_OP_READ, IORING_OP_WRITE};
+  int ring_fd = cap_io_uring_setup(RING_BATCH, &params, opcodes, 2, &fd, 1);
+  if (ring_fd < 0 && errno == ENOSYS) {
+    TEST_SKIPPED("io_uring restrictions unavailable");
+    return;
+  }
+  EXPECT_OK(ring_fd);
+  TestRing ring;
+  ASSERT_TRUE(TestRingMap(&ring, ring_fd, &params));
+  EXPECT_OK(cap_enter_ex(CAP_ENTER_IO_URING, NULL, 0));
+
+  const int count = 32 * 1024;
+  for (int writing = 0; writing < 2; writing++) {
+    double syscalls = RepeatPio(fd, count, writing);
+    double batched = RepeatRing(&ring, count, writing);
+    if (verbose) fprintf(stderr, "%d %s: pio=%fs io_uring=%fs ratio=%.2f%%\n",
+                         count, writing ? "writes" : "reads", syscalls, batched,
+                         100.0*batched/syscalls);
+    // Batching should at least keep up with a syscall per block.
+    EXPECT_GT(2, TimeRatio(batched, syscalls));
+  }
+  close(ring_fd);
+  close(fd);
+}
+#endif
+
+// Zero-copy and high-throughput I/O syscalls allowed in capability mode.
+#ifdef HAVE_SPLICE
+FORK_TEST(Overhead, Splice) {
+  int pipe1[2], pipe2[2];
+  EXPECT_OK(pipe(pipe1));
+  EXPECT_OK(pipe(pipe2));
+  // Empty pipe, so each call returns EAGAIN.
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_splice, pipe1[0], 0, pipe2[1],
+                               0, 4096, SPLICE_F_NONBLOCK));
+}
+#endif
+#ifdef HAVE_TEE
+FORK_TEST(Overhead, Tee) {
+  int pipe1[2], pipe2[2];
+  EXPECT_OK(pipe(pipe1));
+  EXPECT_OK(pipe(pipe2));
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_tee, pipe1[0], pipe2[1], 4096,
+                               SPLICE_F_NONBLOCK));
+}
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+FORK_TEST(Overhead, CopyFileRange) {
+  int fd_in = open("/etc/passwd", O_RDONLY);
+  int fd_out = open(TmpFile("cap_overhead_copy"), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  EXPECT_OK(fd_out);
+  loff_t off_in = 0, off_out = 0;
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_copy_file_range, fd_in, (long)&off_in,
+                               fd_out, (long)&off_out, 0, 0));
+  close(fd_out);
+  close(fd_in);
+  unlink(TmpFile("cap_overhead_copy"));
+}
+#endif
+#ifdef HAVE_FALLOCATE
+FORK_TEST(Overhead, Fallocate) {
+  int fd = open(TmpFile("cap_overhead_fallocate"), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  EXPECT_OK(fd);
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_fallocate, fd, FALLOC_FL_KEEP_SIZE, 0, 4096));
+  close(fd);
+  unlink(TmpFile("cap_overhead_fallocate"));
+}
+#endif
+#ifdef __NR_fadvise64
+FORK_TEST(Overhead, Fadvise) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_fadvise64, fd, 0, 0, POSIX_FADV_NORMAL));
+  close(fd);
+}
+#endif
+#ifdef HAVE_PREADV2
+FORK_TEST(Overhead, Preadv2) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  char buffer[16];
+  struct iovec io = {buffer, sizeof(buffer)};
+  EXPECT_GT(50, CompareSyscall(&cap_enter, 10000, __NR_preadv2, fd, (long)&io, 1, 0, 0, 0));
+  close(fd);
+}
+#endif
+#ifdef HAVE_MREMAP
+FORK_TEST(Overhead, Mremap) {
+  size_t size = getpagesize();
+  void *mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  // Same size, so the mapping stays put.
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_mremap, (long)mem, size, size, 0));
+  munmap(mem, size);
+}
+#endif
+#ifdef HAVE_SCHED_GETAFFINITY
+FORK_TEST(Overhead, SchedGetAffinity) {
+  cpu_set_t cpus;
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_sched_getaffinity, 0, sizeof(cpus), (long)&cpus));
+}
+#endif
+#ifdef HAVE_CLOCK_NANOSLEEP
+FORK_TEST(Overhead, ClockNanosleep) {
+  struct timespec ts = {0, 0};
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 1000, __NR_clock_nanosleep, CLOCK_MONOTONIC, 0, (long)&ts, 0));
+}
+#endif
+#ifdef __linux__
+FORK_TEST(Overhead, TimerFDGettime) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  struct itimerspec ispec;
+  EXPECT_GT(10, CompareSyscall(&cap_enter, 10000, __NR_timerfd_gettime, fd, (long)&ispec, 0));
+  close(fd);
+}
+#endif
 #endif
@@ -458,7 +458,11 @@ TEST_F(PipePdfork, FdInfo) {
   EXPECT_NE((char*)NULL, strstr(buffer, "pos:\t0")) << buffer;
   // ...and the underlying pid
   char pidline[256];
+#ifdef HAVE_PD_KILL_ON_CLOSE
   sprintf(pidline, "pid:\t%d", pid_);
+#else
+  sprintf(pidline, "Pid:\t%d", pid_);  // pidfd
+#endif
   EXPECT_NE((char*)NULL, strstr(buffer, pidline)) << buffer;
   close(procfd);
 }
@@ -474,6 +478,10 @@ TEST_F(PipePdfork, Close) {
   EXPECT_OK(close(pd_));
   pd_ = -1;
   EXPECT_FALSE(had_signal[SIGCHLD]);
+#ifndef HAVE_PD_KILL_ON_CLOSE
+  EXPECT_PID_ALIVE(pid_);
+  EXPECT_OK(kill(pid_, SIGKILL));
+#endif
   EXPECT_PID_DEAD(pid_);
 
 #ifdef __FreeBSD__
@@ -513,6 +521,10 @@ TEST_F(PipePdfork, CloseLast) {
   EXPECT_EQ(0, errno);
 
   EXPECT_OK(close(pd_other));
+#ifndef HAVE_PD_KILL_ON_CLOSE
+  EXPECT_PID_ALIVE(pid_);
+  EXPECT_OK(kill(pid_, SIGKILL));
+#endif
   EXPECT_PID_DEAD(pid_);
 
   EXPECT_FALSE(had_signal[SIGCHLD]);
@@ -975,3 +987,146 @@ TEST_F(PipePdfork, PassProcessDescriptor) {
   EXPECT_PID_DEAD(child2);
   EXPECT_PID_DEAD(pid_);
 }
+
+#ifdef __linux__
+//------------------------------------------------
+// Reaping many process descriptors at once.
+
+// Fork up to count children that each wait for the pipe to close and then
+// exit with (index % 128); returns how many were started.
+static int PdforkMany(int count, int *pds, int reaper) {
+  // Enough descriptors for all of the children, if we can get them.
+  struct rlimit rl;
+  EXPECT_OK(getrlimit(RLIMIT_NOFILE, &rl));
+  if (rl.rlim_cur < (rlim_t)count + 64 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = (rl.rlim_max < (rlim_t)count + 64) ? rl.rlim_max : count + 64;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (rl.rlim_cur < (rlim_t)count + 64) count = rl.rlim_cur - 64;
+
+  int pipes[2];
+  EXPECT_OK(pipe(pipes));
+  int started;
+  for (started = 0; started < count; started++) {
+    int rc = pdfork(&pds[started], 0);
+    if (rc == 0) {
+      char ch;
+      close(pipes[1]);
+      read(pipes[0], &ch, sizeof(ch));
+      _exit(started % 128);
+    }
+    if (rc < 0) break;
+    EXPECT_OK(pd_reaper_add(reaper, pds[started]));
+  }
+  close(pipes[0]);
+  close(pipes[1]);  // Off they go.
+  return started;
+}
+
+struct ReaperState {
+  int reaper;
+  int count;
+  std::map<int, int> *index;  // pd => child number
+  pthread_mutex_t lock;
+  int reaped;
+  int seen_twice;
+  int bad_status;
+};
+
+static void *ReaperThread(void *arg) {
+  ReaperState *state = static_cast<ReaperState *>(arg);
+  struct pd_reaped reaped[32];
+  while (true) {
+    pthread_mutex_lock(&state->lock);
+    bool done = (state->reaped >= state->count);
+    pthread_mutex_unlock(&state->lock);
+    if (done) break;
+    int n = pd_reaper_wait(state->reaper, reaped, 32, 100);
+    pthread_mutex_lock(&state->lock);
+    for (int ii = 0; ii < n; ii++) {
+      std::map<int, int>::iterator it = state->index->find(reaped[ii].pd);
+      if (it == state->index->end()) {
+        state->seen_twice++;
+        continue;
+      }
+      if (reaped[ii].pid <= 0 || !WIFEXITED(reaped[ii].status) ||
+          WEXITSTATUS(reaped[ii].status) != it->second % 128) {
+        state->bad_status++;
+      }
+      state->index->erase(it);
+      state->reaped++;
+      close(reaped[ii].pd);
+    }
+    pthread_mutex_unlock(&state->lock);
+  }
+  return NULL;
+}
+
+TEST(Pdfork, ReaperMany) {
+  const int kCount = 2000;
+  static int pds[kCount];
+  int reaper = pd_reaper_create(PD_CLOEXEC);
+  EXPECT_OK(reaper);
+  EXPECT_SYSCALL_FAIL(EINVAL, pd_reaper_create(PD_DAEMON));
+
+  int count = PdforkMany(kCount, pds, reaper);
+  EXPECT_LT(100, count) << " only managed " << count << " children";
+  std::map<int, int> index;
+  for (int ii = 0; ii < count; ii++) index[pds[ii]] = ii;
+
+  // Reap them all from a small pool of threads.
+  const int kThreads = 4;
+  ReaperState state;
+  state.reaper = reaper;
+  state.count = count;
+  state.index = &index;
+  pthread_mutex_init(&state.lock, NULL);
+  state.reaped = state.seen_twice = state.bad_status = 0;
+  pthread_t threads[kThreads];
+  for (int ii = 0; ii < kThreads; ii++) {
+    EXPECT_OK(pthread_create(&threads[ii], NULL, ReaperThread, &state));
+  }
+  for (int ii = 0; ii < kThreads; ii++) {
+    EXPECT_OK(pthread_join(threads[ii], NULL));
+  }
+  pthread_mutex_destroy(&state.lock);
+  EXPECT_EQ(count, state.reaped);
+  EXPECT_EQ(0, state.seen_twice);
+  EXPECT_EQ(0, state.bad_status);
+  EXPECT_EQ(0U, index.size());
+
+  // Nothing left to reap.
+  struct pd_reaped reaped[4];
+  EXPECT_EQ(0, pd_reaper_wait(reaper, reaped, 4, 0));
+  close(reaper);
+}
+
+TEST_F(PipePdfork, Reaper) {
+  int reaper = pd_reaper_create(0);
+  EXPECT_OK(reaper);
+  EXPECT_OK(pd_reaper_add(reaper, pd_));
+  EXPECT_SYSCALL_FAIL(EEXIST, pd_reaper_add(reaper, pd_));
+  struct pd_reaped reaped[2];
+  // Still running, so nothing to reap.
+  EXPECT_EQ(0, pd_reaper_wait(reaper, reaped, 2, 0));
+  EXPECT_EQ(0, pd_reaper_wait(reaper, reaped, 2, 10));
+
+  // A removed descriptor isn't waited for...
+  EXPECT_OK(pd_reaper_remove(reaper, pd_));
+  TerminateChild();
+  EXPECT_EQ(0, pd_reaper_wait(reaper, reaped, 2, 100));
+  // ...until it's added back.
+  EXPECT_OK(pd_reaper_add(reaper, pd_));
+  EXPECT_EQ(1, pd_reaper_wait(reaper, reaped, 2, 2000));
+  EXPECT_EQ(pd_, reaped[0].pd);
+  EXPECT_EQ(pid_, reaped[0].pid);
+  EXPECT_TRUE(WIFEXITED(reaped[0].status));
+  EXPECT_EQ(0, WEXITSTATUS(reaped[0].status));
+  EXPECT_LE(0, reaped[0].rusage.ru_utime.tv_sec);
+  if (verbose) print_rusage(stderr, &reaped[0].rusage);
+  // Once reaped, it's gone from the set.
+  EXPECT_SYSCALL_FAIL(ENOENT, pd_reaper_remove(reaper, pd_));
+  pid_ = 0;
+  close(reaper);
+}
+#endif
@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <string.h>
+
+#include "capsicum.h"
+#include "capsicum-test.h"
+#include "capsicum-rights-builder.h"
+
+#ifdef CAP_RIGHTS_VERSION
+
+// Everything in this block has to be evaluated by the compiler.
+static constexpr cap_rights_t kReadSeek = CapRights(CAP_READ, CAP_SEEK);
+static_assert(CapRightsIsSet(kReadSeek, CAP_READ), "CAP_READ missing");
+static_assert(CapRightsIsSet(kReadSeek, CAP_READ, CAP_SEEK), "CAP_SEEK missing");
+static_assert(!CapRightsIsSet(kReadSeek, CAP_WRITE), "CAP_WRITE present");
+static_assert(!CapRightsIsSet(kReadSeek, CAP_EVENT), "CAP_EVENT present");
+static_assert(CapRightsContains(CapRightsSet(kReadSeek, CAP_WRITE), kReadSeek),
+              "set dropped a right");
+static_assert(!CapRightsIsSet(CapRightsClear(kReadSeek, CAP_SEEK), CAP_SEEK),
+              "clear kept a right");
+static_assert(CapRightsIsSet(CapRightsClear(kReadSeek, CAP_SEEK), CAP_READ),
+              "clear dropped too much");
+
+static void ExpectSameBits(const cap_rights_t& built, const cap_rights_t& runtime) {
+  for (size_t ii = 0; ii < sizeof(built.cr_rights) / sizeof(built.cr_rights[0]); ii++) {
+    EXPECT_EQ(runtime.cr_rights[ii], built.cr_rights[ii]) << " word " << ii;
+  }
+  EXPECT_EQ(0, memcmp(&built, &runtime, sizeof(built)));
+  EXPECT_RIGHTS_EQ(&built, &runtime);
+}
+
+TEST(RightsBuilder, MatchesInit) {
+  cap_rights_t r;
+
+  CAP_SET_NONE(&r);
+  ExpectSameBits(CapRights(), r);
+
+  cap_rights_init(&r, CAP_READ);
+  ExpectSameBits(CapRights(CAP_READ), r);
+
+  cap_rights_init(&r, CAP_READ, CAP_FSTAT, CAP_SEEK);
+  ExpectSameBits(CapRights(CAP_READ, CAP_FSTAT, CAP_SEEK), r);
+
+  // Rights from both words of the array.
+  cap_rights_init(&r, CAP_READ, CAP_EVENT, CAP_PDKILL, CAP_MMAP_RWX);
+  ExpectSameBits(CapRights(CAP_READ, CAP_EVENT, CAP_PDKILL, CAP_MMAP_RWX), r);
+
+  // Compound rights share bits with their components.
+  cap_rights_init(&r, CAP_PREAD, CAP_READ, CAP_SEEK);
+  ExpectSameBits(CapRights(CAP_PREAD, CAP_READ, CAP_SEEK), r);
+
+  cap_rights_init(&r, CAP_READ, CAP_FSTAT);
+  ExpectSameBits(CapRightsConstant<CAP_READ, CAP_FSTAT>::value, r);
+}
+
+TEST(RightsBuilder, MatchesSetClear) {
+  cap_rights_t r;
+  cap_rights_init(&r, CAP_READ, CAP_FSTAT);
+  constexpr cap_rights_t base = CapRights(CAP_READ, CAP_FSTAT);
+
+  cap_rights_set(&r, CAP_WRITE, CAP_EVENT);
+  constexpr cap_rights_t more = CapRightsSet(base, CAP_WRITE, CAP_EVENT);
+  ExpectSameBits(more, r);
+
+  cap_rights_clear(&r, CAP_FSTAT, CAP_EVENT);
+  constexpr cap_rights_t less = CapRightsClear(more, CAP_FSTAT, CAP_EVENT);
+  ExpectSameBits(less, r);
+
+  // Clearing a compound right removes all of its bits.
+  cap_rights_init(&r, CAP_PREAD, CAP_PWRITE);
+  cap_rights_clear(&r, CAP_SEEK);
+  ExpectSameBits(CapRightsClear(CapRights(CAP_PREAD, CAP_PWRITE), CAP_SEEK), r);
+
+  // The builder also works on runtime values.
+  cap_rights_t all;
+  CAP_SET_ALL(&all);
+  cap_rights_t built = CapRightsClear(all, CAP_READ);
+  cap_rights_clear(&all, CAP_READ);
+  ExpectSameBits(built, all);
+}
+
+TEST(RightsBuilder, MatchesIsSet) {
+  cap_rights_t r;
+  cap_rights_init(&r, CAP_READ, CAP_WRITE, CAP_EVENT);
+  constexpr cap_rights_t built = CapRights(CAP_READ, CAP_WRITE, CAP_EVENT);
+  EXPECT_EQ(cap_rights_is_set(&r, CAP_READ), CapRightsIsSet(built, CAP_READ));
+  EXPECT_EQ(cap_rights_is_set(&r, CAP_READ, CAP_EVENT),
+            CapRightsIsSet(built, CAP_READ, CAP_EVENT));
+  EXPECT_EQ(cap_rights_is_set(&r, CAP_SEEK), CapRightsIsSet(built, CAP_SEEK));
+  EXPECT_EQ(cap_rights_is_set(&r, CAP_PREAD), CapRightsIsSet(built, CAP_PREAD));
+  EXPECT_EQ(cap_rights_is_set(&r, CAP_PDWAIT), CapRightsIsSet(built, CAP_PDWAIT));
+  EXPECT_TRUE(cap_rights_is_valid(&built));
+}
+
+TEST(RightsBuilder, Limit) {
+  int fd = open("/etc/passwd", O_RDONLY);
+  EXPECT_OK(fd);
+  EXPECT_OK(cap_rights_limit(fd, &CapRightsConstant<CAP_READ, CAP_FSTAT>::value));
+  cap_rights_t rights;
+  EXPECT_OK(cap_rights_get(fd, &rights));
+  cap_rights_t expected = CapRights(CAP_READ, CAP_FSTAT);
+  EXPECT_RIGHTS_EQ(&expected, &rights);
+  close(fd);
+}
+
+#ifdef __linux__
+// The array entry points give the same answers as the one-at-a-time calls.
+TEST(Rights, ManyMatchesSingle) {
+  const int kCount = 37;  // not a multiple of any vector width
+  cap_rights_t have[kCount], want[kCount], merged[kCount], removed[kCount];
+  bool results[kCount];
+  for (int ii = 0; ii < kCount; ii++) {
+    cap_rights_init(&have[ii], CAP_READ, CAP_FSTAT);
+    if (ii & 1) cap_rights_set(&have[ii], CAP_SEEK);
+    if (ii & 2) cap_rights_set(&have[ii], CAP_EVENT, CAP_PDWAIT);
+    cap_rights_init(&want[ii], CAP_READ);
+    if (ii % 3 == 0) cap_rights_set(&want[ii], CAP_SEEK);
+    if (ii % 5 == 0) cap_rights_set(&want[ii], CAP_EVENT);
+  }
+  EXPECT_TRUE(cap_rights_is_valid_many(have, kCount));
+  EXPECT_TRUE(cap_rights_is_valid_many(want, kCount));
+
+  size_t expected = 0;
+  for (int ii = 0; ii < kCount; ii++)
+    expected += cap_rights_contains(&have[ii], &want[ii]);
+  EXPECT_LT(0U, expected);
+  EXPECT_GT((size_t)kCount, expected);
+  EXPECT_EQ(expected, cap_rights_contains_many(have, want, kCount, results));
+  EXPECT_EQ(expected, cap_rights_contains_many(have, want, kCount, NULL));
+
+  memcpy(merged, have, sizeof(merged));
+  memcpy(removed, have, sizeof(removed));
+  cap_rights_merge_many(merged, want, kCount);
+  cap_rights_remove_many(removed, want, kCount);
+  for (int ii = 0; ii < kCount; ii++) {
+    EXPECT_EQ(cap_rights_contains(&have[ii], &want[ii]), results[ii]) << " entry " << ii;
+    cap_rights_t r = have[ii];
+    cap_rights_merge(&r, &want[ii]);
+    EXPECT_EQ(0, memcmp(&r, &merged[ii], sizeof(r))) << " entry " << ii;
+    r = have[ii];
+    cap_rights_remove(&r, &want[ii]);
+    EXPECT_EQ(0, memcmp(&r, &removed[ii], sizeof(r))) << " entry " << ii;
+  }
+  EXPECT_TRUE(cap_rights_is_valid_many(merged, kCount));
+  EXPECT_TRUE(cap_rights_is_valid_many(removed, kCount));
+
+  // Validation covers every element, not just the first.
+  have[kCount - 1].cr_rights[1] = 0;
+  EXPECT_FALSE(cap_rights_is_valid_many(have, kCount));
+  EXPECT_TRUE(cap_rights_is_valid_many(have, kCount - 1));
+  EXPECT_TRUE(cap_rights_is_valid_many(have, 0));
+}
+#endif
+
+#endif  /* CAP_RIGHTS_VERSION */
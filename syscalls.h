@@ -238,6 +238,47 @@ static inline int connect_(int sockfd, const struct sockaddr *addr, socklen_t ad
 #define HAVE_SYSCALL
 #define HAVE_MKNOD_REG
 #define HAVE_MKNOD_SOCKET
+#define HAVE_FALLOCATE
+#define HAVE_MREMAP
+#define HAVE_SCHED_GETAFFINITY
+#define HAVE_CLOCK_NANOSLEEP
+/* Newer syscalls may lack libc wrappers, so call them directly. */
+#ifdef __NR_copy_file_range
+static inline ssize_t copy_file_range_(int fd_in, loff_t *off_in, int fd_out,
+                                       loff_t *off_out, size_t len, unsigned int flags) {
+  return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, flags);
+}
+#define HAVE_COPY_FILE_RANGE
+#endif
+#ifdef __NR_preadv2
+/* Offset is passed as two longs, low word first; -1 => use file position. */
+static inline ssize_t preadv2_(int fd, const struct iovec *iov, int iovcnt,
+                               off_t offset, int flags) {
+  return syscall(__NR_preadv2, fd, iov, iovcnt, (long)offset,
+                 (long)((int64_t)offset >> 32), flags);
+}
+static inline ssize_t pwritev2_(int fd, const struct iovec *iov, int iovcnt,
+                                off_t offset, int flags) {
+  return syscall(__NR_pwritev2, fd, iov, iovcnt, (long)offset,
+                 (long)((int64_t)offset >> 32), flags);
+}
+#define HAVE_PREADV2
+#endif
+#ifdef __NR_io_uring_setup
+struct io_uring_params;
+static inline int io_uring_setup_(unsigned int entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+static inline int io_uring_enter_(int fd, unsigned int to_submit,
+                                  unsigned int min_complete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+static inline int io_uring_register_(int fd, unsigned int opcode, const void *arg,
+                                     unsigned int nargs) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+#define HAVE_IO_URING
+#endif
 /*
  * O_BENEATH is arch-specific, via <asm/fcntl.h>; however we cannot include both that file
  * and the normal <fcntl.h> as they have some clashing definitions.  Bypass by directly